@@ -16,20 +16,24 @@
 #include <time.h>
 #include "AgMD2.h"
 
-#include "TCanvas.h"
-#include "TH1.h"
+#include "TString.h"
 #include "TApplication.h"
-#include "TGaxis.h"
 
 #include "RunParams.h"
 #include "ChannelParams.h"
+#include "Header.h"
+#include "OnlineFeatures.h"
+#include "SaturationScan.h"
+#include "LiveMonitor.h"
+#include "CalibrationCache.h"
+#include "Telemetry.h"
 
 #include "../date/include/date/date.h"
 
 class AgMD2_DAQ
 {
  public:
-  AgMD2_DAQ(){ };
+  AgMD2_DAQ() : forceCalibration(false) { };
   int app();
   void initialize_parameters();
   void calibrate();
@@ -40,28 +44,18 @@ class AgMD2_DAQ
   void checkApiCall(ViStatus status, char const* functionName);
   void Quit();
   ViSession GetSession() { return sess; }
+  void SetForceCalibration(bool f) { forceCalibration = f; }
 
  private:
   ViSession sess;
   void SetSession(ViSession s) {sess = s; }
   RunParams rp;
   std::map<ViUInt8, ChannelParams> cpm;
-
-  struct Header
-  {
-    ViInt64 memsize;
-    ViInt64 actualPoints;
-    ViInt64 firstValidPoint;
-    ViReal64 initialXOffset;
-    ViReal64 initialXTimeSeconds;
-    ViReal64 initialXTimeFraction;
-    ViReal64 xIncrement;
-    ViReal64 scaleFactor;
-    ViReal64 scaleOffset;
-    ViUInt8 channelNumber;
-    int eventNumber;
-    std::chrono::system_clock::time_point trigTime;
-  };
+  bool forceCalibration;
+  std::string serialNumber;
+  std::string firmwareRevision;
+  std::string calibration_fingerprint();
+  bool read_temperature(ViReal64 * t);
 
 };
 
@@ -0,0 +1,116 @@
+#ifndef CALIBRATIONCACHE_H
+#define CALIBRATIONCACHE_H
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <ctime>
+
+// Record of the last AgMD2_SelfCalibrate, so a restart with the same
+// instrument and configuration can skip it. The file is plain text in the
+// params.txt layout:
+//
+//   serial       <instrument serial number>
+//   config       <fingerprint of everything the calibration depends on>
+//   temperature  <board temperature in C, or "none">
+//   time         <unix time of the calibration>
+//   duration     <seconds AgMD2_SelfCalibrate took>
+//
+// The cache cannot see a power cycle of the digitizer. After one, start
+// DigiDaq with -calibrate (or delete the file).
+class CalibrationCache
+{
+ public:
+  struct Entry
+  {
+    std::string serial;
+    std::string config;
+    bool haveTemperature;
+    double temperature;
+    int64_t time;
+    double duration;
+
+    Entry() : haveTemperature(false), temperature(0), time(0), duration(0) {}
+  };
+
+  CalibrationCache(const std::string & p) : path(p) {}
+
+  bool Load(Entry * e)
+  {
+    std::ifstream in(path);
+    if (!in.is_open()) return false;
+    *e = Entry();
+    bool haveSerial = false, haveConfig = false, haveTime = false;
+    std::string line;
+    while (std::getline(in,line))
+      {
+	std::stringstream ss(line);
+	std::string key, val;
+	ss >> key >> val;
+	if (key.empty() || key[0] == '#') continue;
+	if (key == "serial") { e->serial = val; haveSerial = true; }
+	else if (key == "config") { e->config = val; haveConfig = true; }
+	else if (key == "temperature")
+	  {
+	    e->haveTemperature = (val != "none");
+	    if (e->haveTemperature) e->temperature = std::stod(val);
+	  }
+	else if (key == "time") { e->time = std::stoll(val); haveTime = true; }
+	else if (key == "duration") e->duration = std::stod(val);
+      }
+    return (haveSerial && haveConfig && haveTime);
+  }
+
+  // Written to a temporary file and renamed, so an interrupted write never
+  // leaves a half-valid cache behind.
+  bool Store(const Entry & e)
+  {
+    std::string tmp = path+".tmp";
+    FILE * f = fopen(tmp.c_str(),"w");
+    if (!f) return false;
+    fprintf(f,"# DigiDaq calibration cache, written after AgMD2_SelfCalibrate\n");
+    fprintf(f,"serial       %s\n",e.serial.c_str());
+    fprintf(f,"config       %s\n",e.config.c_str());
+    if (e.haveTemperature) fprintf(f,"temperature  %.2f\n",e.temperature);
+    else fprintf(f,"temperature  none\n");
+    fprintf(f,"time         %lld\n",(long long)e.time);
+    fprintf(f,"duration     %.3f\n",e.duration);
+    bool ok = (fclose(f) == 0);
+    if (ok) ok = (std::rename(tmp.c_str(),path.c_str()) == 0);
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+  }
+
+  void Invalidate() { std::remove(path.c_str()); }
+
+  // Empty when the cached calibration is still good for now, otherwise the
+  // reason to calibrate again. maxAge <= 0 never trusts the cache.
+  static std::string Check(const Entry & cached, const Entry & now, double maxAge, double maxDeltaT)
+  {
+    char buf[128];
+    if (maxAge <= 0) return "CalibrationMaxAge is 0";
+    if (cached.serial != now.serial) return "different instrument";
+    if (cached.config != now.config) return "configuration changed";
+    double age = (double)(now.time-cached.time);
+    if (age < 0 || age > maxAge)
+      {
+	snprintf(buf,sizeof(buf),"calibration is %.0f s old (max %.0f s)",age,maxAge);
+	return buf;
+      }
+    if (cached.haveTemperature != now.haveTemperature) return "temperature readout changed";
+    if (now.haveTemperature && std::fabs(now.temperature-cached.temperature) > maxDeltaT)
+      {
+	snprintf(buf,sizeof(buf),"temperature moved %.1f C (max %.1f C)",now.temperature-cached.temperature,maxDeltaT);
+	return buf;
+      }
+    return "";
+  }
+
+ private:
+  std::string path;
+};
+
+#endif
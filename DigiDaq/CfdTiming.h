@@ -0,0 +1,310 @@
+#ifndef CFDTIMING_H
+#define CFDTIMING_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "PulseFeatures.h"
+
+// Sub-sample timing of the leading edge: a digital constant fraction
+// discriminator and interpolated 10% / 90% crossings, in samples from the
+// first valid point (the Tdc units of pulsetree).
+//
+// The CFD signal is the delayed pulse minus fraction times the pulse,
+//   c[i] = p[i-delay]-fraction*p[i],   p = polarity*(x-baseline)
+// which goes negative on the leading edge and crosses zero at a time that
+// does not depend on the amplitude. The crossing, and the 10% and 90% ones
+// of p, lie between two samples j and j+1 and are interpolated with
+//   CFD_LINEAR  the straight line through j and j+1
+//   CFD_CUBIC   the cubic through j-1 .. j+2
+//   CFD_SINC    band limited (Lanczos, CFD_SINC_TAPS samples each side)
+// the last two solved by regula falsi on [j, j+1].
+//
+// Only the whole-waveform passes (baseline, peak) cost more than a few
+// samples; they run over fixed-size blocks so they vectorise. When the
+// features are already known, CfdTimingFrom() skips them.
+enum CfdInterpolation
+  {
+    CFD_LINEAR,
+    CFD_CUBIC,
+    CFD_SINC
+  };
+
+#define CFD_SINC_TAPS 4
+#define CFD_BLOCK 64
+
+struct CfdConfig
+{
+  float fraction;
+  int delay;            // samples
+  CfdInterpolation interpolation;
+
+  CfdConfig() : fraction(0.3f), delay(3), interpolation(CFD_LINEAR) {}
+};
+
+// -1 where there is no crossing (no pulse, or cut off by the record).
+struct PulseTiming
+{
+  float cfdTdc;
+  float t10Tdc;
+  float t90Tdc;
+};
+
+// p = polarity*(x-baseline), clamped at the ends of the record.
+template <typename T>
+struct CfdSignal
+{
+  const T * x;
+  int64_t n;
+  float pol;
+  float base;
+
+  float operator()(int64_t i) const
+  {
+    if (i < 0) i = 0;
+    if (i >= n) i = n-1;
+    return pol*((float)x[i]-base);
+  }
+};
+
+// c = p[i-delay]-fraction*p[i]
+template <typename T>
+struct CfdDifference
+{
+  CfdSignal<T> p;
+  int delay;
+  float fraction;
+
+  float operator()(int64_t i) const { return p(i-delay)-fraction*p(i); }
+};
+
+// g shifted down by level
+template <typename G>
+struct CfdLevel
+{
+  const G & g;
+  float level;
+
+  float operator()(int64_t i) const { return g(i)-level; }
+};
+
+// Root in u of f on [0,1], f(0) < 0 <= f(1), by regula falsi (Illinois).
+template <typename F>
+float CfdSolve(const F & f, float f0, float f1)
+{
+  float a = 0, b = 1;
+  float fa = f0, fb = f1;
+  int side = 0;
+  for (int it = 0; it < 12 && b-a > 1e-5f; ++it)
+    {
+      float u = (a*fb-b*fa)/(fb-fa);
+      float fu = f(u);
+      if (fu < 0)
+	{
+	  a = u;
+	  fa = fu;
+	  if (side == -1) fb *= 0.5f;
+	  side = -1;
+	}
+      else
+	{
+	  b = u;
+	  fb = fu;
+	  if (side == 1) fa *= 0.5f;
+	  side = 1;
+	}
+    }
+  return (fa == fb) ? a : (a*fb-b*fa)/(fb-fa);
+}
+
+struct CfdCubicAt
+{
+  float g0, g1, g2, g3;         // at j-1 .. j+2
+
+  float operator()(float u) const
+  {
+    return g0*(-u*(u-1)*(u-2)/6)+g1*((u+1)*(u-1)*(u-2)/2)
+      +g2*(-(u+1)*u*(u-2)/2)+g3*((u+1)*u*(u-1)/6);
+  }
+};
+
+// Lanczos kernel sinc(x) sinc(x/a), a = CFD_SINC_TAPS, at x = u-m for the
+// taps m = -a+1 .. a. sin(pi(u-m)) is +-sin(pi u) and sin(pi(u-m)/a) comes
+// from sin and cos of pi u/a, so one evaluation costs three sines.
+struct CfdSincAt
+{
+  float g[2*CFD_SINC_TAPS];     // at j-TAPS+1 .. j+TAPS
+  float sinm[2*CFD_SINC_TAPS];  // sin and cos of pi m/a
+  float cosm[2*CFD_SINC_TAPS];
+
+  CfdSincAt()
+  {
+    for (int k = 0; k < 2*CFD_SINC_TAPS; ++k)
+      {
+	double m = k-(CFD_SINC_TAPS-1);
+	sinm[k] = std::sin(M_PI*m/CFD_SINC_TAPS);
+	cosm[k] = std::cos(M_PI*m/CFD_SINC_TAPS);
+      }
+  }
+
+  float operator()(float u) const
+  {
+    const float pi = M_PI;
+    const float a = CFD_SINC_TAPS;
+    float su = std::sin(pi*u);
+    float sa = std::sin(pi*u/a);
+    float ca = std::cos(pi*u/a);
+    float s = 0;
+    for (int k = 0; k < 2*CFD_SINC_TAPS; ++k)
+      {
+	int m = k-(CFD_SINC_TAPS-1);
+	float x = u-m;
+	float w;
+	if (std::fabs(x) < 1e-6f) w = 1;
+	else w = a*((m & 1) ? -su : su)*(sa*cosm[k]-ca*sinm[k])/(pi*pi*x*x);
+	s += g[k]*w;
+      }
+    return s;
+  }
+};
+
+// Where g crosses zero between j and j+1, g(j) < 0 <= g(j+1).
+template <typename G>
+float CfdInterpolate(const G & g, int64_t j, CfdInterpolation method)
+{
+  float gj = g(j), gj1 = g(j+1);
+  if (gj1 == gj) return j;
+  float lin = -gj/(gj1-gj);
+  if (method == CFD_CUBIC)
+    {
+      CfdCubicAt c;
+      c.g0 = g(j-1);
+      c.g1 = gj;
+      c.g2 = gj1;
+      c.g3 = g(j+2);
+      return j+CfdSolve(c,gj,gj1);
+    }
+  if (method == CFD_SINC)
+    {
+      CfdSincAt s;
+      for (int k = 0; k < 2*CFD_SINC_TAPS; ++k) s.g[k] = g(j-(CFD_SINC_TAPS-1)+k);
+      return j+CfdSolve(s,gj,gj1);
+    }
+  return j+lin;
+}
+
+// The timing of one record whose baseline, peak and amplitude are known
+// (e.g. from ExtractPulseFeatures).
+template <typename T>
+void CfdTimingFrom(const T * wf, int64_t wf_size, int source, float baseAdc, int64_t peak, float amplitude,
+		   const CfdConfig & cfg, PulseTiming * t)
+{
+  t->cfdTdc = t->t10Tdc = t->t90Tdc = -1;
+  if (wf_size < 2 || amplitude <= 0 || peak <= 0 || peak >= wf_size) return;
+  CfdSignal<T> p;
+  p.x = wf;
+  p.n = wf_size;
+  p.pol = (source < 0) ? -1 : 1;
+  p.base = baseAdc;
+
+  // the leading edge: back from the peak to the last sample under 10%
+  CfdLevel<CfdSignal<T> > l10 = { p, 0.1f*amplitude };
+  CfdLevel<CfdSignal<T> > l90 = { p, 0.9f*amplitude };
+  int64_t j10 = peak-1;
+  while (j10 >= 0 && l10(j10) >= 0) --j10;
+  if (j10 < 0) return;
+  t->t10Tdc = CfdInterpolate(l10,j10,cfg.interpolation);
+  int64_t j90 = peak-1;
+  while (j90 > j10 && l90(j90) >= 0) --j90;
+  t->t90Tdc = CfdInterpolate(l90,j90,cfg.interpolation);
+
+  // from the bottom of the negative lobe of c (not some noise wiggle
+  // before it) to the first sample back at >= 0
+  CfdDifference<T> c;
+  c.p = p;
+  c.delay = cfg.delay;
+  c.fraction = cfg.fraction;
+  int64_t end = peak+cfg.delay < wf_size ? peak+cfg.delay : wf_size-1;
+  int64_t j = j10;
+  float lowest = c(j);
+  for (int64_t k = j10+1; k <= end; ++k)
+    {
+      float ck = c(k);
+      if (ck < lowest)
+	{
+	  lowest = ck;
+	  j = k;
+	}
+    }
+  if (lowest >= 0) return;
+  while (j < end && c(j+1) < 0) ++j;
+  if (j >= end) return;
+  t->cfdTdc = CfdInterpolate(c,j,cfg.interpolation);
+}
+
+template <typename T>
+void CfdTimingFrom(const T * wf, int64_t wf_size, int source, const PulseFeatures & f, const CfdConfig & cfg, PulseTiming * t)
+{
+  CfdTimingFrom(wf,wf_size,source,f.baseAdc,(int64_t)f.peaktimeTdc,f.amplitudeAdc,cfg,t);
+}
+
+template <typename T> struct CfdAccumulator { typedef float type; };
+template <> struct CfdAccumulator<int8_t> { typedef int32_t type; };
+
+// The timing of one record on its own: baseline over the first quarter and
+// the first maximum, as ExtractPulseFeatures.
+template <typename T>
+void CfdTiming(const T * wf, int64_t wf_size, int source, const CfdConfig & cfg, PulseTiming * t)
+{
+  typedef typename CfdAccumulator<T>::type acc;
+  int64_t nb = (int64_t)(wf_size*0.25);
+  acc sum = 0;
+  int64_t i = 0;
+  for (; i+CFD_BLOCK <= nb; i += CFD_BLOCK)
+    {
+      acc s = 0;
+      for (int k = 0; k < CFD_BLOCK; ++k) s += wf[i+k];
+      sum += s;
+    }
+  for (; i < nb; ++i) sum += wf[i];
+  float base = nb > 0 ? (float)((double)sum/nb) : 0;
+
+  // largest polarity*x, block maxima first
+  const acc pol = (source < 0) ? -1 : 1;
+  acc best = pol*(acc)wf[0];
+  int64_t peak = 0;
+  for (i = 0; i+CFD_BLOCK <= wf_size; i += CFD_BLOCK)
+    {
+      T hi = wf[i], lo = wf[i];
+      for (int k = 0; k < CFD_BLOCK; ++k)
+	{
+	  hi = wf[i+k] > hi ? wf[i+k] : hi;
+	  lo = wf[i+k] < lo ? wf[i+k] : lo;
+	}
+      acc m = (pol > 0) ? (acc)hi : -(acc)lo;
+      if (m > best)
+	{
+	  best = m;
+	  peak = i;
+	}
+    }
+  for (int64_t k = i; k < wf_size; ++k)
+    if (pol*(acc)wf[k] > best)
+      {
+	best = pol*(acc)wf[k];
+	peak = k;
+      }
+  while (pol*(acc)wf[peak] != best) ++peak;
+  CfdTimingFrom(wf,wf_size,source,base,peak,(float)best-pol*base,cfg,t);
+}
+
+// CfdTiming() over count records, wf[r] of wf_size[r] samples, one after
+// the other (the vector work is within each record, in the block passes).
+template <typename T>
+void CfdTimingRecords(const T * const * wf, const int64_t * wf_size, const int * source, int count,
+		      const CfdConfig & cfg, PulseTiming * t)
+{
+  for (int r = 0; r < count; ++r) CfdTiming(wf[r],wf_size[r],source[r],cfg,&t[r]);
+}
+
+#endif
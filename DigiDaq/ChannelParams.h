@@ -14,6 +14,7 @@ class ChannelParams
   ViReal64 channelOffset; bool setCO = false;
   ViReal64 triggerLevel; bool setTL = false;
   ViInt32 triggerSlope; bool setTSl = false;
+  ViInt16 pulseSign; bool setPS = false;   // optional, from triggerSlope
   ViChar triggerSource[16]; bool setTSo = false;
   ViBoolean activeTrigger; bool setAT = false;
   bool updated;
@@ -47,6 +48,9 @@ class ChannelParams
   
   ViReal64 GetTriggerLevel() { return triggerLevel; }
   ViInt32 GetTriggerSlope() { return triggerSlope; }
+  // Sign of the pulses, as the sign of cX for waveform. Without PulseSign
+  // the pulse goes the way the trigger fires on: slope 0 (negative) -1.
+  ViInt16 GetPulseSign() { return setPS ? pulseSign : (triggerSlope == 0 ? -1 : 1); }
   ViChar * GetTriggerSource() { return triggerSource; }
   ViBoolean GetActiveTrigger() { return activeTrigger; }
   
@@ -120,6 +124,22 @@ class ChannelParams
     updated = true;
   }
 
+  void UpdatePulseSign(ViInt16 ps)
+  {
+    if (ps != 1 && ps != -1)
+      {
+	printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+	printf("Pulse sign %i is invalid.\n",ps);
+	printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+	setPS = false;
+      }
+    else
+      {
+	pulseSign = ps;
+	setPS = true;
+      }
+  }
+
   void UpdateChannelNickname(char * nn)
   {
     sprintf(channelNickname,"%s",nn);
@@ -2,10 +2,22 @@
 
 int main(int argc, char** argv)
 {
+  // -calibrate forces AgMD2_SelfCalibrate even when the cached calibration
+  // is still good. Taken out before TApplication sees the arguments.
+  bool forceCalibration = false;
+  int nargs = 1;
+  for (int i = 1; i < argc; ++i)
+    {
+      if (std::string(argv[i]) == "-calibrate") forceCalibration = true;
+      else argv[nargs++] = argv[i];
+    }
+  argc = nargs;
+
   TApplication app("daq",&argc, argv);
   app.ExitOnException();
 
   AgMD2_DAQ daqApp;
+  daqApp.SetForceCalibration(forceCalibration);
   daqApp.app();
 
   app.Run();
@@ -95,8 +107,10 @@ void AgMD2_DAQ::initialize_driver()
   printf("Instrument model:   %s\n", str);
   checkApiCall(AgMD2_GetAttributeViString(session, "", AGMD2_ATTR_INSTRUMENT_FIRMWARE_REVISION, sizeof(str), str), "AgMD2_GetAttributeViString(AGMD2_ATTR_INSTRUMENT_FIRMWARE_REVISION)");
   printf("Firmware revision:  %s\n", str);
+  firmwareRevision = str;
   checkApiCall(AgMD2_GetAttributeViString(session, "", AGMD2_ATTR_INSTRUMENT_INFO_SERIAL_NUMBER_STRING, sizeof(str), str), "AgMD2_GetAttributeViString(AGMD2_ATTR_INSTRUMENT_INFO_SERIAL_NUMBER_STRING)");
   printf("Serial number:      %s\n", str);
+  serialNumber = str;
   checkApiCall(AgMD2_GetAttributeViString(session, "", AGMD2_ATTR_INSTRUMENT_INFO_OPTIONS, sizeof(str), str), "AgMD2_GetAttributeViString(AGMD2_ATTR_INSTRUMENT_INFO_OPTIONS)");
   printf("Instrument options: %s\n", str);
   ViInt32 channelcount;
@@ -144,7 +158,8 @@ void AgMD2_DAQ::configure_channels()
 void AgMD2_DAQ::configure_acquisition()
 {
   ViSession session = GetSession();
-  printf("\nNumber of records:  %li\n", rp.GetNumRecords());
+  printf("\nNumber of records:  %li%s\n", rp.GetNumRecords(),
+	 rp.GetOnlineFeatures() ? " (with features, saved or not)" : "");
   printf("Record size:        %li\n", rp.GetRecordSize());
   printf("Sample rate:        %g\n", rp.GetSampleRate());
   checkApiCall(AgMD2_SetAttributeViInt64(session, "", AGMD2_ATTR_NUM_RECORDS_TO_ACQUIRE, 1), "AgMD2_SetAttributeViInt64(AGMD2_ATTR_NUM_RECORDS_TO_ACQUIRE)");
@@ -212,12 +227,74 @@ void AgMD2_DAQ::configure_triggers()
   checkApiCall(AgMD2_SetAttributeViReal64(session, "", AGMD2_ATTR_TRIGGER_DELAY, triggerdelay), "AgMD2_SetAttributeViReal64(AGMD2_ATTR_TRIGGER_DELAY)");
 }
 
+// Everything the self-calibration depends on. Whitespace free, it is
+// stored as one word in the calibration cache.
+std::string AgMD2_DAQ::calibration_fingerprint()
+{
+  std::stringstream ss;
+  ss << "fw=" << firmwareRevision << ";sr=" << rp.GetSampleRate();
+  auto itr = cpm.begin();
+  while (itr != cpm.end())
+    {
+      if (itr->second.GetUseChannel())
+	{
+	  ss << ";ch" << (int)itr->first
+	     << "=" << itr->second.GetChannelRange()
+	     << "," << itr->second.GetChannelOffset();
+	}
+      itr++;
+    }
+  std::string fp = ss.str();
+  std::replace(fp.begin(),fp.end(),' ','_');
+  return fp;
+}
+
+// Board temperature, when the driver version has the attribute.
+bool AgMD2_DAQ::read_temperature(ViReal64 * t)
+{
+#ifdef AGMD2_ATTR_BOARD_TEMPERATURE
+  return (AgMD2_GetAttributeViReal64(GetSession(), "", AGMD2_ATTR_BOARD_TEMPERATURE, t) == VI_SUCCESS);
+#else
+  (void)t;
+  return false;
+#endif
+}
+
 void AgMD2_DAQ::calibrate()
 {
   ViSession session = GetSession();
+
+  CalibrationCache cache(rp.GetCalibrationFile());
+  CalibrationCache::Entry now;
+  now.serial = serialNumber;
+  now.config = calibration_fingerprint();
+  now.haveTemperature = read_temperature(&now.temperature);
+  now.time = (int64_t)std::time(0);
+
+  std::string reason = "forced with -calibrate";
+  CalibrationCache::Entry cached;
+  if (!forceCalibration)
+    {
+      if (cache.Load(&cached)) reason = CalibrationCache::Check(cached,now,rp.GetCalibrationMaxAge(),rp.GetCalibrationMaxDeltaT());
+      else reason = "no calibration cache";
+    }
+
+  if (reason.empty())
+    {
+      printf("Skipping self-calibration: cached calibration is %lli s old",(long long)(now.time-cached.time));
+      if (now.haveTemperature) printf(", temperature %.1f C (was %.1f C)",now.temperature,cached.temperature);
+      printf(", saves ~%.1f s\n",cached.duration);
+      return;
+    }
+
   // Calibrate the instrument.
-  printf("Performing self-calibration\n");
+  printf("Performing self-calibration (%s)\n",reason.c_str());
+  cache.Invalidate();
+  auto start = std::chrono::steady_clock::now();
   checkApiCall(AgMD2_SelfCalibrate(session), "AgMD2_SelfCalibrate");
+  now.duration = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  printf("Self-calibration took %.1f s\n",now.duration);
+  if (!cache.Store(now)) printf("** Warning: could not write calibration cache %s\n",rp.GetCalibrationFile().c_str());
 }
 
 
@@ -282,6 +359,39 @@ void AgMD2_DAQ::initialize_parameters()
 	      {
 		rp.SetDutyCycle(std::stod(parval));
 	      }
+	    else if (parname == "OnlineFeatures")
+	      {
+		if (parval == "true") rp.SetOnlineFeatures(true);
+		else if (parval == "false") rp.SetOnlineFeatures(false);
+	      }
+	    else if (parname == "FeatureThreads")
+	      {
+		rp.SetFeatureThreads(std::stoi(parval));
+	      }
+	    else if (parname == "SaveAmplitudeAbove")
+	      {
+		rp.SetSaveAmplitudeAbove(std::stod(parval));
+	      }
+	    else if (parname == "StatsFile")
+	      {
+		rp.SetStatsFile(parval);
+	      }
+	    else if (parname == "StatsInterval")
+	      {
+		rp.SetStatsInterval(std::stod(parval));
+	      }
+	    else if (parname == "CalibrationFile")
+	      {
+		rp.SetCalibrationFile(parval);
+	      }
+	    else if (parname == "CalibrationMaxAge")
+	      {
+		rp.SetCalibrationMaxAge(std::stod(parval));
+	      }
+	    else if (parname == "CalibrationMaxDeltaT")
+	      {
+		rp.SetCalibrationMaxDeltaT(std::stod(parval));
+	      }
 	  }
 	else 
 	  {
@@ -324,6 +434,10 @@ void AgMD2_DAQ::initialize_parameters()
 		  {
 		    cp->UpdateTriggerSlope(std::stoi(parval));
 		  }
+		else if (parname == "PulseSign")
+		  {
+		    cp->UpdatePulseSign(std::stoi(parval));
+		  }
 		else if (parname == "ActiveTrigger")
 		  {
 		    if (parval == "true") cp->UpdateActiveTrigger(true);
@@ -343,6 +457,7 @@ void handler(int)
 
 int AgMD2_DAQ::app()
 {
+  auto startup = std::chrono::steady_clock::now();
   initialize_parameters();
   bool complete = true;
   if (!rp.Complete()) {
@@ -379,6 +494,8 @@ int AgMD2_DAQ::app()
 
   calibrate();
 
+  printf("Startup took %.1f s\n\n",std::chrono::duration<double>(std::chrono::steady_clock::now()-startup).count());
+
   struct sigaction action;
   memset(&action, 0, sizeof(struct sigaction));
   action.sa_handler = handler;
@@ -402,98 +519,133 @@ int AgMD2_DAQ::app()
       std::cerr << "error: open file for output failed!" << std::endl;
       return -1;
     }
-  
-  TCanvas* canv;
-  std::map<ViUInt8, TH1I*> histMap;
-  std::map<ViUInt8, TGaxis*> axMap;
 
-  int clipmax = 0, clipmin = 0;
-
-  if (rp.GetDraw())
+  // In online mode every trigger is fetched and reduced to FeatureRows,
+  // SaveDutyCycle then only prescales which full waveforms are kept.
+  bool online = rp.GetOnlineFeatures();
+  std::ofstream featout;
+  OnlineFeatures * features = 0;
+  if (online)
     {
-      canv = new TCanvas("c","DigiView",1400, 800);
-
+      TString featname = TString::Format("DAQ_%04i%02i%02i_%02i%02i%02i_features.dat",(int)(ymd.year()),(unsigned)(ymd.month()),(unsigned)(ymd.day()),time.hours().count(),time.minutes().count(),(unsigned)time.seconds().count());
+      featout.open(featname,std::ios::out|std::ios::binary);
+      if (!featout.is_open())
+	{
+	  std::cerr << "error: open feature file for output failed!" << std::endl;
+	  return -1;
+	}
+      printf("Online features: %i threads, writing %s\n",rp.GetFeatureThreads(),featname.Data());
+      features = new OnlineFeatures(rp.GetFeatureThreads(),64,&fileout,&featout,rp.GetSaveAmplitudeAbove());
+    }
+  
+  // Drawing happens in DigiView, which attaches to this shared-memory
+  // segment whenever it likes. Publishing costs the same with or without it.
+  LivePublisher live;
+  bool publish = rp.GetDraw() && live.Open();
+  if (publish)
+    {
+      printf("Publishing waveforms to %s, run ./DigiView to look at them\n",LIVEMONITOR_NAME);
       itr = cpm.begin();
       while (itr != cpm.end())
 	{
-	  if (!itr->second.GetUseChannel())
-	    {
-	      itr++;
-	      continue;
-	    }
-	  TString name = "h"; name += itr->first;
-	  TString title = itr->second.GetChannelNickname();
-	  histMap.emplace(itr->first,new TH1I(name.Data(),title.Data(),rp.GetRecordSize(),0,0));
-	  axMap.emplace(itr->first,new TGaxis(1,0,1,1,0,1,510,"+L"));
+	  if (itr->second.GetUseChannel()) live.SetNickname(itr->first,itr->second.GetChannelNickname());
 	  itr++;
 	}
     }
-  
+
   bool saturation_flag_high = false;
   bool saturation_flag_low = false;
   unsigned int success = 0;
 
   int pcount = 0;
 
-  int i_record;
-  bool print = false;
+  // Per-phase timing and rates, written to the stats file once per
+  // StatsInterval. Nothing is printed per record.
+  Telemetry tel(rp.GetStatsFile(),rp.GetStatsInterval());
+  TelemetryCounts counts;
+  int npublished = 0;
+  printf("Writing run statistics to %s every %g s\n",rp.GetStatsFile().c_str(),rp.GetStatsInterval());
+  // between records, and between the slices of a long wait for a trigger
+  auto publishStats = [&]()
+    {
+      counts.saved = online ? features->Saved() : counts.recorded;
+      tel.Publish(counts);
+      // bounds how far waveform -follow lags behind at low rates
+      if (online) features->Flush();
+      else fileout.flush();
+      if (++npublished % 10 == 0)
+	{
+	  printf("%llu triggers, %llu recorded, %llu rejected\n",
+		 (unsigned long long)counts.triggers,
+		 (unsigned long long)counts.recorded,
+		 (unsigned long long)counts.rejected);
+	}
+      tel.Lap(TELEMETRY_PUBLISH);
+    };
+  tel.Start();
+
+  // NumRecords counts unsaturated records: those saved, or with
+  // OnlineFeatures every one with features, saved or not
+  int i_record = 0;
   try
     {
       for (i_record = 0; success < rp.GetNumRecords(); ++i_record)
 	{
 	  ++pcount;
 
-	  if (/*i_record % 100 == 0 &&*/ pcount*rp.GetDutyCycle() >= 1)
-	    {
-	      print = true;
-	    }
-	  else
-	    {
-	      print = false;
-	    }
-	  
 	  if (sig_caught) break;
+
+	  if (tel.Due()) publishStats();
       
 	  head.eventNumber = i_record;
 
-	  if (print)
-	    {
-	      std::cout << "Event " << success << " -- Init" << std::flush;
-	    }
-
 	  checkApiCall(AgMD2_InitiateAcquisition(session), "AgMD2_InitiateAcquisition");
+	  tel.Lap(TELEMETRY_INITIATE);
 
-	  if (print)
-	    {
-	      std::cout << ", Waiting" << std::flush;
-	    }
 	  // this is cheating vvvvvvvvv
 	  //checkApiCall(AgMD2_SendSoftwareTrigger(session), "AgMD2_SendSoftwareTrigger");
   
-	  checkApiCall(AgMD2_WaitForAcquisitionComplete(session, rp.GetTimeoutInMS()), "AgMD2_WaitForAcquisitionComplete");
-	  head.trigTime = std::chrono::system_clock::now();
-
-	  if (pcount*rp.GetDutyCycle() < 1) 
+	  // Wait in slices of at most TELEMETRY_WAIT_SLICE_MS, so that the
+	  // stats are still written and Ctrl+C still ends the run while no
+	  // trigger comes (TimeoutInMS -1 waits for ever)
+	  ViInt32 remaining = rp.GetTimeoutInMS();
+	  ViStatus waited;
+	  for (;;)
 	    {
-	      continue;
+	      ViInt32 slice = (remaining < 0 || remaining > TELEMETRY_WAIT_SLICE_MS) ? TELEMETRY_WAIT_SLICE_MS : remaining;
+	      waited = AgMD2_WaitForAcquisitionComplete(session, slice);
+	      if (waited != AGMD2_ERROR_MAX_TIME_EXCEEDED || sig_caught) break;
+	      if (remaining >= 0 && (remaining -= slice) <= 0) break;
+	      tel.Lap(TELEMETRY_WAIT);
+	      if (tel.Due()) publishStats();
 	    }
-	  pcount = 0;
-
-	  if (print)
+	  if (sig_caught && waited == AGMD2_ERROR_MAX_TIME_EXCEEDED)
 	    {
-	      std::cout << ", Acquiring" << std::flush;
+	      checkApiCall(AgMD2_Abort(session), "AgMD2_Abort");
+	      break;
 	    }
+	  checkApiCall(waited, "AgMD2_WaitForAcquisitionComplete");
+	  head.trigTime = std::chrono::system_clock::now();
+	  tel.Lap(TELEMETRY_WAIT);
+	  ++counts.triggers;
+	  if (publish) live.UpdateCounters(counts.triggers,success,counts.clipHigh,counts.clipLow);
 
-	  checkApiCall(AgMD2_QueryMinWaveformMemory(session, 8, 1, 0, rp.GetRecordSize(), &head.memsize), "AgMD2_QueryMinWaveformMemory");
-      
-	  if (print)
+	  bool keep = (pcount*rp.GetDutyCycle() >= 1);
+	  if (!keep && !online) 
 	    {
-	      std::cout << ", Writing " << std::flush;
+	      continue;
 	    }
+	  if (keep) pcount = 0;
+	  ++counts.fetched;
+
+	  checkApiCall(AgMD2_QueryMinWaveformMemory(session, 8, 1, 0, rp.GetRecordSize(), &head.memsize), "AgMD2_QueryMinWaveformMemory");
 	  
 	  saturation_flag_high = false;
 	  saturation_flag_low = false;
 
+	  OnlineFeatures::Event * ev = 0;
+	  if (online) ev = features->Acquire();
+
 	  itr = cpm.begin();
 
 	  while (itr != cpm.end())
@@ -504,7 +656,16 @@ int AgMD2_DAQ::app()
 		  continue;
 		}
 	      head.channelNumber = itr->second.GetChannelNumber();
-	      ViInt8* dataArray = new ViInt8[head.memsize];
+	      ViInt8* dataArray;
+	      if (online)
+		{
+		  ev->data[ev->nchan].resize(head.memsize);
+		  dataArray = ev->data[ev->nchan].data();
+		}
+	      else
+		{
+		  dataArray = new ViInt8[head.memsize];
+		}
 	      checkApiCall(AgMD2_FetchWaveformInt8(session,
 						   itr->second.GetChannelName(),
 						   head.memsize,
@@ -518,96 +679,98 @@ int AgMD2_DAQ::app()
 						   &head.scaleFactor,
 						   &head.scaleOffset),
 			   "AgMD2_FetchWaveformInt8");
-
-	      if (rp.GetDraw())
-		{
-		  histMap[head.channelNumber]->Reset();
-		  histMap[head.channelNumber]->GetYaxis()->SetRangeUser(-128,128);
-		  histMap[head.channelNumber]->SetBins(head.actualPoints-1,head.initialXOffset,head.initialXOffset+(head.xIncrement * head.actualPoints));
-		}
-
-	      for (int i = 0; i < head.actualPoints; i++)
-		{
-		  int pol = itr->second.GetChannelPolarity();
-		  //int pol = 1;
-		  int val = pol*dataArray[i+head.firstValidPoint];
-	 
-		  if (rp.GetDraw())
-		    {
-		      histMap[head.channelNumber]->SetBinContent(i,val);
-		    }
-		  if (val >= 127) saturation_flag_high = true;
-		  if (val <= -127) saturation_flag_low = true;
-		}
+	      tel.Lap(TELEMETRY_FETCH);
+
+	      // polarity flip and saturation test in one pass, stopping at the
+	      // first saturated sample since the event is rejected
+	      int saturation = ScanSaturation(dataArray+head.firstValidPoint,
+					      head.actualPoints,
+					      itr->second.GetChannelPolarity(),
+					      0,
+					      true);
+	      if (saturation & SATURATION_HIGH) saturation_flag_high = true;
+	      if (saturation & SATURATION_LOW) saturation_flag_low = true;
 	      
 	      if (saturation_flag_high || saturation_flag_low)
 		{
-		  delete[] dataArray;
-		  if (print)
-		    {
-		      std::cout << "X" << std::flush;
-		    }
+		  if (!online) delete[] dataArray;
+		  tel.Lap(TELEMETRY_WRITE);
 		  break;
 		}
 	      
 	      
+	      if (publish) live.Publish(head,itr->second.GetChannelPolarity(),dataArray);
 
-	      fileout.write((char*)&head,sizeof(Header));
-	      fileout.write((char*)dataArray,head.memsize*sizeof(ViInt8));
-	      
-	      delete[] dataArray;
-	      if (print)
+	      if (online)
+		{
+		  ev->head[ev->nchan] = head;
+		  ev->source[ev->nchan] = itr->second.GetPulseSign();
+		  ++ev->nchan;
+		}
+	      else
 		{
-		  std::cout << (int)head.channelNumber << std::flush;
-		}	      
+		  fileout.write((char*)&head,sizeof(Header));
+		  fileout.write((char*)dataArray,head.memsize*sizeof(ViInt8));
+		  delete[] dataArray;
+		}
+	      tel.Lap(TELEMETRY_WRITE);
 	      itr++;
 	    }
-	  if (print)
+
+	  if (saturation_flag_high) ++counts.clipHigh;
+	  if (saturation_flag_low) ++counts.clipLow;
+
+	  if (online)
 	    {
-	      std::cout << ", Finished, " << success << " Recorded" << std::flush;
+	      if (saturation_flag_high || saturation_flag_low) features->Release(ev);
+	      else
+		{
+		  ev->keep = keep;
+		  features->Submit(ev);
+		}
+	      tel.Lap(TELEMETRY_WRITE);
 	    }
 
-	  if (saturation_flag_high) ++clipmax;
-	  if (saturation_flag_low) ++clipmin;
-
 	  if (!saturation_flag_high && !saturation_flag_low)
 	    {
 	      success++;
-	      
-	      if (rp.GetDraw())
-		{
-		  int canvnumber = 1;
-		  for (std::map<ViUInt8, TH1I*>::iterator hitr = histMap.begin(); hitr != histMap.end(); ++hitr) 
-		    {
-		      canv->cd(canvnumber);
-		      histMap[hitr->first]->Draw();
-		      canv->Update();
-		      axMap[hitr->first]->DrawAxis(gPad->GetUxmax(),gPad->GetUymin(),gPad->GetUxmax()-0.0000000001,gPad->GetUymax(),gPad->GetUymin()*head.scaleFactor+head.scaleOffset,gPad->GetUymax()*head.scaleFactor+head.scaleOffset,510,"+L");
-		      canv->Update();
-		      canvnumber++;
-		    }
-		  canv->Modified();
-		  canv->Update();
-		}	    
+	      ++counts.recorded;
 	    }
-	  
-	  if (print)
+	  else
 	    {
-	      std::cout << std::endl << std::flush;
+	      ++counts.rejected;
 	    }
 	}
     }
   catch (std::exception e) {}
 
+  if (online)
+    {
+      features->Finish();
+      featout.close();
+    }
   fileout.close();
+  if (publish) live.UpdateCounters(counts.triggers,success,counts.clipHigh,counts.clipLow);
+  counts.saved = online ? features->Saved() : counts.recorded;
+  tel.Publish(counts);
 
   auto end = std::chrono::system_clock::now();
   std::cout << "Time = " << end-now << " seconds" << std::endl; 
   
   std::cout << "\n " << success << " events recorded." << std::endl;
 
-  std::cout << "\n " << clipmin << " events out of range LOW" << std::endl;
-  std::cout << "\n " << clipmax << " events out of range HIGH" << std::endl;
+  std::cout << "\n " << counts.clipLow << " events out of range LOW" << std::endl;
+  std::cout << "\n " << counts.clipHigh << " events out of range HIGH" << std::endl;
+
+  tel.Summary(counts);
+
+  if (online)
+    {
+      std::cout << "\n " << features->Processed() << " events with online features, "
+		<< features->Saved() << " waveforms saved, "
+		<< features->Stalls() << " stalls waiting for a free slot" << std::endl;
+      delete features;
+    }
 
   Quit();
 
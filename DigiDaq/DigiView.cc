@@ -0,0 +1,139 @@
+/**********************************************
+Live waveform viewer for DigiDaq.
+
+Build with:
+ make DigiView
+
+Run:
+ ./DigiView [refresh interval in ms, default 200]
+
+DigiDaq publishes the latest waveform of every channel to a shared-memory
+segment when "global Draw true" is set in params.txt. This viewer attaches
+to it, draws whatever is newest at the refresh interval and detaches again
+when DigiDaq exits (it keeps waiting for the next run). Starting or
+stopping the viewer does not change anything for the acquisition.
+**********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <signal.h>
+#include <unistd.h>
+
+#include "TCanvas.h"
+#include "TH1.h"
+#include "TApplication.h"
+#include "TGaxis.h"
+#include "TSystem.h"
+
+#include "LiveMonitor.h"
+#include "SaturationScan.h"
+
+volatile sig_atomic_t sig_caught = 0;
+
+void handler(int)
+{
+  sig_caught = 1;
+}
+
+int main(int argc, char** argv)
+{
+  int refresh = 200;
+  if (argc > 1) refresh = std::atoi(argv[1]);
+  if (refresh < 10) refresh = 10;
+
+  TApplication app("view",&argc,argv);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(struct sigaction));
+  action.sa_handler = handler;
+  sigaction(SIGINT, &action, NULL);
+
+  TCanvas * canv = new TCanvas("c","DigiView",1400,800);
+  TH1I * hist[LIVEMONITOR_CHANNELS];
+  TGaxis * axis[LIVEMONITOR_CHANNELS];
+  uint32_t lastSeq[LIVEMONITOR_CHANNELS];
+  for (int c = 0; c < LIVEMONITOR_CHANNELS; ++c)
+    {
+      hist[c] = new TH1I(TString::Format("h%i",c+1),TString::Format("Channel%i",c+1),1,0,1);
+      axis[c] = new TGaxis(1,0,1,1,0,1,510,"+L");
+      lastSeq[c] = 0;
+    }
+
+  // one channel copy is ~64 kB, keep it off the stack
+  static LiveChannel buf;
+  LiveCounters counters;
+  LiveReader reader;
+  uint32_t layout = 0;
+
+  while (!sig_caught)
+    {
+      if (!reader.Attached())
+	{
+	  if (!reader.Attach())
+	    {
+	      gSystem->ProcessEvents();
+	      usleep(500000);
+	      continue;
+	    }
+	  printf("Attached to %s\n",LIVEMONITOR_NAME);
+	  layout = 0;
+	  for (int c = 0; c < LIVEMONITOR_CHANNELS; ++c) lastSeq[c] = 0;
+	}
+      if (!reader.Alive())
+	{
+	  printf("DigiDaq went away, waiting for the next run\n");
+	  reader.Detach();
+	  continue;
+	}
+
+      uint32_t mask = reader.ChannelMask();
+      if (mask != layout)
+	{
+	  int npads = __builtin_popcount(mask);
+	  canv->Clear();
+	  if (npads > 1) canv->Divide(npads);
+	  layout = mask;
+	  for (int c = 0; c < LIVEMONITOR_CHANNELS; ++c) lastSeq[c] = 0;
+	}
+
+      int pad = 0;
+      for (int c = 0; c < LIVEMONITOR_CHANNELS; ++c)
+	{
+	  if (!(mask & (1u<<c))) continue;
+	  ++pad;
+	  uint32_t seq = reader.ReadChannel(c+1,&buf);
+	  if (seq == lastSeq[c]) continue;
+	  lastSeq[c] = seq;
+
+	  int64_t n = buf.actualPoints;
+	  if (n < 2) continue;
+	  TH1I * h = hist[c];
+	  h->Reset();
+	  if (buf.nickname[0]) h->SetTitle(buf.nickname);
+	  h->GetYaxis()->SetRangeUser(-128,128);
+	  h->SetBins(n-1,buf.initialXOffset,buf.initialXOffset+(buf.xIncrement * n));
+	  ScanSaturation(buf.samples,n,buf.polarity,h->GetArray(),false);
+	  h->SetEntries(n);
+
+	  canv->cd(layout == (1u<<c) ? 0 : pad);
+	  h->Draw();
+	  canv->Update();
+	  axis[c]->DrawAxis(gPad->GetUxmax(),gPad->GetUymin(),gPad->GetUxmax()-0.0000000001,gPad->GetUymax(),gPad->GetUymin()*buf.scaleFactor+buf.scaleOffset,gPad->GetUymax()*buf.scaleFactor+buf.scaleOffset,510,"+L");
+	}
+
+      reader.ReadCounters(&counters);
+      canv->SetTitle(TString::Format("DigiView -- %llu triggers, %llu recorded, %llu high / %llu low saturated",
+				     (unsigned long long)counters.triggers,
+				     (unsigned long long)counters.recorded,
+				     (unsigned long long)counters.clipHigh,
+				     (unsigned long long)counters.clipLow));
+      canv->Modified();
+      canv->Update();
+      gSystem->ProcessEvents();
+      usleep(refresh*1000);
+    }
+
+  reader.Detach();
+  return 0;
+}
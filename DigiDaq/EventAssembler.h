@@ -0,0 +1,136 @@
+#ifndef EVENTASSEMBLER_H
+#define EVENTASSEMBLER_H
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include "RecordReader.h"
+
+// Builds events out of a stream of records. Slots are kept in a ring
+// indexed by eventNumber, so each record costs O(1) whatever the number of
+// channels. An event is handed out the moment every requested channel has
+// arrived; records of the same event do not need to be adjacent, as long
+// as they arrive within capacity events of each other.
+//
+// What does not assemble is counted rather than analysed:
+//   partial     events pushed out of the ring (or left at the end) with
+//               channels missing, e.g. events DigiDaq rejected half way
+//   outOfOrder  records older than the newest event seen (still assembled
+//               if within the window)
+//   stale       records too old for the window, dropped
+//   duplicates  a channel arriving twice for one event (the last one wins)
+//   ignored     records of channels that were not requested
+struct AssemblerCounters
+{
+  uint64_t records;
+  uint64_t events;
+  uint64_t partial;
+  uint64_t outOfOrder;
+  uint64_t stale;
+  uint64_t duplicates;
+  uint64_t ignored;
+
+  AssemblerCounters() : records(0), events(0), partial(0), outOfOrder(0), stale(0), duplicates(0), ignored(0) {}
+};
+
+class EventAssembler
+{
+ public:
+  EventAssembler(uint32_t channelMask, int capacity = 64)
+    : wanted(channelMask), slots(capacity), used(capacity,0), newest(0), haveNewest(false) {}
+
+  // Add one record. Returns the completed event, valid until the next call,
+  // or 0.
+  const EventView * Add(const RecordView & r)
+  {
+    ++counters.records;
+    int c = r.head.channelNumber;
+    if (c < 1 || c > 8 || !(wanted & (1u<<(c-1))))
+      {
+	++counters.ignored;
+	return 0;
+      }
+    int64_t evnum = r.head.eventNumber;
+    if (haveNewest && evnum < newest)
+      {
+	++counters.outOfOrder;
+	if (newest-evnum >= (int64_t)slots.size())
+	  {
+	    ++counters.stale;
+	    return 0;
+	  }
+      }
+    if (!haveNewest || evnum > newest) newest = evnum;
+    haveNewest = true;
+
+    size_t s = (size_t)(evnum % (int64_t)slots.size());
+    if (evnum < 0) s = (s+slots.size()) % slots.size();
+    EventView & ev = slots[s];
+    if (used[s] && ev.eventNumber != evnum)
+      {
+	// an older event still waiting for channels, it will not complete
+	++counters.partial;
+	used[s] = 0;
+      }
+    if (!used[s])
+      {
+	used[s] = 1;
+	ev.eventNumber = evnum;
+	ev.mask = 0;
+	ev.offset = r.offset;
+	ev.end = 0;
+      }
+    uint32_t bit = 1u<<(c-1);
+    if (ev.mask & bit) ++counters.duplicates;
+    ev.chan[c-1] = r;
+    ev.mask |= bit;
+    if (r.offset < ev.offset) ev.offset = r.offset;
+    if (RecordReader::NextOffset(r) > ev.end) ev.end = RecordReader::NextOffset(r);
+    if (ev.mask != wanted) return 0;
+    used[s] = 0;
+    ++counters.events;
+    return &ev;
+  }
+
+  // End of input: whatever is still waiting is partial.
+  void Flush()
+  {
+    for (size_t s = 0; s < slots.size(); ++s)
+      {
+	if (used[s]) ++counters.partial;
+	used[s] = 0;
+      }
+  }
+
+  // File offset of the oldest record still needed (or upTo if none), for
+  // RecordReader::Release.
+  int64_t OldestOffset(int64_t upTo) const
+  {
+    int64_t off = upTo;
+    for (size_t s = 0; s < slots.size(); ++s)
+      if (used[s] && slots[s].offset < off) off = slots[s].offset;
+    return off;
+  }
+
+  const AssemblerCounters & Counters() const { return counters; }
+
+  void Summary() const
+  {
+    printf("Assembled %llu events from %llu records\n",(unsigned long long)counters.events,(unsigned long long)counters.records);
+    if (counters.partial || counters.outOfOrder || counters.stale || counters.duplicates)
+      printf("  %llu partial, %llu records out of order (%llu too late), %llu duplicate channels\n",
+	     (unsigned long long)counters.partial,(unsigned long long)counters.outOfOrder,
+	     (unsigned long long)counters.stale,(unsigned long long)counters.duplicates);
+  }
+
+ private:
+  uint32_t wanted;
+  std::vector<EventView> slots;
+  std::vector<char> used;
+  int64_t newest;
+  bool haveNewest;
+  AssemblerCounters counters;
+};
+
+#endif
@@ -0,0 +1,513 @@
+#ifndef FEATUREKERNEL_H
+#define FEATUREKERNEL_H
+
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+
+#include "TMath.h"
+
+#include "Header.h"
+#include "PulseFeatures.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define FEATUREKERNEL_X86
+#endif
+
+// ExtractPulseFeatures for raw int8 samples in three passes with early
+// exits, giving bit for bit the same PulseFeatures:
+//
+//  1. baseline sum and sum of squares over the first quarter, max and min
+//     over the whole record (integer arithmetic, exact)
+//  2. first position of the max and of the min, from the front
+//  3. last 10%/90%/50% crossings, from the back
+//
+// The crossing tests of the reference, fabs((float)x - baseAdc) >= t, only
+// see 256 possible x. For t > 0 the samples passing a test are exactly
+// x <= lo or x >= hi (the float subtraction is monotonic in x), so the
+// vector paths compare int8 against two bounds found once per waveform.
+//
+// The baseline RMS of TMath::StdDev is a two-pass double sum. It is
+// computed here from the exact integer sums instead; when the result
+// lies so close to a float rounding boundary that the two could round
+// differently, TMath::StdDev itself is called (rare).
+
+// The vector baseline sums of squares add, per step, two madd results of
+// two int8 products each to every 32 bit lane: at most 4*128*128 = 65536.
+// The lanes are widened as unsigned, so they hold 65535 steps before they
+// are flushed into the 64 bit sums.
+#define FEATURE_SQ_STEPS 65535
+
+enum FeatureKernelLevel
+  {
+    FEATUREKERNEL_SCALAR,
+    FEATUREKERNEL_SSE41,
+    FEATUREKERNEL_AVX2
+  };
+
+struct FeatureStats
+{
+  int64_t sum;      // baseline samples
+  int64_t sumsq;
+  int max;          // whole record
+  int min;
+};
+
+// Samples x with fabs((float)x - base) >= t are x <= lo or x >= hi.
+// all: every sample passes (t <= 0), no crossing can occur.
+struct FeatureThreshold
+{
+  int lo;
+  int hi;
+  bool all;
+};
+
+inline FeatureThreshold MakeFeatureThreshold(float base, float t)
+{
+  FeatureThreshold th;
+  th.all = !(t > 0);
+  th.lo = -129;
+  th.hi = 128;
+  if (th.all) return th;
+  // smallest x with (float)x - base >= t
+  int a = -128, b = 128;
+  while (a < b)
+    {
+      int m = (a+b) >> 1;
+      if ((float)m - base >= t) b = m;
+      else a = m+1;
+    }
+  th.hi = a;
+  // largest x with (float)x - base <= -t
+  a = -129;
+  b = 127;
+  while (a < b)
+    {
+      int m = (a+b+1) >> 1;
+      if ((float)m - base <= -t) a = m;
+      else b = m-1;
+    }
+  th.lo = a;
+  return th;
+}
+
+inline bool FeatureAbove(int x, const FeatureThreshold & th)
+{
+  return th.all || x <= th.lo || x >= th.hi;
+}
+
+// Crossing positions as in the reference, -1 when not found.
+enum { FEATURE_RISE10, FEATURE_RISE90, FEATURE_RISE50, FEATURE_FALL50, FEATURE_NCROSS };
+
+inline void FeatureStatsScalar(const int8_t * x, int64_t n, int64_t nb, FeatureStats * s)
+{
+  int64_t sum = 0, sumsq = 0;
+  int mx = -128, mn = 127;
+  for (int64_t i = 0; i < nb; ++i)
+    {
+      int v = x[i];
+      sum += v;
+      sumsq += v*v;
+    }
+  for (int64_t i = 0; i < n; ++i)
+    {
+      int v = x[i];
+      if (v > mx) mx = v;
+      if (v < mn) mn = v;
+    }
+  s->sum = sum;
+  s->sumsq = sumsq;
+  s->max = mx;
+  s->min = mn;
+}
+
+inline void FeatureFindScalar(const int8_t * x, int64_t n, int mx, int mn, int64_t * imax, int64_t * imin)
+{
+  *imax = -1;
+  *imin = -1;
+  for (int64_t i = 0; i < n && (*imax < 0 || *imin < 0); ++i)
+    {
+      if (*imax < 0 && x[i] == mx) *imax = i;
+      if (*imin < 0 && x[i] == mn) *imin = i;
+    }
+}
+
+// Backwards over v in [1,end), filling the crossings not found yet.
+inline void FeatureCrossScalar(const int8_t * x, int64_t end, const FeatureThreshold * th, int64_t * cross)
+{
+  for (int64_t v = end-1; v >= 1; --v)
+    {
+      int p = x[v-1], c = x[v];
+      if (cross[FEATURE_RISE10] < 0 && !FeatureAbove(p,th[0]) && FeatureAbove(c,th[0])) cross[FEATURE_RISE10] = v;
+      if (cross[FEATURE_RISE90] < 0 && !FeatureAbove(p,th[1]) && FeatureAbove(c,th[1])) cross[FEATURE_RISE90] = v;
+      bool p50 = FeatureAbove(p,th[2]), c50 = FeatureAbove(c,th[2]);
+      if (cross[FEATURE_RISE50] < 0 && !p50 && c50) cross[FEATURE_RISE50] = v;
+      if (cross[FEATURE_FALL50] < 0 && p50 && !c50) cross[FEATURE_FALL50] = v;
+      if (cross[0] >= 0 && cross[1] >= 0 && cross[2] >= 0 && cross[3] >= 0) return;
+    }
+}
+
+#ifdef FEATUREKERNEL_X86
+
+// One block of the vector crossing scans: a and p are the pass bits of
+// the samples at i+bit and i+bit-1 for the 10%, 90% and 50% tests. Keeps
+// the highest crossing of each kind not found yet, true when all are found.
+inline bool FeatureCrossUpdate(int64_t i, const uint32_t * a, const uint32_t * p, int64_t * cross)
+{
+  uint32_t m[FEATURE_NCROSS] = { a[0] & ~p[0], a[1] & ~p[1], a[2] & ~p[2], p[2] & ~a[2] };
+  bool done = true;
+  for (int k = 0; k < FEATURE_NCROSS; ++k)
+    {
+      if (cross[k] < 0 && m[k]) cross[k] = i+31-__builtin_clz(m[k]);
+      done = done && (cross[k] >= 0);
+    }
+  return done;
+}
+
+__attribute__((target("sse4.1")))
+inline void FeatureStatsSSE41(const int8_t * x, int64_t n, int64_t nb, FeatureStats * s)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i flip = _mm_set1_epi8(-128);
+  __m128i vmax = _mm_set1_epi8(-128);
+  __m128i vmin = _mm_set1_epi8(127);
+  __m128i sad = zero;
+  __m128i sq64 = zero;
+  int64_t i = 0;
+  while (i+16 <= nb)
+    {
+      int64_t stop = i+16*FEATURE_SQ_STEPS;
+      __m128i sq32 = zero;
+      for (; i+16 <= nb && i < stop; i += 16)
+	{
+	  __m128i v = _mm_loadu_si128((const __m128i*)(x+i));
+	  vmax = _mm_max_epi8(vmax,v);
+	  vmin = _mm_min_epi8(vmin,v);
+	  sad = _mm_add_epi64(sad,_mm_sad_epu8(_mm_xor_si128(v,flip),zero));
+	  __m128i lo = _mm_cvtepi8_epi16(v);
+	  __m128i hi = _mm_cvtepi8_epi16(_mm_srli_si128(v,8));
+	  sq32 = _mm_add_epi32(sq32,_mm_add_epi32(_mm_madd_epi16(lo,lo),_mm_madd_epi16(hi,hi)));
+	}
+      sq64 = _mm_add_epi64(sq64,_mm_add_epi64(_mm_cvtepu32_epi64(sq32),_mm_cvtepu32_epi64(_mm_srli_si128(sq32,8))));
+    }
+  int64_t sum = _mm_cvtsi128_si64(sad)+_mm_extract_epi64(sad,1)-128*i;
+  int64_t sumsq = _mm_cvtsi128_si64(sq64)+_mm_extract_epi64(sq64,1);
+  for (; i < nb; ++i)
+    {
+      sum += x[i];
+      sumsq += x[i]*x[i];
+      vmax = _mm_max_epi8(vmax,_mm_set1_epi8(x[i]));
+      vmin = _mm_min_epi8(vmin,_mm_set1_epi8(x[i]));
+    }
+  for (; i+16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(x+i));
+      vmax = _mm_max_epi8(vmax,v);
+      vmin = _mm_min_epi8(vmin,v);
+    }
+  int8_t bmax[16], bmin[16];
+  _mm_storeu_si128((__m128i*)bmax,vmax);
+  _mm_storeu_si128((__m128i*)bmin,vmin);
+  int mx = -128, mn = 127;
+  for (int k = 0; k < 16; ++k)
+    {
+      if (bmax[k] > mx) mx = bmax[k];
+      if (bmin[k] < mn) mn = bmin[k];
+    }
+  for (; i < n; ++i)
+    {
+      if (x[i] > mx) mx = x[i];
+      if (x[i] < mn) mn = x[i];
+    }
+  s->sum = sum;
+  s->sumsq = sumsq;
+  s->max = mx;
+  s->min = mn;
+}
+
+__attribute__((target("sse4.1")))
+inline void FeatureFindSSE41(const int8_t * x, int64_t n, int mx, int mn, int64_t * imax, int64_t * imin)
+{
+  const __m128i vmx = _mm_set1_epi8(mx);
+  const __m128i vmn = _mm_set1_epi8(mn);
+  *imax = -1;
+  *imin = -1;
+  int64_t i = 0;
+  for (; i+16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(x+i));
+      int a = _mm_movemask_epi8(_mm_cmpeq_epi8(v,vmx));
+      int b = _mm_movemask_epi8(_mm_cmpeq_epi8(v,vmn));
+      if (*imax < 0 && a) *imax = i+__builtin_ctz(a);
+      if (*imin < 0 && b) *imin = i+__builtin_ctz(b);
+      if (*imax >= 0 && *imin >= 0) return;
+    }
+  int64_t tmax, tmin;
+  FeatureFindScalar(x+i,n-i,mx,mn,&tmax,&tmin);
+  if (*imax < 0 && tmax >= 0) *imax = i+tmax;
+  if (*imin < 0 && tmin >= 0) *imin = i+tmin;
+}
+
+__attribute__((target("sse4.1")))
+inline __m128i FeatureAboveSSE41(__m128i v, __m128i hiM1, __m128i loP1)
+{
+  return _mm_or_si128(_mm_cmpgt_epi8(v,hiM1),_mm_cmpgt_epi8(loP1,v));
+}
+
+__attribute__((target("sse4.1")))
+inline void FeatureCrossSSE41(const int8_t * x, int64_t n, const FeatureThreshold * th, int64_t * cross)
+{
+  __m128i hiM1[3], loP1[3];
+  for (int k = 0; k < 3; ++k)
+    {
+      hiM1[k] = _mm_set1_epi8(th[k].hi-1);
+      loP1[k] = _mm_set1_epi8(th[k].lo+1);
+    }
+  int64_t i = n-16;
+  for (; i >= 1; i -= 16)
+    {
+      __m128i c = _mm_loadu_si128((const __m128i*)(x+i));
+      uint32_t a[3], p[3];
+      for (int k = 0; k < 3; ++k)
+	{
+	  a[k] = _mm_movemask_epi8(FeatureAboveSSE41(c,hiM1[k],loP1[k]));
+	  // the previous sample of each lane is the lane below
+	  p[k] = ((a[k] << 1) | FeatureAbove(x[i-1],th[k])) & 0xffff;
+	}
+      if (FeatureCrossUpdate(i,a,p,cross)) return;
+    }
+  FeatureCrossScalar(x,i+16,th,cross);
+}
+
+__attribute__((target("avx2")))
+inline void FeatureStatsAVX2(const int8_t * x, int64_t n, int64_t nb, FeatureStats * s)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i flip = _mm256_set1_epi8(-128);
+  __m256i vmax = _mm256_set1_epi8(-128);
+  __m256i vmin = _mm256_set1_epi8(127);
+  __m256i sad = zero;
+  __m256i sq64 = zero;
+  int64_t i = 0;
+  while (i+32 <= nb)
+    {
+      int64_t stop = i+32*FEATURE_SQ_STEPS;
+      __m256i sq32 = zero;
+      for (; i+32 <= nb && i < stop; i += 32)
+	{
+	  __m256i v = _mm256_loadu_si256((const __m256i*)(x+i));
+	  vmax = _mm256_max_epi8(vmax,v);
+	  vmin = _mm256_min_epi8(vmin,v);
+	  sad = _mm256_add_epi64(sad,_mm256_sad_epu8(_mm256_xor_si256(v,flip),zero));
+	  __m256i lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(v));
+	  __m256i hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(v,1));
+	  sq32 = _mm256_add_epi32(sq32,_mm256_add_epi32(_mm256_madd_epi16(lo,lo),_mm256_madd_epi16(hi,hi)));
+	}
+      sq64 = _mm256_add_epi64(sq64,_mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(sq32)),
+						    _mm256_cvtepu32_epi64(_mm256_extracti128_si256(sq32,1))));
+    }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes,sad);
+  int64_t sum = lanes[0]+lanes[1]+lanes[2]+lanes[3]-128*i;
+  _mm256_storeu_si256((__m256i*)lanes,sq64);
+  int64_t sumsq = lanes[0]+lanes[1]+lanes[2]+lanes[3];
+  for (; i < nb; ++i)
+    {
+      sum += x[i];
+      sumsq += x[i]*x[i];
+      vmax = _mm256_max_epi8(vmax,_mm256_set1_epi8(x[i]));
+      vmin = _mm256_min_epi8(vmin,_mm256_set1_epi8(x[i]));
+    }
+  for (; i+32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(x+i));
+      vmax = _mm256_max_epi8(vmax,v);
+      vmin = _mm256_min_epi8(vmin,v);
+    }
+  int8_t bmax[32], bmin[32];
+  _mm256_storeu_si256((__m256i*)bmax,vmax);
+  _mm256_storeu_si256((__m256i*)bmin,vmin);
+  int mx = -128, mn = 127;
+  for (int k = 0; k < 32; ++k)
+    {
+      if (bmax[k] > mx) mx = bmax[k];
+      if (bmin[k] < mn) mn = bmin[k];
+    }
+  for (; i < n; ++i)
+    {
+      if (x[i] > mx) mx = x[i];
+      if (x[i] < mn) mn = x[i];
+    }
+  s->sum = sum;
+  s->sumsq = sumsq;
+  s->max = mx;
+  s->min = mn;
+}
+
+__attribute__((target("avx2")))
+inline void FeatureFindAVX2(const int8_t * x, int64_t n, int mx, int mn, int64_t * imax, int64_t * imin)
+{
+  const __m256i vmx = _mm256_set1_epi8(mx);
+  const __m256i vmn = _mm256_set1_epi8(mn);
+  *imax = -1;
+  *imin = -1;
+  int64_t i = 0;
+  for (; i+32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(x+i));
+      unsigned a = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,vmx));
+      unsigned b = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,vmn));
+      if (*imax < 0 && a) *imax = i+__builtin_ctz(a);
+      if (*imin < 0 && b) *imin = i+__builtin_ctz(b);
+      if (*imax >= 0 && *imin >= 0) return;
+    }
+  int64_t tmax, tmin;
+  FeatureFindScalar(x+i,n-i,mx,mn,&tmax,&tmin);
+  if (*imax < 0 && tmax >= 0) *imax = i+tmax;
+  if (*imin < 0 && tmin >= 0) *imin = i+tmin;
+}
+
+__attribute__((target("avx2")))
+inline __m256i FeatureAboveAVX2(__m256i v, __m256i hiM1, __m256i loP1)
+{
+  return _mm256_or_si256(_mm256_cmpgt_epi8(v,hiM1),_mm256_cmpgt_epi8(loP1,v));
+}
+
+__attribute__((target("avx2")))
+inline void FeatureCrossAVX2(const int8_t * x, int64_t n, const FeatureThreshold * th, int64_t * cross)
+{
+  __m256i hiM1[3], loP1[3];
+  for (int k = 0; k < 3; ++k)
+    {
+      hiM1[k] = _mm256_set1_epi8(th[k].hi-1);
+      loP1[k] = _mm256_set1_epi8(th[k].lo+1);
+    }
+  int64_t i = n-32;
+  for (; i >= 1; i -= 32)
+    {
+      __m256i c = _mm256_loadu_si256((const __m256i*)(x+i));
+      uint32_t a[3], p[3];
+      for (int k = 0; k < 3; ++k)
+	{
+	  a[k] = _mm256_movemask_epi8(FeatureAboveAVX2(c,hiM1[k],loP1[k]));
+	  p[k] = (a[k] << 1) | FeatureAbove(x[i-1],th[k]);
+	}
+      if (FeatureCrossUpdate(i,a,p,cross)) return;
+    }
+  FeatureCrossScalar(x,i+32,th,cross);
+}
+
+#endif
+
+inline int BestFeatureKernelLevel()
+{
+#ifdef FEATUREKERNEL_X86
+  static const int level = __builtin_cpu_supports("avx2") ? FEATUREKERNEL_AVX2 :
+    (__builtin_cpu_supports("sse4.1") ? FEATUREKERNEL_SSE41 : FEATUREKERNEL_SCALAR);
+  return level;
+#else
+  return FEATUREKERNEL_SCALAR;
+#endif
+}
+
+// TMath::StdDev of the nb baseline samples from their exact sums.
+inline float FeatureBaselineRms(const int8_t * x, int64_t nb, int64_t sum, int64_t sumsq)
+{
+  if (nb < 2) return 0;
+  double n = nb;
+  double r = std::sqrt((double)(nb*sumsq-sum*sum)/(n*(n-1)));
+  float f = r;
+  if ((double)f == r) return f;
+  double other = (r > f) ? std::nextafter(f,FLT_MAX) : std::nextafter(f,-FLT_MAX);
+  double mid = 0.5*((double)f+other);
+  if (std::fabs(r-mid) <= r*(n+16)*DBL_EPSILON) return TMath::StdDev(x,x+nb);
+  return f;
+}
+
+inline void ExtractPulseFeaturesLevel(const int8_t * wf, int64_t wf_size, int source, const Header & head, PulseFeatures * f, int level)
+{
+  int64_t nb = (int64_t)(wf_size*0.25);
+  // tiny records and baselines whose sums could overflow go the long way
+  if (wf_size < 32 || nb > (1<<24))
+    {
+      ExtractPulseFeatures(wf,wf_size,source,head,f);
+      return;
+    }
+
+  FeatureStats st;
+  int64_t imax, imin;
+#ifdef FEATUREKERNEL_X86
+  if (level == FEATUREKERNEL_AVX2)
+    {
+      FeatureStatsAVX2(wf,wf_size,nb,&st);
+      FeatureFindAVX2(wf,wf_size,st.max,st.min,&imax,&imin);
+    }
+  else if (level == FEATUREKERNEL_SSE41)
+    {
+      FeatureStatsSSE41(wf,wf_size,nb,&st);
+      FeatureFindSSE41(wf,wf_size,st.max,st.min,&imax,&imin);
+    }
+  else
+#endif
+    {
+      FeatureStatsScalar(wf,wf_size,nb,&st);
+      FeatureFindScalar(wf,wf_size,st.max,st.min,&imax,&imin);
+    }
+
+  // from here on the same float/double expressions as ExtractPulseFeatures
+  float scalefactor = head.scaleFactor;
+  float scaleoffset = head.scaleOffset;
+
+  f->baseAdc = (double)st.sum/(double)nb;
+  f->baseVolt = scalefactor*f->baseAdc+scaleoffset;
+  f->baseRmsAdc = FeatureBaselineRms(wf,nb,st.sum,st.sumsq);
+  f->baseRmsVolt = scalefactor*f->baseRmsAdc+scaleoffset;
+
+  float maximum = st.max;
+  float minimum = st.min;
+  float maxpeaktime = imax;
+  float minpeaktime = imin;
+  f->peaktimeTdc = (source<0) ? minpeaktime : maxpeaktime;
+  f->peaktimeSec = head.initialXOffset+head.xIncrement*f->peaktimeTdc;
+  f->maxAdc = (source<0) ? minimum : maximum;
+  f->maxVolt = scalefactor*f->maxAdc+scaleoffset;
+  f->amplitudeAdc = fabs(f->maxAdc-f->baseAdc);
+  f->amplitudeVolt = fabs(f->maxVolt-f->baseVolt);
+
+  float baseAdc = f->baseAdc;
+  float tpct = f->amplitudeAdc*0.1;
+  float npct = f->amplitudeAdc*0.9;
+  float fpct = f->amplitudeAdc*0.5;
+  FeatureThreshold th[3] = { MakeFeatureThreshold(baseAdc,tpct),
+			     MakeFeatureThreshold(baseAdc,npct),
+			     MakeFeatureThreshold(baseAdc,fpct) };
+  int64_t cross[FEATURE_NCROSS] = { -1, -1, -1, -1 };
+  // with t <= 0 every sample passes its test and nothing ever crosses
+  bool anyall = th[0].all || th[1].all || th[2].all;
+  bool allall = th[0].all && th[1].all && th[2].all;
+#ifdef FEATUREKERNEL_X86
+  if (!anyall && level == FEATUREKERNEL_AVX2) FeatureCrossAVX2(wf,wf_size,th,cross);
+  else if (!anyall && level == FEATUREKERNEL_SSE41) FeatureCrossSSE41(wf,wf_size,th,cross);
+  else
+#endif
+    if (!allall) FeatureCrossScalar(wf,wf_size,th,cross);
+  float riseLow = cross[FEATURE_RISE10];
+  float riseHigh = cross[FEATURE_RISE90];
+  float halfLow = cross[FEATURE_RISE50];
+  float halfHigh = cross[FEATURE_FALL50];
+
+  f->fwhmTdc = halfHigh - halfLow;
+  f->fwhmSec = head.xIncrement*f->fwhmTdc;
+  f->riseTimeTdc = riseHigh - riseLow;
+  f->riseTimeSec = head.xIncrement*f->riseTimeTdc;
+}
+
+// Same results as ExtractPulseFeatures on int8 samples, on the best
+// instruction set this CPU has.
+inline void ExtractPulseFeaturesFast(const int8_t * wf, int64_t wf_size, int source, const Header & head, PulseFeatures * f)
+{
+  ExtractPulseFeaturesLevel(wf,wf_size,source,head,f,BestFeatureKernelLevel());
+}
+
+#endif
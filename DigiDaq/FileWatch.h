@@ -0,0 +1,91 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+#include <string>
+#include <cstdio>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// Waits for a file that another process is writing to change. Uses inotify
+// when it can (local file systems); otherwise, e.g. on NFS where inotify
+// does not see writes from other hosts, it falls back to polling.
+enum FileWatchEvent
+  {
+    FILEWATCH_TIMEOUT,
+    FILEWATCH_CHANGED,    // written to (or, when polling, maybe)
+    FILEWATCH_CLOSED,     // the writer closed the file, no more data
+    FILEWATCH_INTERRUPTED // a signal came in
+  };
+
+class FileWatch
+{
+ public:
+  FileWatch(int pollMs = 200) : fd(-1), wd(-1), poll_ms(pollMs) {}
+  ~FileWatch() { Close(); }
+
+  // False if inotify is not available, Wait() then polls.
+  bool Open(const std::string & path)
+  {
+    Close();
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (fd < 0) return false;
+    wd = inotify_add_watch(fd,path.c_str(),IN_MODIFY|IN_CLOSE_WRITE);
+    if (wd < 0)
+      {
+	close(fd);
+	fd = -1;
+	return false;
+      }
+    return true;
+  }
+
+  void Close()
+  {
+    if (fd >= 0) close(fd);
+    fd = -1;
+    wd = -1;
+  }
+
+  bool Inotify() const { return fd >= 0; }
+
+  // Wait at most timeoutMs for the file to change.
+  FileWatchEvent Wait(int timeoutMs)
+  {
+    if (fd < 0)
+      {
+	int ms = timeoutMs < poll_ms ? timeoutMs : poll_ms;
+	if (usleep(ms*1000) != 0 && errno == EINTR) return FILEWATCH_INTERRUPTED;
+	return FILEWATCH_CHANGED;
+      }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    int n = poll(&pfd,1,timeoutMs);
+    if (n < 0) return errno == EINTR ? FILEWATCH_INTERRUPTED : FILEWATCH_TIMEOUT;
+    if (n == 0) return FILEWATCH_TIMEOUT;
+
+    // drain everything queued, a burst of writes is one change
+    FileWatchEvent ret = FILEWATCH_CHANGED;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(fd,buf,sizeof(buf))) > 0)
+      {
+	for (char * p = buf; p < buf+len; )
+	  {
+	    const struct inotify_event * e = (const struct inotify_event*)p;
+	    if (e->mask & IN_CLOSE_WRITE) ret = FILEWATCH_CLOSED;
+	    p += sizeof(struct inotify_event)+e->len;
+	  }
+      }
+    return ret;
+  }
+
+ private:
+  int fd;
+  int wd;
+  int poll_ms;
+};
+
+#endif
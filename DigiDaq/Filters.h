@@ -0,0 +1,399 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <type_traits>
+
+#include "AgMD2.h"
+
+// Filters for the digitizer waveforms, to run ahead of the feature
+// extraction. Every filter is a small class with
+//
+//   void Apply(const float * x, float * y, int64_t n) const
+//   void ApplyBatch(const float * const * x, float * const * y, int64_t n, int count) const
+//
+// x and y must not overlap; ApplyBatch does count waveforms of the same
+// length n. All filters are causal (y[i] only depends on x[0..i]) and treat
+// the samples before the start as equal to x[0], so a flat baseline comes
+// out without a start-up transient.
+//
+// Lengths are template parameters, so the inner loops have a fixed trip
+// count and the compiler unrolls them and vectorises over the samples. The
+// CR-RC shaper is recursive and can not be vectorised along a waveform; its
+// ApplyBatch runs FILTER_LANES waveforms side by side instead, one per SIMD
+// lane. (The trapezoid is recursive too, but only two running sums, which
+// is faster one waveform at a time than transposing.)
+
+#define FILTER_LANES 8
+#define FILTER_BLOCK 256
+
+// Default ApplyBatch, one waveform after the other.
+template <typename Derived>
+struct FilterBase
+{
+  void ApplyBatch(const float * const * x, float * const * y, int64_t n, int count) const
+  {
+    for (int w = 0; w < count; ++w) static_cast<const Derived*>(this)->Apply(x[w],y[w],n);
+  }
+};
+
+// Mean of the last N samples.
+template <int N>
+struct MovingAverage : public FilterBase<MovingAverage<N> >
+{
+  static_assert(N >= 1, "MovingAverage needs N >= 1");
+
+  void Apply(const float * x, float * y, int64_t n) const
+  {
+    const float scale = 1.f/N;
+    int64_t head = n < N-1 ? n : N-1;
+    for (int64_t i = 0; i < head; ++i)
+      {
+	float s = 0;
+	for (int k = 0; k < N; ++k) s += (i-k >= 0) ? x[i-k] : x[0];
+	y[i] = s*scale;
+      }
+    // tap by tap over whole blocks, so the loop over the samples
+    // vectorises (each y[i] still adds its taps in the same order)
+    int64_t i0 = head;
+    for (; i0+FILTER_BLOCK <= n; i0 += FILTER_BLOCK)
+      {
+	float s[FILTER_BLOCK];
+	for (int i = 0; i < FILTER_BLOCK; ++i) s[i] = 0;
+	for (int k = 0; k < N; ++k)
+	  {
+	    const float * xk = x+i0-k;
+	    for (int i = 0; i < FILTER_BLOCK; ++i) s[i] += xk[i];
+	  }
+	for (int i = 0; i < FILTER_BLOCK; ++i) y[i0+i] = s[i]*scale;
+      }
+    for (int64_t i = i0; i < n; ++i)
+      {
+	float s = 0;
+	for (int k = 0; k < N; ++k) s += x[i-k];
+	y[i] = s*scale;
+      }
+  }
+};
+
+// Matched (template) filter of N taps. The template is made zero-mean and
+// scaled so that the output for a + A*template is A at the sample where the
+// template ends, whatever the baseline a.
+template <int N>
+struct MatchedFilter : public FilterBase<MatchedFilter<N> >
+{
+  static_assert(N >= 2, "MatchedFilter needs N >= 2");
+
+  float h[N];
+
+  MatchedFilter() { for (int k = 0; k < N; ++k) h[k] = 0; }
+  explicit MatchedFilter(const float * shape) { SetTemplate(shape); }
+
+  // False (and the filter left at zero) for a flat template.
+  bool SetTemplate(const float * shape)
+  {
+    double mean = 0;
+    for (int k = 0; k < N; ++k) mean += shape[k];
+    mean /= N;
+    double norm = 0;
+    for (int k = 0; k < N; ++k) norm += (shape[k]-mean)*(shape[k]-mean);
+    for (int k = 0; k < N; ++k) h[k] = norm > 0 ? (shape[k]-mean)/norm : 0;
+    return norm > 0;
+  }
+
+  void Apply(const float * x, float * y, int64_t n) const
+  {
+    int64_t head = n < N-1 ? n : N-1;
+    for (int64_t i = 0; i < head; ++i)
+      {
+	float s = 0;
+	for (int k = 0; k < N; ++k)
+	  {
+	    int64_t j = i-(N-1)+k;
+	    s += h[k]*(j >= 0 ? x[j] : x[0]);
+	  }
+	y[i] = s;
+      }
+    int64_t i0 = head;
+    for (; i0+FILTER_BLOCK <= n; i0 += FILTER_BLOCK)
+      {
+	float s[FILTER_BLOCK];
+	for (int i = 0; i < FILTER_BLOCK; ++i) s[i] = 0;
+	for (int k = 0; k < N; ++k)
+	  {
+	    const float hk = h[k];
+	    const float * xk = x+i0-(N-1)+k;
+	    for (int i = 0; i < FILTER_BLOCK; ++i) s[i] += hk*xk[i];
+	  }
+	for (int i = 0; i < FILTER_BLOCK; ++i) y[i0+i] = s[i];
+      }
+    for (int64_t i = i0; i < n; ++i)
+      {
+	const float * xs = x+i-(N-1);
+	float s = 0;
+	for (int k = 0; k < N; ++k) s += h[k]*xs[k];
+	y[i] = s;
+      }
+  }
+};
+
+// Copy count waveforms into lane-major order (sample i of waveform w at
+// t[i*FILTER_LANES+w]) and back.
+inline void FilterInterleave(const float * const * x, int64_t n, int count, float * t)
+{
+  for (int64_t i = 0; i < n; ++i)
+    for (int w = 0; w < FILTER_LANES; ++w) t[i*FILTER_LANES+w] = x[w < count ? w : 0][i];
+}
+
+inline void FilterDeinterleave(const float * t, int64_t n, int count, float * const * y)
+{
+  for (int w = 0; w < count; ++w)
+    for (int64_t i = 0; i < n; ++i) y[w][i] = t[i*FILTER_LANES+w];
+}
+
+// CR-RC^Order shaper: one CR differentiator and Order RC integrators with
+// the same time constant tau (in samples). The output is scaled to peak at
+// 1 for a unit step (exactly so for tau >> 1 sample), and has no baseline.
+template <int Order>
+struct CrRcFilter
+{
+  static_assert(Order >= 1, "CrRcFilter needs Order >= 1");
+
+  float a;      // CR: y[i] = a*y[i-1]+x[i]-x[i-1]
+  float b;      // RC: y[i] = y[i-1]+b*(x[i]-y[i-1]), b = 1-a
+  float gain;
+
+  explicit CrRcFilter(double tau = 10)
+  {
+    if (tau <= 0) tau = 1;
+    a = std::exp(-1/tau);
+    b = 1-a;
+    // continuous peak of the step response: Order^Order e^-Order / Order!
+    double peak = std::exp(-(double)Order);
+    for (int k = 1; k <= Order; ++k) peak *= (double)Order/k;
+    gain = 1/peak;
+  }
+
+  void Apply(const float * x, float * y, int64_t n) const
+  {
+    if (n <= 0) return;
+    float prev = x[0];
+    float cr = 0;
+    float rc[Order];
+    for (int k = 0; k < Order; ++k) rc[k] = 0;
+    for (int64_t i = 0; i < n; ++i)
+      {
+	cr = a*cr+x[i]-prev;
+	prev = x[i];
+	float v = cr;
+	for (int k = 0; k < Order; ++k)
+	  {
+	    rc[k] += b*(v-rc[k]);
+	    v = rc[k];
+	  }
+	y[i] = gain*v;
+      }
+  }
+
+  void ApplyBatch(const float * const * x, float * const * y, int64_t n, int count) const
+  {
+    if (n <= 0) return;
+    const int L = FILTER_LANES;
+    std::vector<float> t(n*L);
+    for (int w0 = 0; w0 < count; w0 += L)
+      {
+	int m = count-w0 < L ? count-w0 : L;
+	FilterInterleave(x+w0,n,m,t.data());
+	float prev[L], cr[L], rc[Order][L];
+	for (int j = 0; j < L; ++j)
+	  {
+	    prev[j] = t[j];
+	    cr[j] = 0;
+	    for (int k = 0; k < Order; ++k) rc[k][j] = 0;
+	  }
+	for (int64_t i = 0; i < n; ++i)
+	  {
+	    float * ti = &t[i*L];
+	    for (int j = 0; j < L; ++j)
+	      {
+		cr[j] = a*cr[j]+ti[j]-prev[j];
+		prev[j] = ti[j];
+	      }
+	    for (int j = 0; j < L; ++j) rc[0][j] += b*(cr[j]-rc[0][j]);
+	    for (int k = 1; k < Order; ++k)
+	      for (int j = 0; j < L; ++j) rc[k][j] += b*(rc[k-1][j]-rc[k][j]);
+	    for (int j = 0; j < L; ++j) ti[j] = gain*rc[Order-1][j];
+	  }
+	FilterDeinterleave(t.data(),n,m,y+w0);
+      }
+  }
+};
+
+// Trapezoidal shaper (Jordanov) with rise K and flat top M samples. tau is
+// the decay time of the input pulses in samples, for the pole-zero
+// correction; tau <= 0 means step-like input. The flat top equals the
+// pulse amplitude.
+template <int K, int M>
+struct TrapezoidFilter : public FilterBase<TrapezoidFilter<K,M> >
+{
+  static_assert(K >= 1 && M >= 0, "TrapezoidFilter needs K >= 1, M >= 0");
+
+  float pz;     // pole-zero term, r = p+pz*d
+  float scale;
+
+  explicit TrapezoidFilter(double tau = 0)
+  {
+    pz = tau > 0 ? 1/(std::exp(1/tau)-1) : 0;
+    scale = tau > 0 ? 1/(K*(pz+1)) : 1.0/K;
+  }
+
+  void Apply(const float * x, float * y, int64_t n) const
+  {
+    const int64_t L = K+M;
+    float p = 0, s = 0;
+    for (int64_t i = 0; i < n; ++i)
+      {
+	float d = x[i]-at(x,i-K)-at(x,i-L)+at(x,i-K-L);
+	p += d;
+	if (pz > 0) s += p+pz*d;
+	else s += p;
+	y[i] = s*scale;
+      }
+  }
+
+ private:
+  static float at(const float * x, int64_t i) { return x[i > 0 ? i : 0]; }
+};
+
+// Several filters in a row, fixed at compile time:
+//   FilterChain<MovingAverage<4>, CrRcFilter<2> > chain(MovingAverage<4>(), CrRcFilter<2>(12.));
+// Apply needs n floats of scratch besides y.
+template <typename... F>
+class FilterChain
+{
+ public:
+  FilterChain() {}
+  explicit FilterChain(const F &... f) : filters(f...) {}
+
+  void Apply(const float * x, float * y, int64_t n, float * scratch) const
+  {
+    run(x,y,scratch,n,std::integral_constant<int,0>());
+  }
+
+  template <int I>
+  typename std::tuple_element<I,std::tuple<F...> >::type & Get() { return std::get<I>(filters); }
+
+ private:
+  // stage I writes into y or scratch so that the last one ends in y
+  template <int I>
+  void run(const float * in, float * y, float * scratch, int64_t n, std::integral_constant<int,I>) const
+  {
+    float * out = ((sizeof...(F)-I) % 2 == 1) ? y : scratch;
+    std::get<I>(filters).Apply(in,out,n);
+    run(out,y,scratch,n,std::integral_constant<int,I+1>());
+  }
+  void run(const float *, float *, float *, int64_t, std::integral_constant<int,sizeof...(F)>) const {}
+
+  std::tuple<F...> filters;
+};
+
+// Run time selection of a chain, for the waveform command line. Each stage
+// is one of the template filters above behind a virtual call, which costs
+// nothing next to a whole waveform.
+class FloatFilter
+{
+ public:
+  virtual ~FloatFilter() {}
+  virtual void Apply(const float * x, float * y, int64_t n) const = 0;
+  virtual void ApplyBatch(const float * const * x, float * const * y, int64_t n, int count) const = 0;
+};
+
+template <typename F>
+class FloatFilterOf : public FloatFilter
+{
+ public:
+  explicit FloatFilterOf(const F & f) : filter(f) {}
+  void Apply(const float * x, float * y, int64_t n) const { filter.Apply(x,y,n); }
+  void ApplyBatch(const float * const * x, float * const * y, int64_t n, int count) const { filter.ApplyBatch(x,y,n,count); }
+  F filter;
+};
+
+// A comma separated list of stages:
+//   ma4 ma8 ma16          moving average
+//   crrc1 crrc2 crrc4     CR-RC^n, time constant tau
+//   trap4_2 trap8_4 trap16_8   trapezoid rise_flat, decay tau
+// e.g. "ma4,crrc2". tau is in samples.
+class WaveformFilterChain
+{
+ public:
+  WaveformFilterChain() {}
+  ~WaveformFilterChain() { Clear(); }
+
+  // False (and the chain empty) if a stage is unknown.
+  bool Parse(const std::string & spec, double tau)
+  {
+    Clear();
+    size_t pos = 0;
+    while (pos <= spec.size())
+      {
+	size_t end = spec.find(',',pos);
+	if (end == std::string::npos) end = spec.size();
+	std::string name = spec.substr(pos,end-pos);
+	FloatFilter * f = 0;
+	if (name == "ma4") f = new FloatFilterOf<MovingAverage<4> >(MovingAverage<4>());
+	else if (name == "ma8") f = new FloatFilterOf<MovingAverage<8> >(MovingAverage<8>());
+	else if (name == "ma16") f = new FloatFilterOf<MovingAverage<16> >(MovingAverage<16>());
+	else if (name == "crrc1") f = new FloatFilterOf<CrRcFilter<1> >(CrRcFilter<1>(tau));
+	else if (name == "crrc2") f = new FloatFilterOf<CrRcFilter<2> >(CrRcFilter<2>(tau));
+	else if (name == "crrc4") f = new FloatFilterOf<CrRcFilter<4> >(CrRcFilter<4>(tau));
+	else if (name == "trap4_2") f = new FloatFilterOf<TrapezoidFilter<4,2> >(TrapezoidFilter<4,2>(tau));
+	else if (name == "trap8_4") f = new FloatFilterOf<TrapezoidFilter<8,4> >(TrapezoidFilter<8,4>(tau));
+	else if (name == "trap16_8") f = new FloatFilterOf<TrapezoidFilter<16,8> >(TrapezoidFilter<16,8>(tau));
+	if (!f)
+	  {
+	    Clear();
+	    return false;
+	  }
+	stages.push_back(f);
+	pos = end+1;
+      }
+    return !stages.empty();
+  }
+
+  bool Empty() const { return stages.empty(); }
+
+  // Filter n raw samples into y. work is resized as needed, one per thread.
+  void Apply(const ViInt8 * x, float * y, int64_t n, std::vector<float> & work) const
+  {
+    if ((int64_t)work.size() < 2*n) work.resize(2*n);
+    float * a = work.data();
+    float * b = a+n;
+    for (int64_t i = 0; i < n; ++i) a[i] = x[i];
+    for (size_t s = 0; s < stages.size(); ++s)
+      {
+	float * out = (s+1 == stages.size()) ? y : b;
+	stages[s]->Apply(a,out,n);
+	std::swap(a,b);
+      }
+    if (stages.empty()) for (int64_t i = 0; i < n; ++i) y[i] = x[i];
+  }
+
+  void Clear()
+  {
+    for (size_t s = 0; s < stages.size(); ++s) delete stages[s];
+    stages.clear();
+  }
+
+ private:
+  WaveformFilterChain(const WaveformFilterChain &);
+  WaveformFilterChain & operator=(const WaveformFilterChain &);
+
+  std::vector<FloatFilter*> stages;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HEADER_H
+#define HEADER_H
+
+#include <chrono>
+#include "AgMD2.h"
+
+// Record header written by DigiDaq in front of every waveform.
+// The binary file layout is
+// <<header>><<waveform_c1>><<header>><<waveform_c2>>...
+// so this struct must not change without breaking old data files.
+struct Header
+{
+  ViInt64 memsize;
+  ViInt64 actualPoints;
+  ViInt64 firstValidPoint;
+  ViReal64 initialXOffset;
+  ViReal64 initialXTimeSeconds;
+  ViReal64 initialXTimeFraction;
+  ViReal64 xIncrement;
+  ViReal64 scaleFactor;
+  ViReal64 scaleOffset;
+  ViUInt8 channelNumber;
+  int eventNumber;
+  std::chrono::system_clock::time_point trigTime;
+};
+
+#endif
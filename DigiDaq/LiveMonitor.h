@@ -0,0 +1,274 @@
+#ifndef LIVEMONITOR_H
+#define LIVEMONITOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Header.h"
+
+// Shared-memory segment through which DigiDaq publishes the latest waveform
+// of every channel and a few run counters. DigiView (or anything else) maps
+// it read-only and can attach/detach at any time; the acquisition never
+// waits for a reader.
+//
+// Every block is guarded by a seqlock: the writer makes the sequence odd,
+// copies the data and makes it even again. A reader copies the block and
+// retries if the sequence was odd or changed meanwhile.
+
+#define LIVEMONITOR_NAME       "/digidaq_live"
+#define LIVEMONITOR_MAGIC      0x5644444c   // "LDDV"
+#define LIVEMONITOR_VERSION    1
+#define LIVEMONITOR_CHANNELS   8
+#define LIVEMONITOR_MAX_POINTS 65536
+
+struct LiveChannel
+{
+  std::atomic<uint32_t> seq;
+  int32_t polarity;
+  int32_t eventNumber;
+  int32_t reserved;
+  int64_t actualPoints;
+  int64_t trigTimeNs;
+  double initialXOffset;
+  double xIncrement;
+  double scaleFactor;
+  double scaleOffset;
+  char nickname[16];
+  int8_t samples[LIVEMONITOR_MAX_POINTS];
+};
+
+struct LiveCounters
+{
+  std::atomic<uint32_t> seq;
+  uint32_t reserved;
+  uint64_t triggers;        // triggers seen
+  uint64_t recorded;        // events accepted
+  uint64_t clipHigh;        // events rejected for saturation
+  uint64_t clipLow;
+  int64_t startNs;          // run start, system_clock ns
+  int64_t updateNs;         // last update, system_clock ns
+};
+
+struct LiveSegment
+{
+  uint32_t magic;
+  uint32_t version;
+  int32_t pid;              // publishing DigiDaq process
+  uint32_t channelMask;     // bit c set when channel c+1 is published
+  LiveCounters counters;
+  LiveChannel channel[LIVEMONITOR_CHANNELS];
+};
+
+inline int64_t LiveNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline void SeqlockWriteBegin(std::atomic<uint32_t> & seq)
+{
+  seq.store(seq.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void SeqlockWriteEnd(std::atomic<uint32_t> & seq)
+{
+  seq.store(seq.load(std::memory_order_relaxed)+1,std::memory_order_release);
+}
+
+// Copy size bytes from the block guarded by seq. Returns the sequence
+// number the copy corresponds to, so callers can skip unchanged blocks.
+inline uint32_t SeqlockRead(const std::atomic<uint32_t> & seq, const void * src, void * dst, size_t size)
+{
+  while (true)
+    {
+      uint32_t s0 = seq.load(std::memory_order_acquire);
+      if (s0 & 1)
+	{
+	  sched_yield();
+	  continue;
+	}
+      memcpy(dst,src,size);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq.load(std::memory_order_relaxed) == s0) return s0;
+    }
+}
+
+// Writer side, owned by the acquisition process.
+class LivePublisher
+{
+ public:
+  LivePublisher() : seg(0) {}
+  ~LivePublisher() { Close(); }
+
+  bool Open()
+  {
+    // always start from a fresh, zero-filled segment; viewers still
+    // mapping an old one notice that its publisher is gone
+    shm_unlink(LIVEMONITOR_NAME);
+    int fd = shm_open(LIVEMONITOR_NAME,O_CREAT|O_EXCL|O_RDWR,0644);
+    if (fd < 0)
+      {
+	perror("LivePublisher: shm_open");
+	return false;
+      }
+    if (ftruncate(fd,sizeof(LiveSegment)) != 0)
+      {
+	perror("LivePublisher: ftruncate");
+	close(fd);
+	return false;
+      }
+    void * p = mmap(0,sizeof(LiveSegment),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (p == MAP_FAILED)
+      {
+	perror("LivePublisher: mmap");
+	return false;
+      }
+    seg = (LiveSegment*)p;
+    seg->version = LIVEMONITOR_VERSION;
+    seg->pid = getpid();
+    seg->counters.startNs = LiveNowNs();
+    std::atomic_thread_fence(std::memory_order_release);
+    seg->magic = LIVEMONITOR_MAGIC;
+    return true;
+  }
+
+  void Close()
+  {
+    if (!seg) return;
+    seg->magic = 0;
+    munmap(seg,sizeof(LiveSegment));
+    shm_unlink(LIVEMONITOR_NAME);
+    seg = 0;
+  }
+
+  bool IsOpen() { return seg != 0; }
+
+  void SetNickname(int chan, const char * nick)
+  {
+    if (!seg || chan < 1 || chan > LIVEMONITOR_CHANNELS) return;
+    LiveChannel & lc = seg->channel[chan-1];
+    SeqlockWriteBegin(lc.seq);
+    snprintf(lc.nickname,sizeof(lc.nickname),"%s",nick);
+    SeqlockWriteEnd(lc.seq);
+  }
+
+  // Publish one fetched record (samples start at data[head.firstValidPoint]).
+  void Publish(const Header & head, int polarity, const ViInt8 * data)
+  {
+    int chan = head.channelNumber;
+    if (!seg || chan < 1 || chan > LIVEMONITOR_CHANNELS) return;
+    LiveChannel & lc = seg->channel[chan-1];
+    int64_t n = head.actualPoints;
+    if (n > LIVEMONITOR_MAX_POINTS) n = LIVEMONITOR_MAX_POINTS;
+    SeqlockWriteBegin(lc.seq);
+    lc.polarity = polarity;
+    lc.eventNumber = head.eventNumber;
+    lc.actualPoints = n;
+    lc.trigTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(head.trigTime.time_since_epoch()).count();
+    lc.initialXOffset = head.initialXOffset;
+    lc.xIncrement = head.xIncrement;
+    lc.scaleFactor = head.scaleFactor;
+    lc.scaleOffset = head.scaleOffset;
+    memcpy(lc.samples,data+head.firstValidPoint,n);
+    SeqlockWriteEnd(lc.seq);
+    seg->channelMask |= (1u<<(chan-1));
+  }
+
+  void UpdateCounters(uint64_t triggers, uint64_t recorded, uint64_t clipHigh, uint64_t clipLow)
+  {
+    if (!seg) return;
+    LiveCounters & c = seg->counters;
+    SeqlockWriteBegin(c.seq);
+    c.triggers = triggers;
+    c.recorded = recorded;
+    c.clipHigh = clipHigh;
+    c.clipLow = clipLow;
+    c.updateNs = LiveNowNs();
+    SeqlockWriteEnd(c.seq);
+  }
+
+ private:
+  LiveSegment * seg;
+};
+
+// Reader side, used by DigiView.
+class LiveReader
+{
+ public:
+  LiveReader() : seg(0) {}
+  ~LiveReader() { Detach(); }
+
+  bool Attach()
+  {
+    int fd = shm_open(LIVEMONITOR_NAME,O_RDONLY,0);
+    if (fd < 0) return false;
+    void * p = mmap(0,sizeof(LiveSegment),PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    seg = (const LiveSegment*)p;
+    if (!Alive())
+      {
+	Detach();
+	return false;
+      }
+    return true;
+  }
+
+  void Detach()
+  {
+    if (!seg) return;
+    munmap((void*)seg,sizeof(LiveSegment));
+    seg = 0;
+  }
+
+  bool Attached() { return seg != 0; }
+
+  // False once the publisher closed the segment or died.
+  bool Alive()
+  {
+    if (!seg) return false;
+    if (seg->magic != LIVEMONITOR_MAGIC || seg->version != LIVEMONITOR_VERSION) return false;
+    return (kill(seg->pid,0) == 0);
+  }
+
+  uint32_t ChannelMask() { return seg ? seg->channelMask : 0; }
+
+  uint32_t ReadCounters(LiveCounters * out)
+  {
+    const LiveCounters & c = seg->counters;
+    return SeqlockRead(c.seq,(const char*)&c+sizeof(c.seq),(char*)out+sizeof(out->seq),sizeof(LiveCounters)-sizeof(c.seq));
+  }
+
+  // Copies the metadata and the actualPoints valid samples of channel chan
+  // (1-8) into out. Returns the sequence number of the copy.
+  uint32_t ReadChannel(int chan, LiveChannel * out)
+  {
+    const LiveChannel & lc = seg->channel[chan-1];
+    size_t meta = offsetof(LiveChannel,samples)-sizeof(lc.seq);
+    while (true)
+      {
+	uint32_t s0 = SeqlockRead(lc.seq,(const char*)&lc+sizeof(lc.seq),(char*)out+sizeof(out->seq),meta);
+	int64_t n = out->actualPoints;
+	if (n < 0 || n > LIVEMONITOR_MAX_POINTS) n = 0;
+	memcpy(out->samples,lc.samples,n);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (lc.seq.load(std::memory_order_relaxed) == s0) return s0;
+      }
+  }
+
+ private:
+  const LiveSegment * seg;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef ONLINEFEATURES_H
+#define ONLINEFEATURES_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <chrono>
+
+#include "AgMD2.h"
+
+#include "Header.h"
+#include "PulseFeatures.h"
+#include "FeatureKernel.h"
+
+// Worker pool for OnlineFeatures mode. The acquisition loop fetches every
+// trigger into a pre-allocated Event slot and hands it over with Submit().
+// The workers compute the pulse features of each channel, append one
+// FeatureRow per channel to the feature file, and write the full waveforms
+// to the data file only when the event was prescaled for saving or passes
+// the amplitude selection. All channels of an event are written together,
+// so waveform can still read the data file, and the events are written in
+// the order they were submitted (eventNumber order): a worker that is done
+// early waits for its turn, as analyse_parallel in waveform fills in file
+// order.
+class OnlineFeatures
+{
+ public:
+  struct Event
+  {
+    bool keep;                  // prescaled for saving by the acquisition loop
+    int nchan;
+    Header head[8];
+    int source[8];              // pulse sign of each channel
+    unsigned long seq;          // submission order, set by Submit()
+    std::vector<ViInt8> data[8];
+  };
+
+  OnlineFeatures(int nthreads, int nslots, std::ofstream * dataout, std::ofstream * featout, ViReal64 saveAbove)
+    : slots(nslots), dataFile(dataout), featFile(featout), amplitudeCut(saveAbove),
+      submitted(0), written(0), processed(0), saved(0), stalls(0), done(false)
+  {
+    for (auto & s : slots) freeList.push_back(&s);
+    if (nthreads < 1) nthreads = 1;
+    for (int i = 0; i < nthreads; ++i) workers.emplace_back(&OnlineFeatures::work, this);
+  }
+
+  ~OnlineFeatures() { Finish(); }
+
+  // Blocks until a slot is free. Only the acquisition thread calls this.
+  Event * Acquire()
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (freeList.empty()) ++stalls;
+    cvFree.wait(lock, [this]{ return !freeList.empty(); });
+    Event * ev = freeList.back();
+    freeList.pop_back();
+    ev->nchan = 0;
+    ev->keep = false;
+    return ev;
+  }
+
+  // Hand back a slot without processing it (e.g. saturated event).
+  void Release(Event * ev)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    freeList.push_back(ev);
+    cvFree.notify_one();
+  }
+
+  void Submit(Event * ev)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ev->seq = submitted++;
+    pending.push_back(ev);
+    cvWork.notify_one();
+  }
+
+  // Drain the queue and stop the workers.
+  void Finish()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (done) return;
+      done = true;
+    }
+    cvWork.notify_all();
+    for (auto & w : workers) w.join();
+    workers.clear();
+  }
+
+  // Push what the workers wrote so far out to the files, so a following
+  // waveform sees it.
+  void Flush()
+  {
+    std::lock_guard<std::mutex> lock(fileMtx);
+    dataFile->flush();
+    featFile->flush();
+  }
+
+  unsigned long Processed() { std::lock_guard<std::mutex> lock(mtx); return processed; }
+  unsigned long Saved() { std::lock_guard<std::mutex> lock(mtx); return saved; }
+  unsigned long Stalls() { std::lock_guard<std::mutex> lock(mtx); return stalls; }
+
+ private:
+  void work()
+  {
+    FeatureRow rows[8];
+    while (true)
+      {
+	Event * ev;
+	{
+	  std::unique_lock<std::mutex> lock(mtx);
+	  cvWork.wait(lock, [this]{ return done || !pending.empty(); });
+	  if (pending.empty()) return;
+	  ev = pending.front();
+	  pending.pop_front();
+	}
+
+	bool keep = ev->keep;
+	for (int c = 0; c < ev->nchan; ++c)
+	  {
+	    const Header & head = ev->head[c];
+	    FeatureRow & row = rows[c];
+	    ExtractPulseFeaturesFast(ev->data[c].data()+head.firstValidPoint, head.actualPoints, ev->source[c], head, &row.feat);
+	    row.trigTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(head.trigTime.time_since_epoch()).count();
+	    row.eventNumber = head.eventNumber;
+	    row.channel = head.channelNumber;
+	    row.source = ev->source[c];
+	    row.reserved = 0;
+	    if (amplitudeCut > 0 && row.feat.amplitudeAdc > amplitudeCut) keep = true;
+	  }
+	for (int c = 0; c < ev->nchan; ++c) rows[c].saved = keep;
+
+	{
+	  // events are taken from pending in order, so the one before this
+	  // is already with another worker
+	  std::unique_lock<std::mutex> lock(fileMtx);
+	  cvWritten.wait(lock, [this,ev]{ return written == ev->seq; });
+	  featFile->write((char*)rows,ev->nchan*sizeof(FeatureRow));
+	  if (keep)
+	    {
+	      for (int c = 0; c < ev->nchan; ++c)
+		{
+		  dataFile->write((char*)&ev->head[c],sizeof(Header));
+		  dataFile->write((char*)ev->data[c].data(),ev->head[c].memsize*sizeof(ViInt8));
+		}
+	    }
+	  ++written;
+	}
+	cvWritten.notify_all();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	++processed;
+	if (keep) ++saved;
+	freeList.push_back(ev);
+	cvFree.notify_one();
+      }
+  }
+
+  std::vector<Event> slots;
+  std::vector<Event*> freeList;
+  std::deque<Event*> pending;
+  std::vector<std::thread> workers;
+  std::mutex mtx;
+  std::mutex fileMtx;
+  std::condition_variable cvFree;
+  std::condition_variable cvWork;
+  std::condition_variable cvWritten;    // with fileMtx
+
+  std::ofstream * dataFile;
+  std::ofstream * featFile;
+  ViReal64 amplitudeCut;
+
+  unsigned long submitted;
+  unsigned long written;        // with fileMtx
+  unsigned long processed;
+  unsigned long saved;
+  unsigned long stalls;
+  bool done;
+};
+
+#endif
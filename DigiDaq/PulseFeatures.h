@@ -0,0 +1,116 @@
+#ifndef PULSEFEATURES_H
+#define PULSEFEATURES_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "TMath.h"
+
+#include "Header.h"
+
+// Pulse features as stored in waveform's pulsetree.
+struct PulseFeatures
+{
+  float baseVolt;
+  float baseAdc;
+  float baseRmsVolt;
+  float baseRmsAdc;
+  float amplitudeVolt;
+  float amplitudeAdc;
+  float maxVolt;
+  float maxAdc;
+  float peaktimeSec;
+  float peaktimeTdc;
+  float riseTimeSec;
+  float riseTimeTdc;
+  float fwhmSec;
+  float fwhmTdc;
+};
+
+// One row of the online feature file written by DigiDaq (OnlineFeatures true).
+// The file is a plain sequence of these rows, in eventNumber order.
+struct FeatureRow
+{
+  int64_t trigTimeNs;   // system_clock nanoseconds since epoch
+  int32_t eventNumber;
+  uint8_t channel;
+  int8_t source;        // pulse sign the features were taken with (PulseSign)
+  uint8_t saved;        // 1 if the full waveform was also written to the data file
+  uint8_t reserved;
+  PulseFeatures feat;
+};
+
+// Baseline, amplitude, peak time, rise time and FWHM of one waveform.
+// source < 0 means a negative polarity pulse (same convention as the
+// waveform command line). T can be the raw ViInt8 samples or floats,
+// both give identical results.
+template <typename T>
+void ExtractPulseFeatures(const T * wf, int64_t wf_size, int source, const Header & head, PulseFeatures * f)
+{
+  float scalefactor = head.scaleFactor;
+  float scaleoffset = head.scaleOffset;
+
+  f->baseAdc = TMath::Mean(wf,wf+(int64_t)(wf_size*0.25));
+  f->baseVolt = scalefactor*f->baseAdc+scaleoffset;
+  f->baseRmsAdc = TMath::StdDev(wf,wf+(int64_t)(wf_size*0.25));
+  f->baseRmsVolt = scalefactor*f->baseRmsAdc+scaleoffset;
+
+  float maximum = -9999;
+  float minimum = 9999;
+  float maxpeaktime = -9999;
+  float minpeaktime = -9999;
+  for (int64_t v = 0; v < wf_size; ++v)
+    {
+      float val = wf[v];
+      if (val > maximum)
+	{
+	  maximum = val;
+	  maxpeaktime = v;
+	}
+      if (val < minimum)
+	{
+	  minimum = val;
+	  minpeaktime = v;
+	}
+    }
+  f->peaktimeTdc = (source<0) ? minpeaktime : maxpeaktime;
+  f->peaktimeSec = head.initialXOffset+head.xIncrement*f->peaktimeTdc;
+  f->maxAdc = (source<0) ? minimum : maximum;
+  f->maxVolt = scalefactor*f->maxAdc+scaleoffset;
+  f->amplitudeAdc = fabs(f->maxAdc-f->baseAdc);
+  f->amplitudeVolt = fabs(f->maxVolt-f->baseVolt);
+
+  float baseAdc = f->baseAdc;
+  float tpct = f->amplitudeAdc*0.1;
+  float npct = f->amplitudeAdc*0.9;
+  float fpct = f->amplitudeAdc*0.5;
+  float riseLow = -1, riseHigh = -1;
+  float halfLow = -1, halfHigh = -1;
+  for (int64_t v = 1; v < wf_size; ++v)
+    {
+      float prevamp = fabs((float)wf[v-1] - baseAdc);
+      float thisamp = fabs((float)wf[v]   - baseAdc);
+      if (prevamp < tpct && thisamp >= tpct)
+	{
+	  riseLow = v;
+	}
+      if (prevamp < npct && thisamp >= npct)
+	{
+	  riseHigh = v;
+	}
+      if (prevamp < fpct && thisamp >= fpct)
+	{
+	  halfLow = v;
+	}
+      if (prevamp >= fpct && thisamp < fpct)
+	{
+	  halfHigh = v;
+	}
+    }
+  f->fwhmTdc = halfHigh - halfLow;
+  f->fwhmSec = head.xIncrement*f->fwhmTdc;
+  f->riseTimeTdc = riseHigh - riseLow;
+  f->riseTimeSec = head.xIncrement*f->riseTimeTdc;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef RECORDREADER_H
+#define RECORDREADER_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Header.h"
+
+// One record of a DigiDaq data file. The header is copied out (it sits at
+// arbitrary alignment in the file, 88 bytes), the samples are not:
+// samples points straight into the mapping, at the first valid point.
+struct RecordView
+{
+  Header head;
+  const ViInt8 * samples;   // head.actualPoints samples
+  int64_t offset;           // file offset of the header
+};
+
+// All records of one event, by channel. chan[c] is only valid when bit c
+// of mask is set; a channel written twice keeps its last record.
+struct EventView
+{
+  int eventNumber;
+  uint32_t mask;            // bit c set when channel c+1 is present
+  int64_t offset;           // file offset of the first record
+  int64_t end;              // file offset just after the last record
+  RecordView chan[8];
+};
+
+// Read-only memory mapping of a DigiDaq binary file
+// (<<header>><<waveform>><<header>><<waveform>>...). Records are parsed in
+// place, nothing is allocated per record. A file cut short by a crashed or
+// still running DigiDaq ends cleanly at the last complete record; the
+// leftover bytes are reported by TailBytes().
+//
+// A file that is still being written can be followed: Open() it with a
+// reserve, which maps that much address space up front so records never
+// move, and call Refresh() to pick up what was appended. Iteration simply
+// resumes at the record that was incomplete before.
+class RecordReader
+{
+ public:
+  RecordReader() : base(0), size(0), mapped(0), pos(0), tail(0), released(0), fd(-1) {}
+  ~RecordReader() { Close(); }
+
+  // sequential: the file will be read front to back (kernel read-ahead),
+  // otherwise the whole file is requested up front for random access.
+  // reserve > 0: keep the file open for Refresh(), up to reserve bytes.
+  bool Open(const std::string & filename, bool sequential = true, int64_t reserve = 0)
+  {
+    Close();
+    fd = open(filename.c_str(),O_RDONLY);
+    if (fd < 0)
+      {
+	perror(("RecordReader: "+filename).c_str());
+	return false;
+      }
+    struct stat st;
+    if (fstat(fd,&st) != 0)
+      {
+	perror("RecordReader: fstat");
+	close(fd);
+	fd = -1;
+	return false;
+      }
+    size = st.st_size;
+    // shared when following, so pages past the old end fill in as the
+    // writer appends
+    mapped = reserve > size ? reserve : size;
+    if (mapped > 0)
+      {
+	void * p = mmap(0,mapped,PROT_READ,reserve > 0 ? MAP_SHARED : MAP_PRIVATE,fd,0);
+	if (p == MAP_FAILED)
+	  {
+	    perror("RecordReader: mmap");
+	    close(fd);
+	    fd = -1;
+	    size = mapped = 0;
+	    return false;
+	  }
+	base = (const char*)p;
+	madvise(p,mapped,sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+      }
+    if (reserve <= 0)
+      {
+	close(fd);
+	fd = -1;
+      }
+    pos = 0;
+    tail = 0;
+    released = 0;
+    return true;
+  }
+
+  void Close()
+  {
+    if (base) munmap((void*)base,mapped);
+    if (fd >= 0) close(fd);
+    base = 0;
+    fd = -1;
+    size = 0;
+    mapped = 0;
+    pos = 0;
+    tail = 0;
+  }
+
+  // Parse the record whose header starts at offset. False if it does not
+  // fit in the file or the header makes no sense.
+  bool At(int64_t offset, RecordView * r) const
+  {
+    if (offset < 0 || offset+(int64_t)sizeof(Header) > size) return false;
+    memcpy(&r->head,base+offset,sizeof(Header));
+    const Header & h = r->head;
+    if (h.memsize < 0 || h.firstValidPoint < 0 || h.actualPoints < 0 ||
+	h.firstValidPoint+h.actualPoints > h.memsize) return false;
+    if (h.memsize > size-offset-(int64_t)sizeof(Header)) return false;
+    r->samples = (const ViInt8*)(base+offset+sizeof(Header)+h.firstValidPoint);
+    r->offset = offset;
+    return true;
+  }
+
+  // File offset of the record following r.
+  static int64_t NextOffset(const RecordView & r) { return r.offset+sizeof(Header)+r.head.memsize; }
+
+  // Sequential iteration from the current position. Stops in front of an
+  // incomplete record, so a later Refresh() can pick it up.
+  bool Next(RecordView * r)
+  {
+    if (pos >= size) return false;
+    if (!At(pos,r))
+      {
+	tail = size-pos;
+	return false;
+      }
+    pos = NextOffset(*r);
+    return true;
+  }
+
+  // Followed file: take in what was appended since Open() or the last call.
+  // False if nothing new (or not opened for following). The file can
+  // not grow past the reserve.
+  bool Refresh()
+  {
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd,&st) != 0) return false;
+    int64_t now = st.st_size < mapped ? (int64_t)st.st_size : mapped;
+    if (now <= size) return false;
+    size = now;
+    tail = 0;
+    return true;
+  }
+
+  // True once a followed file has filled its reserve.
+  bool Full() const { return fd >= 0 && size >= mapped; }
+
+  // Start iterating at offset (must be the start of a record).
+  void Seek(int64_t offset) { pos = offset; tail = 0; }
+  void Rewind() { Seek(0); }
+
+  // Drop the pages before offset from this process (they stay in the page
+  // cache), keeps the resident size flat during long scans.
+  void Release(int64_t offset)
+  {
+    long page = sysconf(_SC_PAGESIZE);
+    int64_t end = (offset/page)*page;
+    if (!base || end <= released) return;
+    madvise((void*)(base+released),end-released,MADV_DONTNEED);
+    released = end;
+  }
+
+  int64_t Size() const { return size; }
+  int64_t Position() const { return pos; }
+  int64_t TailBytes() const { return tail; }
+
+ private:
+  const char * base;
+  int64_t size;
+  int64_t mapped;
+  int64_t pos;
+  int64_t tail;
+  int64_t released;
+  int fd;
+};
+
+#endif
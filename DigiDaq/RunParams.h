@@ -13,6 +13,15 @@ class RunParams
   ViConstString optChar; bool setOC = false;
   bool draw; bool setDRAW = false;
   ViReal64 dutyCycle; bool setDuty = false;
+  // optional, defaults set in Reset()
+  bool onlineFeatures;
+  int featureThreads;
+  ViReal64 saveAmplitudeAbove;
+  std::string calibrationFile;
+  ViReal64 calibrationMaxAge;   // seconds, 0 = always calibrate
+  ViReal64 calibrationMaxDeltaT; // degrees C
+  std::string statsFile;
+  ViReal64 statsInterval;       // seconds
 
  public:
   RunParams() {}
@@ -28,6 +37,14 @@ class RunParams
     setOC = false;
     setDRAW = false;
     setDuty = false;
+    onlineFeatures = false;
+    featureThreads = 2;
+    saveAmplitudeAbove = 0;
+    calibrationFile = "DigiDaq_calibration.cache";
+    calibrationMaxAge = 3600;
+    calibrationMaxDeltaT = 2;
+    statsFile = "DigiDaq_stats.json";
+    statsInterval = 1;
   }
   
   std::string GetResourceName()   { return resourceName; }
@@ -39,6 +56,14 @@ class RunParams
   ViConstString GetOptChar() { return optChar;      }
   bool GetDraw() { return draw; }
   ViReal64 GetDutyCycle() { return dutyCycle; }
+  bool GetOnlineFeatures() { return onlineFeatures; }
+  int GetFeatureThreads() { return featureThreads; }
+  ViReal64 GetSaveAmplitudeAbove() { return saveAmplitudeAbove; }
+  std::string GetCalibrationFile() { return calibrationFile; }
+  ViReal64 GetCalibrationMaxAge() { return calibrationMaxAge; }
+  ViReal64 GetCalibrationMaxDeltaT() { return calibrationMaxDeltaT; }
+  std::string GetStatsFile() { return statsFile; }
+  ViReal64 GetStatsInterval() { return statsInterval; }
 
   void SetResourceName(std::string rn)
   {
@@ -54,6 +79,14 @@ class RunParams
   void SetTriggerDelay(ViReal64 td)  { triggerDelay = td; setTD = true;  }
   void SetDraw(bool d) { draw = d; setDRAW = true; }
   void SetDutyCycle(ViReal64 d) { dutyCycle = d; setDuty = true; }
+  void SetOnlineFeatures(bool o) { onlineFeatures = o; }
+  void SetFeatureThreads(int n) { featureThreads = n; }
+  void SetSaveAmplitudeAbove(ViReal64 a) { saveAmplitudeAbove = a; }
+  void SetCalibrationFile(std::string f) { calibrationFile = f; }
+  void SetCalibrationMaxAge(ViReal64 a) { calibrationMaxAge = a; }
+  void SetCalibrationMaxDeltaT(ViReal64 t) { calibrationMaxDeltaT = t; }
+  void SetStatsFile(std::string f) { statsFile = f; }
+  void SetStatsInterval(ViReal64 t) { statsInterval = (t > 0) ? t : 1; }
 
   bool Complete() { return (setRN && setNR && setRS && setSR && setTIM && setTD && setOC && setDRAW && setDuty); }
 
@@ -0,0 +1,136 @@
+#ifndef SATURATIONSCAN_H
+#define SATURATIONSCAN_H
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SATURATIONSCAN_X86
+#endif
+
+#define SATURATION_HIGH 0x1   // polarity*sample >= 127
+#define SATURATION_LOW  0x2   // polarity*sample <= -127
+
+// One pass over an int8 record: polarity flip, saturation test and an
+// optional copy of the polarity corrected samples to display (e.g. the
+// Int_t storage of a TH1I, display[i] == bin i). With stopAtFirst the SIMD
+// scans return as soon as a block with a saturated sample is seen, display
+// is then incomplete; the scalar scan always reads the whole record.
+//
+// The SIMD scans test the raw samples against +-127 and map the result
+// through the polarity at the end, so the polarity is never multiplied in
+// per sample.
+
+inline int SaturationFlags(int rawhigh, int rawlow, int polarity)
+{
+  int high = (polarity < 0) ? rawlow : rawhigh;
+  int low = (polarity < 0) ? rawhigh : rawlow;
+  return (high ? SATURATION_HIGH : 0) | (low ? SATURATION_LOW : 0);
+}
+
+// The loop AgMD2_DAQ::app always had. A test for early exit in it keeps
+// the compiler from vectorising it and costs more than it saves on clean
+// records, so stopAtFirst is not used here.
+inline int ScanSaturationScalar(const int8_t * x, int64_t n, int polarity, int * display, bool stopAtFirst)
+{
+  (void)stopAtFirst;
+  bool high = false, low = false;
+  int pol = (polarity < 0) ? -1 : 1;
+  for (int64_t i = 0; i < n; i++)
+    {
+      int val = pol*x[i];
+      if (display) display[i] = val;
+      if (val >= 127) high = true;
+      if (val <= -127) low = true;
+    }
+  return (high ? SATURATION_HIGH : 0) | (low ? SATURATION_LOW : 0);
+}
+
+#ifdef SATURATIONSCAN_X86
+
+// SSE2 is part of x86-64, so this path needs no runtime check.
+inline int ScanSaturationSSE2(const int8_t * x, int64_t n, int polarity, int * display, bool stopAtFirst)
+{
+  const __m128i top = _mm_set1_epi8(126);
+  const __m128i bottom = _mm_set1_epi8(-126);
+  const __m128i zero = _mm_setzero_si128();
+  int rawhigh = 0, rawlow = 0;
+  int64_t i = 0;
+  for (; i+16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(x+i));
+      int hi = _mm_movemask_epi8(_mm_cmpgt_epi8(v,top));
+      int lo = _mm_movemask_epi8(_mm_cmpgt_epi8(bottom,v));
+      if (display)
+	{
+	  // sign extend 16 x int8 to 4 x (4 x int32)
+	  __m128i sign = _mm_cmpgt_epi8(zero,v);
+	  __m128i w0 = _mm_unpacklo_epi8(v,sign);
+	  __m128i w1 = _mm_unpackhi_epi8(v,sign);
+	  __m128i s0 = _mm_cmpgt_epi16(zero,w0);
+	  __m128i s1 = _mm_cmpgt_epi16(zero,w1);
+	  __m128i d[4] = { _mm_unpacklo_epi16(w0,s0), _mm_unpackhi_epi16(w0,s0),
+			   _mm_unpacklo_epi16(w1,s1), _mm_unpackhi_epi16(w1,s1) };
+	  for (int k = 0; k < 4; ++k)
+	    {
+	      if (polarity < 0) d[k] = _mm_sub_epi32(zero,d[k]);
+	      _mm_storeu_si128((__m128i*)(display+i+4*k),d[k]);
+	    }
+	}
+      rawhigh |= hi;
+      rawlow |= lo;
+      if (stopAtFirst && (rawhigh | rawlow)) return SaturationFlags(rawhigh,rawlow,polarity);
+    }
+  int tail = ScanSaturationScalar(x+i,n-i,polarity,display ? display+i : 0,stopAtFirst);
+  return tail | SaturationFlags(rawhigh,rawlow,polarity);
+}
+
+__attribute__((target("avx2")))
+inline int ScanSaturationAVX2(const int8_t * x, int64_t n, int polarity, int * display, bool stopAtFirst)
+{
+  const __m256i top = _mm256_set1_epi8(126);
+  const __m256i bottom = _mm256_set1_epi8(-126);
+  const __m256i zero = _mm256_setzero_si256();
+  int rawhigh = 0, rawlow = 0;
+  int64_t i = 0;
+  for (; i+32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(x+i));
+      int hi = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v,top));
+      int lo = _mm256_movemask_epi8(_mm256_cmpgt_epi8(bottom,v));
+      if (display)
+	{
+	  for (int k = 0; k < 4; ++k)
+	    {
+	      __m256i d = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x+i+8*k)));
+	      if (polarity < 0) d = _mm256_sub_epi32(zero,d);
+	      _mm256_storeu_si256((__m256i*)(display+i+8*k),d);
+	    }
+	}
+      rawhigh |= hi;
+      rawlow |= lo;
+      if (stopAtFirst && (rawhigh | rawlow)) return SaturationFlags(rawhigh,rawlow,polarity);
+    }
+  int tail = ScanSaturationSSE2(x+i,n-i,polarity,display ? display+i : 0,stopAtFirst);
+  return tail | SaturationFlags(rawhigh,rawlow,polarity);
+}
+
+inline bool HaveAVX2()
+{
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+#endif
+
+inline int ScanSaturation(const int8_t * x, int64_t n, int polarity, int * display, bool stopAtFirst)
+{
+#ifdef SATURATIONSCAN_X86
+  if (HaveAVX2()) return ScanSaturationAVX2(x,n,polarity,display,stopAtFirst);
+  return ScanSaturationSSE2(x,n,polarity,display,stopAtFirst);
+#else
+  return ScanSaturationScalar(x,n,polarity,display,stopAtFirst);
+#endif
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TELEMETRY_TSC
+#endif
+
+#define TELEMETRY_WAIT_SLICE_MS 1000   /* longest single wait for a trigger, so the stats keep coming */
+
+// Run telemetry for the acquisition loop. The loop calls Lap() at the end
+// of every phase of a record, which costs one TSC read and an add. Once per
+// interval (checked against the last TSC stamp, so no extra clock read) the
+// totals are turned into rates and written as a small JSON object, replacing
+// the file atomically so a scraper never sees a partial one.
+//
+// Live time is the time spent inside AgMD2_WaitForAcquisitionComplete, i.e.
+// with the digitizer armed. The loop waits in slices of at most
+// TELEMETRY_WAIT_SLICE_MS and publishes between them when due, so the stats
+// file is written on time even when no trigger comes. Everything else (initiate, fetch, write, the
+// publishing of the stats and the loop itself) is dead time.
+//
+// The TSC rate is measured once, in Start(), against steady_clock across a
+// sleep that does nothing else.
+
+enum TelemetryPhase
+  {
+    TELEMETRY_INITIATE,
+    TELEMETRY_WAIT,
+    TELEMETRY_FETCH,
+    TELEMETRY_WRITE,
+    TELEMETRY_PUBLISH,
+    TELEMETRY_NPHASES
+  };
+
+static const char * const TelemetryPhaseName[TELEMETRY_NPHASES] = { "initiate", "wait", "fetch", "write", "publish" };
+
+inline uint64_t TelemetryTicks()
+{
+#ifdef TELEMETRY_TSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Run totals, owned by the acquisition loop and handed to Publish().
+struct TelemetryCounts
+{
+  uint64_t triggers;      // acquisitions completed
+  uint64_t fetched;       // of those, read out of the digitizer
+  uint64_t recorded;      // fetched and not saturated
+  uint64_t rejected;      // fetched and saturated
+  uint64_t clipHigh;
+  uint64_t clipLow;
+  uint64_t saved;         // events with waveforms written to disk
+
+  TelemetryCounts() : triggers(0), fetched(0), recorded(0), rejected(0), clipHigh(0), clipLow(0), saved(0) {}
+};
+
+class Telemetry
+{
+ public:
+  Telemetry(const std::string & p, double interval = 1.0)
+    : path(p), tmppath(p+".tmp"), period(interval), last(0), next(0), ticksPerSec(1e9)
+  {
+    for (int i = 0; i < TELEMETRY_NPHASES; ++i) ticks[i] = 0;
+  }
+
+  // Measures the tick rate over a 100 ms sleep and starts the clock.
+  void Start()
+  {
+#ifdef TELEMETRY_TSC
+    uint64_t c0 = TelemetryTicks();
+    auto t0 = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint64_t c1 = TelemetryTicks();
+    auto t1 = std::chrono::steady_clock::now();
+    ticksPerSec = (c1-c0)/std::chrono::duration<double>(t1-t0).count();
+#endif
+    startTime = std::chrono::steady_clock::now();
+    last = TelemetryTicks();
+    next = last+(uint64_t)(ticksPerSec*period);
+    prevTime = startTime;
+    for (int i = 0; i < TELEMETRY_NPHASES; ++i) ticks[i] = prevPhase[i] = 0;
+    prev = TelemetryCounts();
+  }
+
+  // Charge the time since the previous Lap() to phase.
+  void Lap(int phase)
+  {
+    uint64_t t = TelemetryTicks();
+    ticks[phase] += t-last;
+    last = t;
+  }
+
+  bool Due() { return last >= next; }
+
+  // Write the stats file for the interval since the previous call. The
+  // caller charges the time it takes with Lap(TELEMETRY_PUBLISH).
+  void Publish(const TelemetryCounts & c)
+  {
+    auto now = std::chrono::steady_clock::now();
+    double run = std::chrono::duration<double>(now-startTime).count();
+    double dt = std::chrono::duration<double>(now-prevTime).count();
+    if (dt <= 0) dt = 1e-9;
+
+    uint64_t dtrig = c.triggers-prev.triggers;
+    uint64_t dfetch = c.fetched-prev.fetched;
+    uint64_t drej = c.rejected-prev.rejected;
+    double dphase[TELEMETRY_NPHASES];
+    for (int i = 0; i < TELEMETRY_NPHASES; ++i) dphase[i] = (ticks[i]-prevPhase[i])/ticksPerSec;
+
+    FILE * f = fopen(tmppath.c_str(),"w");
+    if (f)
+      {
+	fprintf(f,"{\n");
+	fprintf(f,"  \"time\": %lld,\n",(long long)std::time(0));
+	fprintf(f,"  \"run_seconds\": %.3f,\n",run);
+	fprintf(f,"  \"interval_seconds\": %.3f,\n",dt);
+	fprintf(f,"  \"triggers\": %llu,\n",(unsigned long long)c.triggers);
+	fprintf(f,"  \"fetched\": %llu,\n",(unsigned long long)c.fetched);
+	fprintf(f,"  \"recorded\": %llu,\n",(unsigned long long)c.recorded);
+	fprintf(f,"  \"saved\": %llu,\n",(unsigned long long)c.saved);
+	fprintf(f,"  \"rejected\": %llu,\n",(unsigned long long)c.rejected);
+	fprintf(f,"  \"rejected_high\": %llu,\n",(unsigned long long)c.clipHigh);
+	fprintf(f,"  \"rejected_low\": %llu,\n",(unsigned long long)c.clipLow);
+	fprintf(f,"  \"trigger_rate_hz\": %.3f,\n",dtrig/dt);
+	fprintf(f,"  \"record_rate_hz\": %.3f,\n",(c.recorded-prev.recorded)/dt);
+	fprintf(f,"  \"live_fraction\": %.5f,\n",dphase[TELEMETRY_WAIT]/dt);
+	fprintf(f,"  \"rejection_fraction\": %.5f,\n",dfetch ? (double)drej/dfetch : 0.);
+	fprintf(f,"  \"phase_us_per_trigger\": {");
+	for (int i = 0; i < TELEMETRY_NPHASES; ++i)
+	  fprintf(f,"%s\"%s\": %.3f",i ? ", " : " ",TelemetryPhaseName[i],dtrig ? 1e6*dphase[i]/dtrig : 0.);
+	fprintf(f," }\n");
+	fprintf(f,"}\n");
+	if (fclose(f) == 0) std::rename(tmppath.c_str(),path.c_str());
+      }
+
+    prev = c;
+    prevTime = now;
+    for (int i = 0; i < TELEMETRY_NPHASES; ++i) prevPhase[i] = ticks[i];
+    next = last+(uint64_t)(ticksPerSec*period);
+  }
+
+  // End of run: time per phase over the whole run.
+  void Summary(const TelemetryCounts & c)
+  {
+    double total = 0;
+    for (int i = 0; i < TELEMETRY_NPHASES; ++i) total += ticks[i];
+    printf("\n Time per trigger (%llu triggers):\n",(unsigned long long)c.triggers);
+    for (int i = 0; i < TELEMETRY_NPHASES; ++i)
+      printf("   %-10s %10.2f us  %5.1f %%\n",TelemetryPhaseName[i],
+	     c.triggers ? 1e6*ticks[i]/ticksPerSec/c.triggers : 0.,
+	     total > 0 ? 100.*ticks[i]/total : 0.);
+    printf(" Live time fraction %.4f\n",total > 0 ? ticks[TELEMETRY_WAIT]/total : 0.);
+  }
+
+ private:
+  std::string path;
+  std::string tmppath;
+  double period;
+
+  uint64_t ticks[TELEMETRY_NPHASES];
+  uint64_t last;
+  uint64_t next;
+  double ticksPerSec;
+
+  std::chrono::steady_clock::time_point startTime;
+  std::chrono::steady_clock::time_point prevTime;
+  uint64_t prevPhase[TELEMETRY_NPHASES];
+  TelemetryCounts prev;
+};
+
+#endif
@@ -0,0 +1,792 @@
+/**********************************************
+Microbenchmarks for the DigiDaq/waveform kernels.
+
+Build with:
+ make bench
+
+Run:
+ ./bench scan [record size]
+ ./bench read [file.dat | MB to generate, default 2048]
+ ./bench features [record size]
+ ./bench schema file.root [file.root ...]
+ ./bench filters [record size]
+ ./bench cfd [record size]
+ ./bench template [record size]
+
+Each benchmark first checks the fast paths against the scalar reference
+on random data and stops if they disagree, then prints timings.
+  schema compares waveform outputs, typically one run written twice:
+ ./waveform run.dat c1 ... c8 -schema 1 -o run_v1.root
+ ./waveform run.dat c1 ... c8 -schema 2 -o run_v2.root
+**********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include "SaturationScan.h"
+#include "RecordReader.h"
+#include "EventAssembler.h"
+#include "PulseFeatures.h"
+#include "FeatureKernel.h"
+#include "Filters.h"
+#include "CfdTiming.h"
+#include "PulseTemplate.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Keep the optimiser from dropping results.
+static volatile int64_t bench_sink;
+
+template <typename F>
+double TimePerCall(F f, int64_t ncalls)
+{
+  auto start = bench_clock::now();
+  for (int64_t i = 0; i < ncalls; ++i) f(i);
+  auto end = bench_clock::now();
+  return std::chrono::duration<double,std::nano>(end-start).count()/ncalls;
+}
+
+void FillRandom(std::vector<int8_t> & v, int lo, int hi, unsigned seed)
+{
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> dist(lo,hi);
+  for (auto & x : v) x = dist(gen);
+}
+
+// The per-sample loop that used to be in AgMD2_DAQ::app
+int ScanSaturationOriginal(const int8_t * x, int64_t n, int polarity, int * display)
+{
+  bool high = false, low = false;
+  for (int64_t i = 0; i < n; i++)
+    {
+      int val = polarity*x[i];
+      if (display) display[i] = val;
+      if (val >= 127) high = true;
+      if (val <= -127) low = true;
+    }
+  return (high ? SATURATION_HIGH : 0) | (low ? SATURATION_LOW : 0);
+}
+
+int bench_scan(int argc, char ** argv)
+{
+  int64_t n = (argc > 2) ? std::atoll(argv[2]) : 300;
+  const int nrec = 1024;
+  std::vector<int8_t> rec(n*nrec);
+  std::vector<int> display(n);
+  std::vector<int> check(n);
+
+  // correctness: random records with and without saturated samples
+  for (int trial = 0; trial < 2000; ++trial)
+    {
+      int64_t len = 1+trial%std::max<int64_t>(n,1);
+      std::vector<int8_t> x(len);
+      FillRandom(x,(trial%3==0) ? -128 : -126,(trial%5==0) ? 127 : 126,trial);
+      int pol = (trial%2) ? -1 : 1;
+      int ref = ScanSaturationOriginal(x.data(),len,pol,check.data());
+      int got[3];
+      got[0] = ScanSaturationScalar(x.data(),len,pol,display.data(),false);
+#ifdef SATURATIONSCAN_X86
+      got[1] = ScanSaturationSSE2(x.data(),len,pol,display.data(),false);
+      got[2] = HaveAVX2() ? ScanSaturationAVX2(x.data(),len,pol,display.data(),false) : ref;
+#else
+      got[1] = got[2] = got[0];
+#endif
+      for (int k = 0; k < 3; ++k)
+	{
+	  if (got[k] != ref)
+	    {
+	      printf("scan: flag mismatch (path %i, trial %i): %i != %i\n",k,trial,got[k],ref);
+	      return 1;
+	    }
+	}
+      if (memcmp(check.data(),display.data(),len*sizeof(int)))
+	{
+	  printf("scan: display mismatch (trial %i)\n",trial);
+	  return 1;
+	}
+    }
+
+  // timing: clean records (the common case, whole record scanned)
+  FillRandom(rec,-100,100,1);
+  int64_t ncalls = std::max<int64_t>(1,200000000/std::max<int64_t>(n,1));
+  printf("Saturation scan, %li samples per record\n",(long)n);
+  printf("%-24s %12s %12s %12s\n","path","ns/record","GS/s","GS/s+disp");
+
+  struct Path { const char * name; int (*f)(const int8_t*,int64_t,int,int*,bool); };
+  std::vector<Path> paths;
+  paths.push_back({"original loop",[](const int8_t * x, int64_t len, int pol, int * d, bool) { return ScanSaturationOriginal(x,len,pol,d); }});
+  paths.push_back({"scalar",ScanSaturationScalar});
+#ifdef SATURATIONSCAN_X86
+  paths.push_back({"sse2",ScanSaturationSSE2});
+  if (HaveAVX2()) paths.push_back({"avx2",ScanSaturationAVX2});
+#endif
+  for (auto & p : paths)
+    {
+      double t = TimePerCall([&](int64_t i) { bench_sink += p.f(rec.data()+(i%nrec)*n,n,-1,0,true); },ncalls);
+      double td = TimePerCall([&](int64_t i) { bench_sink += p.f(rec.data()+(i%nrec)*n,n,-1,display.data(),true); },ncalls);
+      printf("%-24s %12.1f %12.2f %12.2f\n",p.name,t,n/t,n/td);
+    }
+  printf("A 1 GS/s record of %li samples covers %li ns of signal.\n",(long)n,(long)n);
+  return 0;
+}
+
+// Two channel DigiDaq style file of about mb MB, 300 samples per record.
+bool WriteTestFile(const std::string & name, int64_t mb)
+{
+  std::ofstream out(name.c_str(),std::ios::out|std::ios::binary);
+  if (!out.is_open()) return false;
+  Header head = Header();
+  head.actualPoints = 300;
+  head.firstValidPoint = 32;
+  head.memsize = 300+64;
+  head.xIncrement = 1e-9;
+  head.scaleFactor = 2.5/256;
+  head.trigTime = std::chrono::system_clock::now();
+  std::vector<int8_t> data(head.memsize);
+  FillRandom(data,-100,100,7);
+  int64_t nrec = mb*(1<<20)/(sizeof(Header)+head.memsize);
+  for (int64_t i = 0; i < nrec; ++i)
+    {
+      head.eventNumber = i/2;
+      head.channelNumber = 1+i%2;
+      data[head.firstValidPoint] = i;
+      out.write((char*)&head,sizeof(Header));
+      out.write((char*)data.data(),head.memsize);
+    }
+  return out.good();
+}
+
+// The read loop waveform::run used before RecordReader, without the
+// feature extraction: returns the sum of all samples of complete events.
+int64_t ReadOriginal(const std::string & name, const std::vector<int> & chans)
+{
+  std::ifstream filein(name.c_str(),std::ios::in|std::ios::binary);
+  Header head;
+  std::map<ViUInt8,std::vector<float> > dataChannelMap;
+  std::map<ViUInt8,Header> headerMap;
+  int64_t sum = 0;
+  while (!filein.eof())
+    {
+      filein.read(reinterpret_cast<char*>(&head),sizeof(Header));
+      headerMap.erase(head.channelNumber);
+      headerMap.emplace(head.channelNumber,head);
+      ViInt8 * data = new ViInt8[head.memsize];
+      filein.read(reinterpret_cast<char*>(data),head.memsize*sizeof(ViInt8));
+      dataChannelMap.erase(head.channelNumber);
+      std::vector<float> empty(head.actualPoints,0);
+      dataChannelMap.emplace(head.channelNumber,empty);
+      for (int j = 0; j < head.actualPoints; j++) dataChannelMap[head.channelNumber][j] = (float)data[j+head.firstValidPoint];
+      delete[] data;
+
+      bool complete = false;
+      for (size_t c = 0; c < chans.size(); ++c)
+	{
+	  if (chans[c] == 0 || dataChannelMap.find(c+1) == dataChannelMap.end()) continue;
+	  for (size_t ca = 0; ca < chans.size(); ++ca)
+	    {
+	      if (c == ca || dataChannelMap.find(ca+1) == dataChannelMap.end()) continue;
+	      if (headerMap[c+1].eventNumber == headerMap[ca+1].eventNumber) complete = true;
+	    }
+	}
+      if (complete)
+	{
+	  for (size_t ichan = 0; ichan < chans.size(); ++ichan)
+	    {
+	      if (chans[ichan] == 0) continue;
+	      std::vector<float> wf = dataChannelMap[ichan+1];
+	      for (float x : wf) sum += (int64_t)x;
+	    }
+	  dataChannelMap.clear();
+	  headerMap.clear();
+	}
+    }
+  return sum;
+}
+
+int64_t ReadMapped(const std::string & name, uint32_t usedmask)
+{
+  RecordReader reader;
+  if (!reader.Open(name)) return 0;
+  EventAssembler assembler(usedmask);
+  RecordView rec;
+  int64_t sum = 0;
+  int64_t nev = 0;
+  while (reader.Next(&rec))
+    {
+      const EventView * ev = assembler.Add(rec);
+      if (!ev) continue;
+      for (int c = 0; c < 8; ++c)
+	{
+	  if (!(usedmask & (1u<<c))) continue;
+	  const RecordView & r = ev->chan[c];
+	  for (int64_t j = 0; j < r.head.actualPoints; ++j) sum += r.samples[j];
+	}
+      if ((++nev & 0xffff) == 0) reader.Release(assembler.OldestOffset(rec.offset));
+    }
+  return sum;
+}
+
+int bench_read(int argc, char ** argv)
+{
+  std::string name;
+  bool generated = false;
+  std::string arg = (argc > 2) ? argv[2] : "2048";
+  if (arg.find_first_not_of("0123456789") == std::string::npos)
+    {
+      name = "bench_read.dat";
+      printf("Writing %s MB test file %s\n",arg.c_str(),name.c_str());
+      if (!WriteTestFile(name,std::atoll(arg.c_str())))
+	{
+	  printf("read: cannot write %s\n",name.c_str());
+	  return 1;
+	}
+      generated = true;
+    }
+  else name = arg;
+
+  RecordReader probe;
+  if (!probe.Open(name)) return 1;
+  double gb = probe.Size()/1e9;
+  probe.Close();
+
+  std::vector<int> chans(8,0);
+  chans[0] = chans[1] = 1;
+  uint32_t usedmask = 0x3;
+
+  // page cache is warm after the first pass, so both readers are timed
+  // on cached data and the first (cold) pass is reported separately
+  int64_t ref = 0, got = 0;
+  double tcold = 0, told = 1e30, tnew = 1e30;
+  for (int pass = 0; pass < 3; ++pass)
+    {
+      auto t0 = bench_clock::now();
+      got = ReadMapped(name,usedmask);
+      auto t1 = bench_clock::now();
+      ref = ReadOriginal(name,chans);
+      auto t2 = bench_clock::now();
+      double dn = std::chrono::duration<double>(t1-t0).count();
+      double dold = std::chrono::duration<double>(t2-t1).count();
+      if (pass == 0) tcold = dn;
+      else
+	{
+	  tnew = std::min(tnew,dn);
+	  told = std::min(told,dold);
+	}
+      if (got != ref)
+	{
+	  printf("read: sample sum mismatch %lld != %lld\n",(long long)got,(long long)ref);
+	  if (generated) unlink(name.c_str());
+	  return 1;
+	}
+    }
+  printf("%s: %.2f GB\n",name.c_str(),gb);
+  printf("%-28s %10s %10s\n","reader","seconds","GB/s");
+  printf("%-28s %10.3f %10.2f\n","mmap, first pass",tcold,gb/tcold);
+  printf("%-28s %10.3f %10.2f\n","ifstream + map (original)",told,gb/told);
+  printf("%-28s %10.3f %10.2f\n","mmap RecordReader",tnew,gb/tnew);
+  if (generated) unlink(name.c_str());
+  return 0;
+}
+
+// Baseline noise plus an exponential pulse of random height, polarity and
+// position; kind selects some awkward cases.
+void FillPulse(std::vector<int8_t> & v, std::mt19937 & gen, int kind)
+{
+  std::normal_distribution<double> noise(0,(kind == 1) ? 0.4 : 2.5);
+  std::uniform_real_distribution<double> uni(0,1);
+  int64_t n = v.size();
+  double base = -20+40*uni(gen);
+  double height = (uni(gen) < 0.5 ? -1 : 1)*300*uni(gen);
+  int64_t t0 = (int64_t)(n*uni(gen));
+  double tau = 1+30*uni(gen);
+  for (int64_t i = 0; i < n; ++i)
+    {
+      double x;
+      if (kind == 2) x = base;                              // flat
+      else if (kind == 3) x = -128+256*uni(gen);            // white
+      else x = base+noise(gen)+((i >= t0) ? height*std::exp(-(i-t0)/tau) : 0);
+      v[i] = (int8_t)std::max(-128.,std::min(127.,std::floor(x+0.5)));
+    }
+}
+
+int bench_features(int argc, char ** argv)
+{
+  int64_t n = (argc > 2) ? std::atoll(argv[2]) : 300;
+  std::mt19937 gen(11);
+  Header head = Header();
+  head.xIncrement = 1e-9;
+  head.initialXOffset = -1.5e-7;
+  head.scaleFactor = 2.5/256;
+  head.scaleOffset = -1;
+
+  // the int8 bounds of the crossing tests, against the float test, for
+  // every sample value
+  std::uniform_real_distribution<double> uni(0,1);
+  for (int trial = 0; trial < 200000; ++trial)
+    {
+      int64_t nb = 1+trial%500;
+      float base = (double)(int64_t)(-128*nb+uni(gen)*255*nb)/(double)nb;
+      float t = (trial%7 == 0) ? (float)(int)(uni(gen)*256) : (float)(uni(gen)*256);
+      FeatureThreshold th = MakeFeatureThreshold(base,t);
+      for (int x = -128; x <= 127; ++x)
+	{
+	  if (FeatureAbove(x,th) != (std::fabs((float)x-base) >= t))
+	    {
+	      printf("features: threshold mismatch x=%i base=%.9g t=%.9g\n",x,base,t);
+	      return 1;
+	    }
+	}
+    }
+
+  // every path against ExtractPulseFeatures, bit for bit
+  std::vector<int> levels(1,FEATUREKERNEL_SCALAR);
+#ifdef FEATUREKERNEL_X86
+  if (BestFeatureKernelLevel() >= FEATUREKERNEL_SSE41) levels.push_back(FEATUREKERNEL_SSE41);
+  if (BestFeatureKernelLevel() >= FEATUREKERNEL_AVX2) levels.push_back(FEATUREKERNEL_AVX2);
+#endif
+  const char * levelName[3] = { "scalar", "sse4.1", "avx2" };
+  int64_t ncheck = 0;
+  for (int trial = 0; trial < 300000; ++trial)
+    {
+      int64_t len = (trial < 2000) ? trial : 1+gen()%2100;
+      std::vector<int8_t> x(len);
+      FillPulse(x,gen,trial%8 < 4 ? 0 : trial%8-4);
+      int source = (trial%2) ? -1 : 1;
+      PulseFeatures ref, got;
+      std::vector<float> xf(x.begin(),x.end());
+      ExtractPulseFeatures(xf.data(),len,source,head,&ref);
+      for (int level : levels)
+	{
+	  memset(&got,0,sizeof(got));
+	  ExtractPulseFeaturesLevel(x.data(),len,source,head,&got,level);
+	  if (memcmp(&ref,&got,sizeof(PulseFeatures)))
+	    {
+	      printf("features: mismatch (%s, trial %i, %li samples)\n",levelName[level],trial,(long)len);
+	      const float * r = (const float*)&ref;
+	      const float * g = (const float*)&got;
+	      for (int k = 0; k < 14; ++k) printf("  %2i %.9g %.9g\n",k,r[k],g[k]);
+	      return 1;
+	    }
+	  ++ncheck;
+	}
+    }
+  printf("%li waveforms identical to ExtractPulseFeatures\n",(long)ncheck);
+
+  // timing on realistic pulses
+  const int nrec = 1024;
+  std::vector<int8_t> rec(n*nrec);
+  for (int r = 0; r < nrec; ++r)
+    {
+      std::vector<int8_t> x(n);
+      FillPulse(x,gen,0);
+      std::copy(x.begin(),x.end(),rec.begin()+r*n);
+    }
+  std::vector<float> recf(rec.begin(),rec.end());
+  int64_t ncalls = std::max<int64_t>(1000,50000000/std::max<int64_t>(n,1));
+  PulseFeatures f;
+  printf("Pulse features, %li samples per record\n",(long)n);
+  printf("%-28s %12s %12s\n","path","ns/record","MS/s");
+  double t;
+  t = TimePerCall([&](int64_t i) { ExtractPulseFeatures(recf.data()+(i%nrec)*n,n,-1,head,&f); bench_sink += f.peaktimeTdc; },ncalls);
+  printf("%-28s %12.1f %12.1f\n","reference on float copy",t,1e3*n/t);
+  t = TimePerCall([&](int64_t i) { ExtractPulseFeatures(rec.data()+(i%nrec)*n,n,-1,head,&f); bench_sink += f.peaktimeTdc; },ncalls);
+  printf("%-28s %12.1f %12.1f\n","reference on int8",t,1e3*n/t);
+  for (int level : levels)
+    {
+      t = TimePerCall([&](int64_t i) { ExtractPulseFeaturesLevel(rec.data()+(i%nrec)*n,n,-1,head,&f,level); bench_sink += f.peaktimeTdc; },ncalls);
+      printf("%-28s %12.1f %12.1f\n",levelName[level],t,1e3*n/t);
+    }
+  return 0;
+}
+
+// Seconds for the fastest of three runs of f.
+template <typename F>
+double BestOfThree(F f)
+{
+  double best = 1e30;
+  for (int pass = 0; pass < 3; ++pass)
+    {
+      auto t0 = bench_clock::now();
+      f();
+      best = std::min(best,std::chrono::duration<double>(bench_clock::now()-t0).count());
+    }
+  return best;
+}
+
+// Size of pulsetree files and how fast they read back: every branch, one
+// branch, and a TTree::Draw of schema 1 names (aliases on schema 2).
+int bench_schema(int argc, char ** argv)
+{
+  if (argc < 3)
+    {
+      printf("schema: no files\n");
+      return 1;
+    }
+  printf("%-24s %6s %10s %8s %9s %12s %12s %12s\n","file","schema","entries","MB","B/entry","all (s)","one (s)","Draw (s)");
+  for (int i = 2; i < argc; ++i)
+    {
+      struct stat st;
+      TFile * f = TFile::Open(argv[i],"READ");
+      TTree * t = 0;
+      if (f) f->GetObject("pulsetree",t);
+      if (!t || stat(argv[i],&st) != 0)
+	{
+	  printf("schema: no pulsetree in %s\n",argv[i]);
+	  delete f;
+	  return 1;
+	}
+      Long64_t n = t->GetEntries();
+      int schema = std::string(t->GetTitle()).find("schema 2") != std::string::npos ? 2 : 1;
+
+      double tall = BestOfThree([&]{ for (Long64_t e = 0; e < n; ++e) t->GetEntry(e); });
+      t->SetBranchStatus("*",0);
+      t->SetBranchStatus("amplitudeAdc",1);
+      double tone = BestOfThree([&]{ for (Long64_t e = 0; e < n; ++e) t->GetEntry(e); });
+      t->SetBranchStatus("*",1);
+      double tdraw = BestOfThree([&]{ t->Draw("amplitudeVolt:hour:riseTimeSec","","goff"); });
+
+      printf("%-24s %6d %10lld %8.1f %9.1f %12.3f %12.3f %12.3f\n",argv[i],schema,(long long)n,st.st_size/1e6,
+	     n ? (double)st.st_size/n : 0.,tall,tone,tdraw);
+      f->Close();
+      delete f;
+    }
+  return 0;
+}
+
+// Largest |a-b| over n samples.
+float MaxDiff(const float * a, const float * b, int64_t n)
+{
+  float d = 0;
+  for (int64_t i = 0; i < n; ++i) d = std::max(d,std::fabs(a[i]-b[i]));
+  return d;
+}
+
+// One filter: batch against one by one, then MS/s both ways.
+template <typename F>
+int bench_one_filter(const char * name, const F & filter, const std::vector<float> & rec, int64_t n, int nrec)
+{
+  std::vector<float> one(n*nrec), batch(n*nrec);
+  std::vector<const float*> in(nrec);
+  std::vector<float*> out(nrec);
+  for (int r = 0; r < nrec; ++r)
+    {
+      in[r] = rec.data()+r*n;
+      out[r] = batch.data()+r*n;
+      filter.Apply(in[r],one.data()+r*n,n);
+    }
+  filter.ApplyBatch(in.data(),out.data(),n,nrec);
+  float d = MaxDiff(one.data(),batch.data(),n*nrec);
+  if (d > 1e-3)
+    {
+      printf("filters: %s batch differs from single by %g\n",name,d);
+      return 1;
+    }
+  int64_t reps = std::max<int64_t>(1,100000000/((int64_t)n*nrec));
+  double t1 = BestOfThree([&]{ for (int64_t k = 0; k < reps; ++k) for (int r = 0; r < nrec; ++r) filter.Apply(in[r],out[r],n); bench_sink += out[0][0]; });
+  double tb = BestOfThree([&]{ for (int64_t k = 0; k < reps; ++k) filter.ApplyBatch(in.data(),out.data(),n,nrec); bench_sink += out[0][0]; });
+  double samples = (double)reps*n*nrec;
+  printf("%-20s %12.1f %12.1f\n",name,samples/t1/1e6,samples/tb/1e6);
+  return 0;
+}
+
+// Filters.h: the filters against what they should give on clean input, then
+// the throughput of each, one waveform per call and batched.
+int bench_filters(int argc, char ** argv)
+{
+  int64_t n = (argc > 2) ? std::atoll(argv[2]) : 1000;
+  const int nrec = 256;
+  if (n < 64) n = 64;
+
+  // a flat line stays flat, a step or exponential pulse gives its height
+  std::vector<float> x(n), y(n), z(n);
+  for (int64_t i = 0; i < n; ++i) x[i] = 7;
+  MovingAverage<8>().Apply(x.data(),y.data(),n);
+  CrRcFilter<2> crrcFlat(10.);
+  crrcFlat.Apply(x.data(),z.data(),n);
+  float err = std::max(MaxDiff(x.data(),y.data(),n),(float)std::fabs(*std::max_element(z.begin(),z.end(),[](float a, float b) { return std::fabs(a) < std::fabs(b); })));
+  const double tau = 20, height = -50, base = 3;
+  const int64_t t0 = n/4;
+  for (int64_t i = 0; i < n; ++i) x[i] = base+(i >= t0 ? height*std::exp(-(i-t0)/tau) : 0);
+  TrapezoidFilter<8,4> trap(tau);
+  trap.Apply(x.data(),y.data(),n);
+  err = std::max(err,(float)std::fabs(y[t0+9]-height));
+  for (int64_t i = 0; i < n; ++i) x[i] = base+(i >= t0 ? height : 0);
+  CrRcFilter<4> crrc(50.);
+  crrc.Apply(x.data(),y.data(),n);
+  float peak = *std::min_element(y.begin(),y.end());
+  if (std::fabs(peak/height-1) > 0.05) err = 1;  // 1/(2 tau) off for a finite tau
+  float shape[32];
+  for (int k = 0; k < 32; ++k) shape[k] = k < 4 ? 0 : std::exp(-(k-4)/6.);
+  MatchedFilter<32> matched(shape);
+  for (int64_t i = 0; i < n; ++i) x[i] = base+((i >= t0 && i < t0+32) ? height*shape[i-t0] : 0);
+  matched.Apply(x.data(),y.data(),n);
+  err = std::max(err,(float)std::fabs(y[t0+31]-height));
+  // a chain is the stages one after the other
+  FilterChain<MovingAverage<4>,CrRcFilter<2>,MovingAverage<8> > chain(MovingAverage<4>(),CrRcFilter<2>(10.),MovingAverage<8>());
+  chain.Apply(x.data(),y.data(),n,z.data());
+  std::vector<float> s1(n), s2(n), s3(n);
+  MovingAverage<4>().Apply(x.data(),s1.data(),n);
+  CrRcFilter<2>(10.).Apply(s1.data(),s2.data(),n);
+  MovingAverage<8>().Apply(s2.data(),s3.data(),n);
+  err = std::max(err,MaxDiff(y.data(),s3.data(),n));
+  if (err > 1e-3)
+    {
+      printf("filters: response check failed (%g)\n",err);
+      return 1;
+    }
+  printf("Filter responses as expected\n");
+
+  std::mt19937 gen(5);
+  std::vector<float> rec(n*nrec);
+  std::vector<int8_t> w(n);
+  for (int r = 0; r < nrec; ++r)
+    {
+      FillPulse(w,gen,0);
+      std::copy(w.begin(),w.end(),rec.begin()+r*n);
+    }
+  printf("Filters, %li samples per record, %i records per batch\n",(long)n,nrec);
+  printf("%-20s %12s %12s\n","filter","MS/s single","MS/s batch");
+  int ret = 0;
+  ret |= bench_one_filter("MovingAverage<4>",MovingAverage<4>(),rec,n,nrec);
+  ret |= bench_one_filter("MovingAverage<16>",MovingAverage<16>(),rec,n,nrec);
+  ret |= bench_one_filter("CrRcFilter<1>",CrRcFilter<1>(10.),rec,n,nrec);
+  ret |= bench_one_filter("CrRcFilter<4>",CrRcFilter<4>(10.),rec,n,nrec);
+  ret |= bench_one_filter("MatchedFilter<32>",matched,rec,n,nrec);
+  ret |= bench_one_filter("TrapezoidFilter<8,4>",trap,rec,n,nrec);
+  ret |= bench_one_filter("TrapezoidFilter<16,8>",TrapezoidFilter<16,8>(tau),rec,n,nrec);
+  return ret;
+}
+
+// A band limited pulse of height amp starting at t0 (not on a sample),
+// rising in about 2 tau: amp*(t/2tau)^2 exp(2-t/tau), plus Gaussian noise,
+// rounded to int8 like the digitizer.
+void FillTimedPulse(std::vector<int8_t> & v, double t0, double amp, double tau, double base, double sigma, int polarity, std::mt19937 & gen)
+{
+  std::normal_distribution<double> noise(0,sigma > 0 ? sigma : 1);
+  for (int64_t i = 0; i < (int64_t)v.size(); ++i)
+    {
+      double t = i-t0;
+      double x = t > 0 ? amp*(t/(2*tau))*(t/(2*tau))*std::exp(2-t/tau) : 0;
+      x = base+polarity*x+(sigma > 0 ? noise(gen) : 0);
+      v[i] = (int8_t)std::max(-128.,std::min(127.,std::floor(x+0.5)));
+    }
+}
+
+// CfdTiming.h: the timing against the true start of simulated pulses, for
+// each interpolation, then its throughput.
+int bench_cfd(int argc, char ** argv)
+{
+  int64_t n = (argc > 2) ? std::atoll(argv[2]) : 300;
+  if (n < 100) n = 100;
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> uni(0,1);
+  const int npulse = 20000;
+  const double tau = 3;
+  const char * methodName[3] = { "linear", "cubic", "sinc" };
+  const double amps[3] = { 20, 50, 100 };
+  const double sigmas[2] = { 0, 1 };
+
+  // the error is cfd-t0 minus its mean; walk is how much that mean moves
+  // from the smallest to the largest pulses
+  printf("CFD timing of %i simulated pulses per point (1 sample = 1000 ps at 1 GS/s)\n",npulse);
+  printf("%-8s %6s %6s %12s %12s %12s %12s\n","interp","noise","amp","offset","rms (ps)","walk (ps)","10-90 rms");
+  std::vector<int8_t> w(n);
+  for (int method = CFD_LINEAR; method <= CFD_SINC; ++method)
+    for (double sigma : sigmas)
+      {
+	double mean0 = 0;
+	for (double amp : amps)
+	  {
+	    CfdConfig cfg;
+	    cfg.interpolation = (CfdInterpolation)method;
+	    double s = 0, s2 = 0, r = 0, r2 = 0;
+	    int nok = 0;
+	    std::mt19937 pulses(17);
+	    for (int k = 0; k < npulse; ++k)
+	      {
+		double t0 = n/3+uni(pulses);
+		int polarity = (k%2) ? -1 : 1;
+		FillTimedPulse(w,t0,amp,tau,-10+20*uni(pulses),sigma,polarity,pulses);
+		PulseTiming t;
+		CfdTiming(w.data(),n,polarity,cfg,&t);
+		if (t.cfdTdc < 0 || t.t10Tdc < 0 || t.t90Tdc < 0) continue;
+		s += t.cfdTdc-t0;
+		s2 += (t.cfdTdc-t0)*(t.cfdTdc-t0);
+		r += t.t90Tdc-t.t10Tdc;
+		r2 += (t.t90Tdc-t.t10Tdc)*(t.t90Tdc-t.t10Tdc);
+		++nok;
+	      }
+	    if (nok < npulse*0.99)
+	      {
+		printf("cfd: %s found only %i of %i pulses of %g\n",methodName[method],nok,npulse,amp);
+		return 1;
+	      }
+	    double mean = s/nok;
+	    double rms = std::sqrt(std::max(0.,s2/nok-mean*mean));
+	    double rrms = std::sqrt(std::max(0.,r2/nok-(r/nok)*(r/nok)));
+	    if (amp == amps[0]) mean0 = mean;
+	    printf("%-8s %6.1f %6.0f %12.4f %12.1f %12.1f %12.1f\n",methodName[method],sigma,amp,mean,1e3*rms,1e3*(mean-mean0),1e3*rrms);
+	  }
+      }
+
+  // throughput on a mix of pulses, on their own and from known features
+  const int nrec = 1024;
+  std::vector<int8_t> rec(n*nrec);
+  std::vector<const int8_t*> wf(nrec);
+  std::vector<int64_t> sizes(nrec,n);
+  std::vector<int> sources(nrec);
+  std::vector<PulseFeatures> feats(nrec);
+  Header head = Header();
+  head.xIncrement = 1e-9;
+  head.scaleFactor = 2.5/256;
+  for (int k = 0; k < nrec; ++k)
+    {
+      sources[k] = (k%2) ? -1 : 1;
+      FillTimedPulse(w,n/3+uni(gen),10+100*uni(gen),tau,0,1,sources[k],gen);
+      std::copy(w.begin(),w.end(),rec.begin()+k*n);
+      wf[k] = rec.data()+k*n;
+      ExtractPulseFeaturesFast(wf[k],n,sources[k],head,&feats[k]);
+    }
+  std::vector<PulseTiming> out(nrec);
+  int64_t reps = std::max<int64_t>(1,20000000/(n*nrec));
+  printf("Throughput, %li samples per record\n",(long)n);
+  printf("%-28s %12s %12s\n","path","ns/record","Mrecords/s");
+  double t = BestOfThree([&]{ for (int64_t k = 0; k < reps; ++k) for (int r = 0; r < nrec; ++r) ExtractPulseFeaturesFast(wf[r],n,sources[r],head,&feats[r]); bench_sink += feats[0].peaktimeTdc; });
+  printf("%-28s %12.1f %12.2f\n","features (for scale)",1e9*t/(reps*nrec),reps*nrec/t/1e6);
+  for (int method = CFD_LINEAR; method <= CFD_SINC; ++method)
+    {
+      CfdConfig cfg;
+      cfg.interpolation = (CfdInterpolation)method;
+      t = BestOfThree([&]{ for (int64_t k = 0; k < reps; ++k) CfdTimingRecords(wf.data(),sizes.data(),sources.data(),nrec,cfg,out.data()); bench_sink += out[0].cfdTdc; });
+      printf("%-28s %12.1f %12.2f\n",(std::string("records, ")+methodName[method]).c_str(),1e9*t/(reps*nrec),reps*nrec/t/1e6);
+      t = BestOfThree([&]{ for (int64_t k = 0; k < reps; ++k) for (int r = 0; r < nrec; ++r) CfdTimingFrom(wf[r],n,sources[r],feats[r],cfg,&out[r]); bench_sink += out[0].cfdTdc; });
+      printf("%-28s %12.1f %12.2f\n",(std::string("from features, ")+methodName[method]).c_str(),1e9*t/(reps*nrec),reps*nrec/t/1e6);
+    }
+  return 0;
+}
+
+// PulseTemplate.h: the average of simulated pulses against their true
+// shape, merged partial builders against one and the int8 (SSE2) path
+// against the float one, then the cost per record.
+int bench_template(int argc, char ** argv)
+{
+  int64_t n = (argc > 2) ? std::atoll(argv[2]) : 300;
+  if (n < 150) n = 150;
+  const double tau = 3;
+  const int npulse = 20000;
+  std::mt19937 gen(9);
+  std::uniform_real_distribution<double> uni(0,1);
+  Header head = Header();
+  head.xIncrement = 1e-9;
+  head.scaleFactor = 2.5/256;
+
+  TemplateConfig cfg;
+  PulseTemplateBuilder all(cfg);
+  PulseTemplateBuilder viaFloat(cfg);
+  std::vector<PulseTemplateBuilder> parts(4,PulseTemplateBuilder(cfg));
+  std::vector<int8_t> w(n);
+  PulseFeatures f;
+  int accepted = 0;
+  for (int k = 0; k < npulse; ++k)
+    {
+      int source = (k%2) ? -1 : 1;
+      FillTimedPulse(w,n/3+uni(gen),20+80*uni(gen),tau,-10+20*uni(gen),1,source,gen);
+      ExtractPulseFeaturesFast(w.data(),n,source,head,&f);
+      accepted += all.Add(1,w.data(),n,source,f,0);
+      parts[k%4].Add(1,w.data(),n,source,f,0);
+      std::vector<float> wf(w.begin(),w.end());
+      viaFloat.Add(1,wf.data(),n,source,f,0);
+    }
+  for (int p = 1; p < 4; ++p) parts[0].Merge(parts[p]);
+  std::vector<float> mean, rms, mean4, rms4;
+  all.Shape(1,mean,rms);
+  parts[0].Shape(1,mean4,rms4);
+  if (all.Count(1) != parts[0].Count(1) || mean != mean4 || rms != rms4)
+    {
+      printf("template: merged builders differ from one builder\n");
+      return 1;
+    }
+  viaFloat.Shape(1,mean4,rms4);
+  if (all.Count(1) != viaFloat.Count(1) || mean != mean4 || rms != rms4)
+    {
+      printf("template: int8 and float samples give different templates\n");
+      return 1;
+    }
+
+  // the true shape peaks at 2 tau with height 1
+  double worst = 0, worstRms = 0;
+  for (int b = 0; b < all.Bins(); ++b)
+    {
+      double t = all.BinTime(b)+2*tau;
+      double truth = t > 0 ? (t/(2*tau))*(t/(2*tau))*std::exp(2-t/tau) : 0;
+      worst = std::max(worst,std::fabs(mean[b]-truth));
+      worstRms = std::max(worstRms,(double)rms[b]);
+    }
+  printf("Template of %i of %i pulses: largest deviation from the true shape %.4f, largest RMS %.4f\n",accepted,npulse,worst,worstRms);
+  if (worst > 0.05)
+    {
+      printf("template: average pulse does not match\n");
+      return 1;
+    }
+
+  const int nrec = 1024;
+  std::vector<int8_t> rec(n*nrec);
+  std::vector<PulseFeatures> feats(nrec);
+  std::vector<PulseTiming> timing(nrec);
+  std::vector<int> sources(nrec);
+  CfdConfig cfd;
+  for (int k = 0; k < nrec; ++k)
+    {
+      sources[k] = (k%2) ? -1 : 1;
+      FillTimedPulse(w,n/3+uni(gen),20+80*uni(gen),tau,0,1,sources[k],gen);
+      std::copy(w.begin(),w.end(),rec.begin()+k*n);
+      ExtractPulseFeaturesFast(&rec[k*n],n,sources[k],head,&feats[k]);
+      CfdTimingFrom(&rec[k*n],n,sources[k],feats[k],cfd,&timing[k]);
+    }
+  int64_t reps = std::max<int64_t>(1,2000000/nrec);
+  printf("%-28s %12s\n","alignment","ns/record");
+  for (int align = TEMPLATE_PEAK; align <= TEMPLATE_CFD; ++align)
+    {
+      TemplateConfig c;
+      c.align = (TemplateAlignment)align;
+      PulseTemplateBuilder b(c);
+      double t = BestOfThree([&]{ for (int64_t k = 0; k < reps; ++k) for (int r = 0; r < nrec; ++r) b.Add(1,&rec[r*n],n,sources[r],feats[r],&timing[r]); });
+      printf("%-28s %12.1f\n",align == TEMPLATE_PEAK ? "peak" : "cfd",1e9*t/(reps*nrec));
+    }
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  std::string what = (argc > 1) ? argv[1] : "";
+  if (what == "scan") return bench_scan(argc,argv);
+  if (what == "read") return bench_read(argc,argv);
+  if (what == "features") return bench_features(argc,argv);
+  if (what == "schema") return bench_schema(argc,argv);
+  if (what == "filters") return bench_filters(argc,argv);
+  if (what == "cfd") return bench_cfd(argc,argv);
+  if (what == "template") return bench_template(argc,argv);
+
+  printf("Usage: ./bench scan [record size]\n"
+	 "       ./bench read [file.dat | MB to generate]\n"
+	 "       ./bench features [record size]\n"
+	 "       ./bench schema file.root [file.root ...]\n"
+	 "       ./bench filters [record size]\n"
+	 "       ./bench cfd [record size]\n"
+	 "       ./bench template [record size]\n");
+  return 1;
+}
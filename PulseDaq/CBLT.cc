@@ -0,0 +1,155 @@
+#include "CBLT.h"
+#include "EventBuilder.h"
+
+// VX1290A_BLT_EVENT_NUM_ADD as last written: the number of VX1290A events
+// the next chained transfer carries
+static uint32_t cblt_event_num = 0;
+
+// Put the two modules in one chain at CBLT_MCST_ADDRESS: the VX1290A first,
+// sending as many events per transfer as CBLT_Read_Buffer asks for, then
+// the MQDC32, which ends the transfer with a bus error. Acquisition is stopped until
+// CBLT_Start.
+CVErrorCodes CBLT_Setup(int32_t Handle, const Settings & set)
+{
+  uint32_t high = CBLT_MCST_ADDRESS >> 24;
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, MQDC32_ACQ_STOP),"CBLT_Setup: Write MQDC32 Stop Acquisition");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_CBLT_ADD, high),"CBLT_Setup: Write MQDC32 CBLT Address");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MCST_ADD, high),"CBLT_Setup: Write MQDC32 MCST Address");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_CBLT_MCST_CTL,
+				     MQDC32_CBLT_ENABLE | MQDC32_CBLT_LAST_ENABLE | MQDC32_CBLT_FIRST_DISABLE | MQDC32_MCST_ENABLE),"CBLT_Setup: Write MQDC32 CBLT/MCST Control");
+
+  checkApiCall(VX1290A_Write_Register(Handle, VX1290A_MCST_CBLT_ADDRESS_ADD, high),"CBLT_Setup: Write VX1290A MCST/CBLT Address");
+  checkApiCall(VX1290A_Write_Register(Handle, VX1290A_MCST_CBLT_CTRL_ADD, VX1290A_CBLT_FIRST),"CBLT_Setup: Write VX1290A MCST/CBLT Control");
+  // the usual batch; CBLT_Read_Buffer changes it when it needs to
+  cblt_event_num = set.MultiEvent() > 1 ? set.MultiEvent() : 1;
+  checkApiCall(VX1290A_Write_Register(Handle, VX1290A_BLT_EVENT_NUM_ADD, cblt_event_num),"CBLT_Setup: Write VX1290A BLT Event Number");
+  return cvSuccess;
+}
+
+CVErrorCodes MCST_Write(int32_t Handle, uint32_t address, uint32_t data)
+{
+  return CAENVME_WriteCycle(Handle, CBLT_MCST_ADDRESS + address, &data, cvA32_U_DATA, cvD16);
+}
+
+// Clear both modules and start the MQDC32 with multicast writes, sent
+// back to back in one multi-write. Only the last module of the chain
+// acknowledges a multicast cycle, so the first write, to a register that
+// only the VX1290A has, may end in a bus error even though it went out.
+CVErrorCodes CBLT_Start(int32_t Handle)
+{
+  uint32_t addr[] = { CBLT_MCST_ADDRESS + VX1290A_SW_CLEAR_ADD,
+		      CBLT_MCST_ADDRESS + MQDC32_FIFO_RESET,
+		      CBLT_MCST_ADDRESS + MQDC32_RESET_CTL_AB,
+		      CBLT_MCST_ADDRESS + MQDC32_READOUT_RESET,
+		      CBLT_MCST_ADDRESS + MQDC32_START_ACQ };
+  uint32_t data[] = { 0x0, 0x0, 0x3, 0x0, MQDC32_ACQ_START };
+  const int ncycles = sizeof(addr)/sizeof(addr[0]);
+  CVAddressModifier am[ncycles];
+  CVDataWidth dw[ncycles];
+  CVErrorCodes ec[ncycles];
+  for (int i = 0; i < ncycles; ++i)
+    {
+      am[i] = cvA32_U_DATA;
+      dw[i] = cvD16;
+    }
+  CVErrorCodes ret = CAENVME_MultiWrite(Handle, addr, data, ncycles, am, dw, ec);
+  if (ret == cvBusError) ret = cvSuccess;
+  for (int i = 1; i < ncycles && ret == cvSuccess; ++i)
+    {
+      if (ec[i] != cvSuccess) ret = ec[i];
+    }
+  return ret;
+}
+
+// Read only the MQDC32, at its own address, into buf: a chained transfer
+// cannot carry zero VX1290A events (VX1290A_BLT_EVENT_NUM_ADD 0 means no
+// limit)
+static CVErrorCodes CBLT_Read_MQDC32(int32_t Handle, const Settings & set, CBLT_Buffer * buf)
+{
+  buf->size = 0;
+  buf->tdcwords = 0;
+  uint32_t len;
+  CVErrorCodes ret = MQDC32_Read_Data_Length(Handle, &len);
+  if (ret != cvSuccess) return ret;
+  if (len == 0) return cvSuccess;
+  if (len > MQDC32_BUFFER_WORDS) len = MQDC32_BUFFER_WORDS;
+  int count = 0;
+  if (set.Readout() == READOUT_MBLT)
+    ret = CAENVME_FIFOMBLTReadCycle(Handle, MQDC32_BASE + MQDC32_EVENT_READOUT_BUFFER, buf->word.data(), 8*((len+1)/2), cvA32_U_MBLT, &count);
+  else
+    ret = CAENVME_FIFOBLTReadCycle(Handle, MQDC32_BASE + MQDC32_EVENT_READOUT_BUFFER, buf->word.data(), 4*len, cvA32_U_BLT, cvD32, &count);
+  buf->size = count/4;
+  if (ret == cvBusError && count > 0) ret = cvSuccess;
+  if (set.Verbose()) std::cout << "CBLT: no VX1290A event, " << buf->size << " MQDC32 words" << std::endl;
+  return ret;
+}
+
+// Read both modules in one chained transfer into buf. The VX1290A comes
+// first with the events counted in its event FIFO (at most MultiEvent(),
+// with the builder BUILDER_WINDOW more so that events the MQDC32 never
+// saw do not pile up in the VX1290A), whose word counts tell where its data ends (buf->tdcwords); everything
+// after belongs to the MQDC32. VX1290A_BLT_EVENT_NUM_ADD is set to that
+// many events, so one that completes after the FIFO was read stays in the
+// module for the next transfer. Without the builder one VX1290A event is
+// waited for; with it the VX1290A may have none (it lost the event), and
+// then the MQDC32 is read on its own.
+CVErrorCodes CBLT_Read_Buffer(int32_t Handle, const Settings & set, CBLT_Buffer * buf, VX1290A_Buffer * tdcbuf)
+{
+  uint32_t stored;
+  CVErrorCodes ret = VX1290A_Events_Stored(Handle, &stored);
+  if (ret != cvSuccess) return ret;
+  uint32_t nblt = set.MultiEvent() > 1 ? set.MultiEvent() : 1;
+  if (set.UseBuilder()) nblt += BUILDER_WINDOW;
+  if (nblt > VX1290A_BLT_EVENT_MAX) nblt = VX1290A_BLT_EVENT_MAX;
+  uint32_t ntdc = stored < nblt ? stored : nblt;
+  if (ntdc == 0 && !set.UseBuilder()) ntdc = 1;
+  if (ntdc == 0) return CBLT_Read_MQDC32(Handle, set, buf);
+  uint32_t tdcwords;
+  ret = VX1290A_Read_Event_Sizes(Handle, tdcbuf, ntdc, &tdcwords);
+  if (ret != cvSuccess) return ret;
+  if (tdcwords > VX1290A_BUFFER_WORDS)
+    {
+      throw std::runtime_error("VX1290A events larger than the readout buffer");
+    }
+  if (ntdc != cblt_event_num)
+    {
+      ret = VX1290A_Write_Register(Handle, VX1290A_BLT_EVENT_NUM_ADD, ntdc);
+      if (ret != cvSuccess) return ret;
+      cblt_event_num = ntdc;
+    }
+  // each module pads its part of an MBLT to whole 64-bit words
+  if (set.Readout() == READOUT_MBLT) tdcwords += tdcwords & 1;
+  buf->tdcwords = tdcwords;
+
+  int count = 0;
+  if (set.Readout() == READOUT_MBLT)
+    ret = CAENVME_FIFOMBLTReadCycle(Handle, CBLT_MCST_ADDRESS, buf->word.data(), 4*CBLT_BUFFER_WORDS, cvA32_U_MBLT, &count);
+  else
+    ret = CAENVME_FIFOBLTReadCycle(Handle, CBLT_MCST_ADDRESS, buf->word.data(), 4*CBLT_BUFFER_WORDS, cvA32_U_BLT, cvD32, &count);
+  buf->size = count/4;
+  if (ret == cvBusError && count > 0) ret = cvSuccess;
+  if (ret != cvSuccess)
+    {
+      std::cout << "Error in CBLT_Read_Buffer" << std::endl;
+      throw ret;
+    }
+  if (set.Verbose()) std::cout << "CBLT: " << buf->size << " words, " << ntdc << " VX1290A events in the first " << tdcwords << std::endl;
+  return cvSuccess;
+}
+
+// Split a chained transfer into the events of the two modules
+void CBLT_Decode_Buffer(const CBLT_Buffer & buf,
+			std::vector<MQDC32_Event> * qdcevents, MQDC32_Event * qdcpartial,
+			std::vector<VX1290A_Event> * tdcevents, VX1290A_Event * tdcpartial,
+			const Settings & set)
+{
+  uint32_t i = 0;
+  for (; i < buf.size && i < buf.tdcwords; ++i)
+    {
+      if (VX1290A_DecodeWord(buf.word[i],tdcpartial,set)) tdcevents->push_back(*tdcpartial);
+    }
+  for (; i < buf.size; ++i)
+    {
+      if (MQDC32_ParseWord(buf.word[i],qdcpartial,set)) qdcevents->push_back(*qdcpartial);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef CBLT_H
+#define CBLT_H
+
+#include "MQDC32.h"
+#include "VX1290A.h"
+
+#include "Common.h"
+#include "User_Settings.h"
+
+#define CBLT_BUFFER_WORDS (MQDC32_BUFFER_WORDS+VX1290A_BUFFER_WORDS)
+
+// Memory for one chained transfer, allocated once. The first tdcwords
+// words come from the VX1290A.
+struct CBLT_Buffer {
+  std::vector<uint32_t> word;
+  uint32_t size;
+  uint32_t tdcwords;
+CBLT_Buffer() : word(CBLT_BUFFER_WORDS+2,0), size(0), tdcwords(0) {}
+};
+
+CVErrorCodes CBLT_Setup(int32_t Handle, const Settings & set);
+CVErrorCodes CBLT_Start(int32_t Handle);
+CVErrorCodes MCST_Write(int32_t Handle, uint32_t address, uint32_t data);
+CVErrorCodes CBLT_Read_Buffer(int32_t Handle, const Settings & set, CBLT_Buffer * buf, VX1290A_Buffer * tdcbuf);
+void CBLT_Decode_Buffer(const CBLT_Buffer & buf,
+			std::vector<MQDC32_Event> * qdcevents, MQDC32_Event * qdcpartial,
+			std::vector<VX1290A_Event> * tdcevents, VX1290A_Event * tdcpartial,
+			const Settings & set);
+
+#endif
@@ -5,9 +5,11 @@ uint32_t BitMask(uint32_t val, uint32_t offset, uint32_t N)
   return ((val>>offset) & ((1<<N)-1));
 }
 
-void handler(int s)
+volatile sig_atomic_t stopRequested = 0;
+
+void handler(int)
 {
-  throw std::runtime_error(s+": Ctrl+C");
+  stopRequested = 1;
 }
 
 void checkApiCall(CVErrorCodes err, std::string s)
@@ -19,3 +21,113 @@ void checkApiCall(CVErrorCodes err, std::string s)
       throw err;
     }
 }
+
+bool ParseReadoutMode(std::string s, ReadoutMode * mode)
+{
+  if (s == "word") *mode = READOUT_WORD;
+  else if (s == "blt") *mode = READOUT_BLT;
+  else if (s == "mblt") *mode = READOUT_MBLT;
+  else return false;
+  return true;
+}
+
+const char * ReadoutModeName(ReadoutMode mode)
+{
+  switch (mode) {
+  case READOUT_WORD : return "word";
+  case READOUT_BLT : return "blt";
+  case READOUT_MBLT : return "mblt";
+  }
+  return "?";
+}
+
+bool ParseIRQMode(std::string s, IRQMode * mode)
+{
+  if (s == "wait") *mode = IRQ_WAIT;
+  else if (s == "poll") *mode = IRQ_POLL;
+  else return false;
+  return true;
+}
+
+const char * IRQModeName(IRQMode mode)
+{
+  return (mode == IRQ_WAIT) ? "wait" : "poll";
+}
+
+// cvSuccess once the interrupt is pending, cvTimeoutError if it did not
+// come within timeout_ms (so the caller can look at stopRequested).
+CVErrorCodes IRQ_Wait(int32_t Handle, CVIRQLevels level, uint32_t timeout_ms, IRQMode * mode)
+{
+  if (*mode == IRQ_WAIT)
+    {
+      CVErrorCodes ret = CAENVME_IRQWait(Handle, level, timeout_ms);
+      if (ret == cvSuccess || ret == cvTimeoutError) return ret;
+      std::cout << "\nCAENVME_IRQWait not available, polling the IRQ instead" << std::endl;
+      *mode = IRQ_POLL;
+    }
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t backoff = IRQ_POLL_MIN_US;
+  while (true)
+    {
+      CAEN_BYTE mask = 0;
+      CVErrorCodes ret = CAENVME_IRQCheck(Handle, &mask);
+      if (ret != cvSuccess) return ret;
+      if (mask & level) return cvSuccess;
+      if (std::chrono::steady_clock::now()-start > std::chrono::milliseconds(timeout_ms)) return cvTimeoutError;
+      usleep(backoff);
+      if (backoff < IRQ_POLL_MAX_US) backoff *= 2;
+    }
+}
+
+Backoff::Backoff(uint32_t timeout_ms)
+  : end(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms)), step(SETUP_POLL_MIN_US)
+{
+}
+
+bool Backoff::Wait()
+{
+  if (std::chrono::steady_clock::now() >= end) return false;
+  usleep(step);
+  if (step < SETUP_POLL_MAX_US) step *= 2;
+  return true;
+}
+
+double ThreadCPUTime()
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+LatencyHistogram::LatencyHistogram()
+  : count(0), sum(0), max(0)
+{
+  for (int i = 0; i < LATENCY_BINS; ++i) bin[i] = 0;
+}
+
+void LatencyHistogram::Fill(double seconds)
+{
+  int b = 0;
+  for (double edge = 1e-6; b < LATENCY_BINS-1 && seconds >= edge; edge *= 2) ++b;
+  ++bin[b];
+  ++count;
+  sum += seconds;
+  if (seconds > max) max = seconds;
+}
+
+void LatencyHistogram::Print(std::string name)
+{
+  if (count == 0) return;
+  std::cout << name << ": " << count << " entries, mean " << std::setprecision(1) << std::fixed << 1e6*sum/count
+	    << " us, max " << 1e6*max << " us" << std::endl;
+  double lo = 0, hi = 1e-6;
+  for (int b = 0; b < LATENCY_BINS; ++b, lo = hi, hi *= 2)
+    {
+      if (bin[b] == 0) continue;
+      std::cout << "  " << std::setw(10) << std::setprecision(0) << 1e6*lo << " - ";
+      if (b == LATENCY_BINS-1) std::cout << std::setw(10) << "" << " us ";
+      else std::cout << std::setw(10) << 1e6*hi << " us ";
+      std::cout << std::setw(10) << bin[b] << std::endl;
+    }
+}
@@ -17,6 +17,10 @@
 #include <deque>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <ctime>
+#include <atomic>
+#include <thread>
 
 #include "../date/include/date/date.h"
 
@@ -24,7 +28,95 @@
 
 #include "TMath.h"
 
+// How a module's output buffer is fetched over the bus: one D32 single
+// cycle per word, or the whole buffer in one D32 (BLT) or D64 (MBLT) block
+// transfer.
+enum ReadoutMode {
+  READOUT_WORD,
+  READOUT_BLT,
+  READOUT_MBLT
+};
+
+bool ParseReadoutMode(std::string s, ReadoutMode * mode);
+const char * ReadoutModeName(ReadoutMode mode);
+
+// How the main loop waits for a module interrupt: blocking in
+// CAENVME_IRQWait, or polling CAENVME_IRQCheck with a backoff that grows
+// from IRQ_POLL_MIN_US to IRQ_POLL_MAX_US. IRQ_Wait falls back to polling
+// by itself if the bridge does not support the blocking wait.
+enum IRQMode {
+  IRQ_WAIT,
+  IRQ_POLL
+};
+
+#define IRQ_TIMEOUT_MS 100
+#define IRQ_POLL_MIN_US 10
+#define IRQ_POLL_MAX_US 1000
+
+bool ParseIRQMode(std::string s, IRQMode * mode);
+const char * IRQModeName(IRQMode mode);
+CVErrorCodes IRQ_Wait(int32_t Handle, CVIRQLevels level, uint32_t timeout_ms, IRQMode * mode);
+
+// CPU seconds used so far by the calling thread alone
+double ThreadCPUTime();
+
+// Bounded wait for a module to become ready, used by the setup instead of
+// fixed sleeps: poll, and while not ready call Wait(), which sleeps for a
+// step growing from SETUP_POLL_MIN_US to SETUP_POLL_MAX_US and returns
+// false once timeout_ms have passed.
+#define SETUP_POLL_MIN_US 10
+#define SETUP_POLL_MAX_US 1000
+
+struct Backoff {
+  Backoff(uint32_t timeout_ms);
+  bool Wait();
+ private:
+  std::chrono::steady_clock::time_point end;
+  uint32_t step;
+};
+
+// Durations in powers of two from 1 us up, printed at the end of a run
+#define LATENCY_BINS 22
+
+struct LatencyHistogram {
+  uint64_t bin[LATENCY_BINS];
+  uint64_t count;
+  double sum;
+  double max;
+  LatencyHistogram();
+  void Fill(double seconds);
+  void Print(std::string name);
+};
+
+// Up to N elements stored in place, with the parts of std::vector the
+// event records use. Per-event records built from these never allocate,
+// so copying and clearing them in the event loop costs no memory
+// management. push_back on a full list drops the element and returns false.
+template <typename T, size_t N>
+struct FixedList {
+  T item[N];
+  size_t n;
+FixedList() : n(0) {}
+  void clear() { n = 0; }
+  bool push_back(const T & x)
+  {
+    if (n >= N) return false;
+    item[n++] = x;
+    return true;
+  }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  T & operator[](size_t i) { return item[i]; }
+  const T & operator[](size_t i) const { return item[i]; }
+  T * begin() { return item; }
+  T * end() { return item+n; }
+  const T * begin() const { return item; }
+  const T * end() const { return item+n; }
+};
+
 uint32_t BitMask(uint32_t val, uint32_t offset, uint32_t N);
+// Ctrl+C only sets stopRequested; the loops that wait look at it
+extern volatile sig_atomic_t stopRequested;
 void handler(int s);
 void checkApiCall(CVErrorCodes err, std::string s);
 
@@ -0,0 +1,109 @@
+#include "EventBuilder.h"
+
+#include <cmath>
+
+EventBuilder::EventBuilder(size_t batch)
+  : built(0), lostQDC(0), lostTDC(0), resyncs(0),
+    window(MaxEvents(batch)), qdc(window), tdc(window), qtime(window), ttime(window),
+    qhead(0), qsize(0), thead(0), tsize(0), qlast(0), tlast(0), qwraps(0), twraps(0),
+    haveOffset(false), offset(0), lastPair(0), misses(0)
+{
+}
+
+// Time in ns of a counter of bits bits, counting the times it went round
+// since the previous event. A gap longer than one turn (67 s for the
+// MQDC32, 107 s for the VX1290A) is taken for a shorter one; the pairs
+// after it are then dropped until the offset is learned again.
+static double BuilderTime(uint32_t raw, int bits, double tick, uint32_t * last, uint64_t * wraps)
+{
+  raw &= (1u << bits)-1;
+  if (raw < *last) ++*wraps;
+  *last = raw;
+  return tick*(double)((*wraps << bits)+raw);
+}
+
+void EventBuilder::Build(std::vector<MQDC32_Event> * qdcevents, std::vector<VX1290A_Event> * tdcevents)
+{
+  // into the windows; a full window loses its oldest event
+  for (auto & q : *qdcevents)
+    {
+      if (qsize == window)
+	{
+	  qhead = (qhead+1) % window;
+	  --qsize;
+	  ++lostQDC;
+	}
+      size_t k = (qhead+qsize++) % window;
+      qdc[k] = q;
+      qtime[k] = BuilderTime(q.eoe.timestamp,BUILDER_QDC_BITS,BUILDER_QDC_TICK_NS,&qlast,&qwraps);
+    }
+  for (auto & t : *tdcevents)
+    {
+      if (tsize == window)
+	{
+	  thead = (thead+1) % window;
+	  --tsize;
+	  ++lostTDC;
+	}
+      size_t k = (thead+tsize++) % window;
+      tdc[k] = t;
+      ttime[k] = BuilderTime(t.gtt.trig_time,BUILDER_TDC_BITS,BUILDER_TDC_TICK_NS,&tlast,&twraps);
+    }
+  qdcevents->clear();
+  tdcevents->clear();
+
+  while (qsize > 0 && tsize > 0)
+    {
+      double tq = qtime[qhead];
+      double tt = ttime[thead];
+      if (!haveOffset)
+	{
+	  offset = tq-tt;
+	  lastPair = tt;
+	  haveOffset = true;
+	}
+      // the clocks may drift apart a little since the last pair
+      double d = tq-offset-tt;
+      double tolerance = BUILDER_TOLERANCE_NS+BUILDER_DRIFT*std::fabs(tt-lastPair);
+      if (std::fabs(d) <= tolerance)
+	{
+	  qdcevents->push_back(qdc[qhead]);
+	  tdcevents->push_back(tdc[thead]);
+	  qhead = (qhead+1) % window;
+	  --qsize;
+	  thead = (thead+1) % window;
+	  --tsize;
+	  ++built;
+	  offset = tq-tt;
+	  lastPair = tt;
+	  misses = 0;
+	  continue;
+	}
+      // the earlier of the two will never see its partner
+      if (d < 0)
+	{
+	  qhead = (qhead+1) % window;
+	  --qsize;
+	  ++lostQDC;
+	}
+      else
+	{
+	  thead = (thead+1) % window;
+	  --tsize;
+	  ++lostTDC;
+	}
+      if (++misses >= BUILDER_RESYNC)
+	{
+	  haveOffset = false;
+	  misses = 0;
+	  ++resyncs;
+	}
+    }
+}
+
+void EventBuilder::Print()
+{
+  std::cout << "Event builder: " << built << " events built, " << lostQDC << " MQDC32 and " << lostTDC
+	    << " VX1290A events dropped, " << resyncs << " clock resyncs, " << qsize << " MQDC32 and "
+	    << tsize << " VX1290A events left unpaired" << std::endl;
+}
@@ -0,0 +1,60 @@
+#ifndef EVENTBUILDER_H
+#define EVENTBUILDER_H
+
+#include "MQDC32.h"
+#include "VX1290A.h"
+
+#include "Common.h"
+
+#define BUILDER_WINDOW 64         /* events kept from each module waiting for a partner, besides two batches */
+#define BUILDER_QDC_TICK_NS 62.5  /* MQDC32 EoE time stamp, 16 MHz */
+#define BUILDER_QDC_BITS 30
+#define BUILDER_TDC_TICK_NS 800.0 /* VX1290A extended trigger time tag */
+#define BUILDER_TDC_BITS 27
+#define BUILDER_TOLERANCE_NS 2000 /* two VX1290A ticks and the MQDC32 one, with room */
+#define BUILDER_DRIFT 1e-4        /* bound on the rate difference of the two clocks */
+#define BUILDER_RESYNC 8          /* drops in a row after which the clock offset is learned again */
+
+// Pairs MQDC32 and VX1290A events by their trigger times (MQDC32 EoE with
+// MQDC32_MARK_TIME, VX1290A global trigger time) instead of by the order
+// they were read in. The two clocks are not synchronised, so the offset
+// between them is learned from the first pair and followed from pair to
+// pair; in effect the time from one trigger to the next is compared. The
+// events of each module wait in a small window until the other module's
+// event of the same time arrives; an event the other module has already
+// gone past is dropped and counted. So an event lost by either module, a
+// missed IRQ or a trigger only the VX1290A saw costs that event instead of
+// mismatching every later one. The offset is learned again after
+// BUILDER_RESYNC drops in a row. The event counters cannot do this: a
+// trigger seen by one module only moves both counters of the pair on
+// alike. Works for single events, multi-event batches and CBLT.
+struct EventBuilder {
+  EventBuilder(size_t batch);
+  // Take the events just read and hand back the matched pairs, aligned by
+  // index, in the same vectors.
+  void Build(std::vector<MQDC32_Event> * qdcevents, std::vector<VX1290A_Event> * tdcevents);
+  void Print();
+  // most pairs Build() hands back at once: what the event lists must hold
+  static size_t MaxEvents(size_t batch) { return 2*batch+BUILDER_WINDOW; }
+
+  uint64_t built;
+  uint64_t lostQDC;         // MQDC32 events without a VX1290A partner
+  uint64_t lostTDC;         // VX1290A events without a MQDC32 partner
+  uint64_t resyncs;
+
+ private:
+  size_t window;
+  std::vector<MQDC32_Event> qdc;     // rings of window events
+  std::vector<VX1290A_Event> tdc;
+  std::vector<double> qtime;         // their times in ns, unwrapped
+  std::vector<double> ttime;
+  size_t qhead, qsize, thead, tsize;
+  uint32_t qlast, tlast;             // raw time of the last event
+  uint64_t qwraps, twraps;
+  bool haveOffset;
+  double offset;                     // MQDC32 time - VX1290A time
+  double lastPair;                   // VX1290A time of the last pair
+  uint32_t misses;
+};
+
+#endif
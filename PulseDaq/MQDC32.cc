@@ -12,27 +12,88 @@ CVErrorCodes MQDC32_Write_Register(int32_t Handle, uint32_t address, uint32_t da
   return CAENVME_WriteCycle(Handle, address, &data, cvA32_U_DATA, cvD16);
 }
 
-CVErrorCodes MQDC32_Read_BLT(int32_t Handle, uint32_t address, uint32_t *data)
+CVErrorCodes MQDC32_Read_D32(int32_t Handle, uint32_t address, uint32_t *data)
 {
   return CAENVME_ReadCycle(Handle, address, data, cvA32_U_DATA, cvD32);
 }
 
-CVErrorCodes MQDC32_Setup(int32_t Handle)
+// Fetch nwords of the event buffer in one block transfer. The buffer is a
+// FIFO at a single address, so the address is not incremented. The module
+// ends the transfer with a bus error when it runs out of data, which is
+// not an error as long as some words came.
+CVErrorCodes MQDC32_Read_BLT(int32_t Handle, MQDC32_Buffer * buf, uint32_t nwords, ReadoutMode mode)
 {
-  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, 0x0),"MQDC32_Setup: Write Stop Acquisition");
-  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_SOFT_RESET, 0x1),"MQDC32_Setup: Write Soft Reset");
-  usleep(1000000);
+  if (nwords > MQDC32_BUFFER_WORDS) nwords = MQDC32_BUFFER_WORDS;
+  int count = 0;
+  CVErrorCodes ret;
+  if (mode == READOUT_MBLT)
+    ret = CAENVME_FIFOMBLTReadCycle(Handle, MQDC32_BASE + MQDC32_EVENT_READOUT_BUFFER, buf->word.data(), 8*((nwords+1)/2), cvA32_U_MBLT, &count);
+  else
+    ret = CAENVME_FIFOBLTReadCycle(Handle, MQDC32_BASE + MQDC32_EVENT_READOUT_BUFFER, buf->word.data(), 4*nwords, cvA32_U_BLT, cvD32, &count);
+  buf->size = count/4;
+  if (ret == cvBusError && count > 0) ret = cvSuccess;
+  return ret;
+}
+
+// Poll MQDC32_START_ACQ until the module answers, for up to
+// MQDC32_RESET_TIMEOUT_MS; it does not while a reset is in progress. A
+// soft reset sets the register back to its default, 1, so after one
+// (after_reset) it must also read 1. Before one, any value will do: a run
+// that died after MQDC32_Setup left the acquisition stopped, and a system
+// reset need not reset the module.
+CVErrorCodes MQDC32_Wait_Ready(int32_t Handle, bool after_reset)
+{
+  Backoff wait(MQDC32_RESET_TIMEOUT_MS);
+  do {
+    uint32_t acq = 0;
+    CVErrorCodes ret = MQDC32_Read_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, &acq);
+    if (ret != cvSuccess && ret != cvBusError) return ret;
+    if (ret == cvSuccess && (!after_reset || (acq & 0x1))) return cvSuccess;
+  } while (wait.Wait());
+  return cvTimeoutError;
+}
+
+// Stop the acquisition and start a soft reset without waiting for it;
+// MQDC32_Setup waits, so the VX1290A can be set up in the meantime.
+CVErrorCodes MQDC32_Reset(int32_t Handle)
+{
+  // the module may still be coming out of a system reset
+  checkApiCall(MQDC32_Wait_Ready(Handle,false),"MQDC32_Reset: Wait Ready");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, 0x0),"MQDC32_Reset: Write Stop Acquisition");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_SOFT_RESET, 0x1),"MQDC32_Reset: Write Soft Reset");
+  return cvSuccess;
+}
+
+CVErrorCodes MQDC32_Setup(int32_t Handle, const Settings & set)
+{
+  checkApiCall(MQDC32_Wait_Ready(Handle,true),"MQDC32_Setup: Wait for Soft Reset");
+  // the reset starts the acquisition again; MQDC32_Start or CBLT_Start
+  // starts it once all modules are set up
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, MQDC32_ACQ_STOP),"MQDC32_Setup: Write Stop Acquisition");
   for (uint32_t chan = 16; chan < 32; ++chan)
     {
       checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + 0x4000 + chan,0xFFF1),"MQDC32_Setup: Disable channels 16-32");
     }
   checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_DATA_LEN_FMT, 0x2),"MQDC32_Setup: Write Data Length Format");
-  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MULTIEVENT, 0x0),"MQDC32_Setup: Write Multievent Off");
-  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MARKING_TYPE, 0x1),"MQDC32_Setup: Write EoE Mark");
+  if (set.MultiEvent() > 1)
+    {
+      // Buffer about MultiEvent() events before interrupting: header, one
+      // word per read channel and EoE each. Limited multi-event mode ends a
+      // transfer with a bus error after the event that reaches the same
+      // number of words, so a block read never stops inside an event.
+      uint32_t words = set.MultiEvent()*(2+set.MQDC32_CHANNEL_CHARGE().size());
+      if (words > MQDC32_BUFFER_WORDS/2) words = MQDC32_BUFFER_WORDS/2;
+      checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MULTIEVENT, MQDC32_MULTIEVENT_LIMITED),"MQDC32_Setup: Write Multievent On");
+      checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_IRQ_DATA_THRESHOLD, words),"MQDC32_Setup: Write IRQ Data Threshold");
+      checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MAX_TRANSFER_DATA, words),"MQDC32_Setup: Write Max Transfer Data");
+    }
+  else
+    checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MULTIEVENT, MQDC32_MULTIEVENT_OFF),"MQDC32_Setup: Write Multievent Off");
+  // The EoE carries the time stamp, which the event builder compares with
+  // the VX1290A trigger time
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_MARKING_TYPE, MQDC32_MARK_TIME),"MQDC32_Setup: Write EoE Mark");
   checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_IRQ_VECTOR, 0x0),"MQDC32_Setup: Write IRQ Vector");
   checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_IRQ_LEVEL, cvIRQ1),"MQDC32_Setup: Write IRQ Level");
-  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_READOUT_RESET, 0x0),"MQDC32_Setup: Write Readout Reset");
-  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, 0x1),"MQDC32_Setup: Start Acquisition");
   //usleep(1000000);
 
 
@@ -40,6 +101,18 @@ CVErrorCodes MQDC32_Setup(int32_t Handle)
   return cvSuccess;
 }
 
+// Empty the buffer, reset the counters and start converting. Called after
+// the VX1290A is set up and cleared, so that the first event of each
+// module comes from the same trigger.
+CVErrorCodes MQDC32_Start(int32_t Handle)
+{
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_FIFO_RESET, 0x0),"MQDC32_Start: Write FIFO Reset");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_RESET_CTL_AB, 0x3),"MQDC32_Start: Reset Counters");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_READOUT_RESET, 0x0),"MQDC32_Start: Write Readout Reset");
+  checkApiCall(MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_START_ACQ, MQDC32_ACQ_START),"MQDC32_Start: Start Acquisition");
+  return cvSuccess;
+}
+
 CVErrorCodes MQDC32_Reset_Data_Buffer(int32_t Handle)
 {
   return MQDC32_Write_Register(Handle, MQDC32_BASE + MQDC32_READOUT_RESET, 0x1);
@@ -47,7 +120,15 @@ CVErrorCodes MQDC32_Reset_Data_Buffer(int32_t Handle)
 
 CVErrorCodes MQDC32_Read_Word(int32_t Handle, uint32_t * data)
 {
-  return MQDC32_Read_BLT(Handle, MQDC32_BASE + MQDC32_EVENT_READOUT_BUFFER, data);
+  return MQDC32_Read_D32(Handle, MQDC32_BASE + MQDC32_EVENT_READOUT_BUFFER, data);
+}
+
+// Number of 32-bit words waiting in the event buffer (MQDC32_DATA_LEN_FMT
+// is set to 32 bit in MQDC32_Setup)
+CVErrorCodes MQDC32_Read_Data_Length(int32_t Handle, uint32_t * len)
+{
+  *len = 0;
+  return MQDC32_Read_Register(Handle, MQDC32_BASE + MQDC32_BUF_DATA_LEN, len);
 }
 
 bool MQDC32_IsHeader(uint32_t word)
@@ -89,9 +170,73 @@ void MQDC32_ParseEoEWord(uint32_t word, MQDC32_EoE * eoe)
   eoe->esig = BitMask(word,30,2);
 }
 
-CVErrorCodes MQDC32_ReadEvent(int32_t handle, MQDC32_Header * head, std::vector<MQDC32_Data> * data, MQDC32_EoE * eoe, Settings set)
+// Add one word to the event being read; true when it completes the event.
+bool MQDC32_ParseWord(uint32_t word, MQDC32_Event * ev, const Settings & set)
+{
+  if (MQDC32_IsHeader(word))
+    {
+      MQDC32_ParseHeaderWord(word,&ev->head);
+      ev->data.clear();
+      if (set.Verbose()) ev->head.Print();
+    }
+  else if (MQDC32_IsData(word))
+    {
+      MQDC32_Data d;
+      MQDC32_ParseDataWord(word,&d);
+
+      if (!(set.MQDC32_CHANNEL_MASK() >> d.channel & 1))
+	{
+	  if (set.Verbose()) d.Print();
+	  return false;
+	}
+      else
+	{
+	  if (set.Verbose())
+	    {
+	      std::cout << "---> ";
+	      d.Print();
+	    }
+	}
+      ev->data.push_back(d);
+    }
+  else if (MQDC32_IsEoE(word))
+    {
+      MQDC32_ParseEoEWord(word,&ev->eoe);
+      if (set.Verbose()) ev->eoe.Print();
+      return true;
+    }
+  return false;
+}
+
+// Read everything the module holds into buf without looking at it. In
+// multi-event mode that is a whole batch, and an event may be cut off at
+// the end of the transfer.
+CVErrorCodes MQDC32_Read_Buffer(int32_t handle, const Settings & set, MQDC32_Buffer * buf)
 {
   CVErrorCodes ret;
+  buf->size = 0;
+  if (set.Readout() != READOUT_WORD)
+    {
+      // Ask the module how much it holds and fetch all of it in one block
+      // transfer
+      uint32_t len;
+      ret = MQDC32_Read_Data_Length(handle,&len);
+      if (ret != cvSuccess)
+	{
+	  std::cout << "Error in MQDC32_Read_Buffer" << std::endl;
+	  throw ret;
+	}
+      if (set.Verbose()) std::cout << "MQDC32_BUF_DATA_LEN = " << len << std::endl;
+      if (len == 0) return cvSuccess;
+      ret = MQDC32_Read_BLT(handle,buf,len,set.Readout());
+      if (ret != cvSuccess)
+	{
+	  std::cout << "Error in MQDC32_Read_Buffer" << std::endl;
+	  throw ret;
+	}
+      return cvSuccess;
+    }
+
   uint32_t word;
   do
     {
@@ -105,56 +250,34 @@ CVErrorCodes MQDC32_ReadEvent(int32_t handle, MQDC32_Header * head, std::vector<
 	  else if (ret == cvInvalidParam) std::cout << "MQDC32_Read_Word return = cvInvalidParam" << std::endl;
 	  else if (ret == cvTimeoutError) std::cout << "MQDC32_Read_Word return = cvTimeoutError" << std::endl;
 	}
-      if (ret == cvSuccess)
-	{
-	  if (MQDC32_IsHeader(word))
-	    {
-	      MQDC32_ParseHeaderWord(word,head);
-	      if (set.Verbose()) head->Print();
-	    }
-	  else if (MQDC32_IsData(word))
-	    {
-	      MQDC32_Data d;
-	      MQDC32_ParseDataWord(word,&d);
-
-	      bool isValidChan = false;
-	      for (auto & elem : set.MQDC32_CHANNEL_CHARGE())
-		{
-		  if (elem==d.channel)
-		    {
-		      isValidChan=true;
-		      break;
-		    }
-		}
-	      
-	      if (!isValidChan)
-		{
-		  if (set.Verbose()) d.Print();
-		  continue;
-		}
-	      else
-		{
-		  if (set.Verbose())
-		    {
-		      std::cout << "---> ";
-		      d.Print();
-		    }
-		}
-	      data->push_back(d);
-	    }
-	  else if (MQDC32_IsEoE(word))
-	    {
-	      MQDC32_ParseEoEWord(word,eoe);
-	      if (set.Verbose()) eoe->Print();
-	    }
-	}
+      if (ret == cvSuccess) buf->word[buf->size++] = word;
       else if (ret == cvBusError) break;
       else
 	{
-	  std::cout << "Error in MQDC32_ReadEvent" << std::endl;
+	  std::cout << "Error in MQDC32_Read_Buffer" << std::endl;
 	  throw ret;
 	}
-    } while (ret == cvSuccess);
+    } while (ret == cvSuccess && buf->size < MQDC32_BUFFER_WORDS);
   return cvSuccess;
 }
 
+// Number of events that end in buf
+uint32_t MQDC32_Count_Events(const MQDC32_Buffer & buf)
+{
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < buf.size; ++i)
+    {
+      if (MQDC32_IsEoE(buf.word[i])) ++n;
+    }
+  return n;
+}
+
+// Append the events completed by the words in buf. An event cut off at
+// the end stays in *partial and is finished by the next buffer.
+void MQDC32_Decode_Buffer(const MQDC32_Buffer & buf, std::vector<MQDC32_Event> * events, MQDC32_Event * partial, const Settings & set)
+{
+  for (uint32_t i = 0; i < buf.size; ++i)
+    {
+      if (MQDC32_ParseWord(buf.word[i],partial,set)) events->push_back(*partial);
+    }
+}
@@ -4,6 +4,8 @@
 #define  MQDC32_EMPTY  1
 #define  MQDC32_MAX_CHANNELS               32
 #define  MQDC32_EVENT_READOUT_BUFFER            0x0000 /* R/W D32, D64 */
+#define  MQDC32_BUFFER_WORDS               16384  /* 32-bit words, largest block read at once */
+#define  MQDC32_RESET_TIMEOUT_MS           2000   /* longest wait for the module after a reset */
 
 // Thershold memory
 #define MQDC32_THRESHOLD_0             0x4000      /* R/W def:0 */
@@ -106,6 +108,16 @@
 #define MQDC32_ACQ_START                    1
 #define MQDC32_MARK_TIME                    1
 #define MQDC32_MARK_EVENT                   0
+#define MQDC32_CBLT_DISABLE                 0x01 /* MQDC32_CBLT_MCST_CTL bits */
+#define MQDC32_CBLT_ENABLE                  0x02
+#define MQDC32_CBLT_LAST_DISABLE            0x04
+#define MQDC32_CBLT_LAST_ENABLE             0x08
+#define MQDC32_CBLT_FIRST_DISABLE           0x10
+#define MQDC32_CBLT_FIRST_ENABLE            0x20
+#define MQDC32_MCST_DISABLE                 0x40
+#define MQDC32_MCST_ENABLE                  0x80
+#define MQDC32_MULTIEVENT_OFF               0
+#define MQDC32_MULTIEVENT_LIMITED           3  /* BERR after MQDC32_MAX_TRANSFER_DATA words */
 #define DONE                                0
 
 #include "Common.h"
@@ -113,10 +125,25 @@
 
 CVErrorCodes MQDC32_Read_Register(int32_t Handle, uint32_t address, uint32_t *data);
 CVErrorCodes MQDC32_Write_Register(int32_t Handle, uint32_t address, uint32_t data);
-CVErrorCodes MQDC32_Read_BLT(int32_t Handle, uint32_t address, uint32_t *data);
-CVErrorCodes MQDC32_Setup(int32_t Handle);
+CVErrorCodes MQDC32_Read_D32(int32_t Handle, uint32_t address, uint32_t *data);
+CVErrorCodes MQDC32_Wait_Ready(int32_t Handle, bool after_reset);
+CVErrorCodes MQDC32_Reset(int32_t Handle);
+CVErrorCodes MQDC32_Setup(int32_t Handle, const Settings & set);
+CVErrorCodes MQDC32_Start(int32_t Handle);
 CVErrorCodes MQDC32_Reset_Data_Buffer(int32_t Handle);
 CVErrorCodes MQDC32_Read_Word(int32_t Handle, uint32_t * data);
+CVErrorCodes MQDC32_Read_Data_Length(int32_t Handle, uint32_t * len);
+
+// Memory for one block transfer of the event buffer, allocated once.
+// One word more than MQDC32_BUFFER_WORDS for the fill word of an odd
+// length MBLT.
+struct MQDC32_Buffer {
+  std::vector<uint32_t> word;
+  uint32_t size;
+MQDC32_Buffer() : word(MQDC32_BUFFER_WORDS+1,0), size(0) {}
+};
+
+CVErrorCodes MQDC32_Read_BLT(int32_t Handle, MQDC32_Buffer * buf, uint32_t nwords, ReadoutMode mode);
 
 bool MQDC32_IsHeader(uint32_t word);
 bool MQDC32_IsData(uint32_t word);
@@ -165,6 +192,16 @@ void MQDC32_ParseHeaderWord(uint32_t word, MQDC32_Header * head);
 void MQDC32_ParseDataWord(uint32_t word, MQDC32_Data * data);
 void MQDC32_ParseEoEWord(uint32_t word, MQDC32_EoE * eoe);
 
+// One event as it comes out of the buffer: header, accepted data words and
+// end of event mark
+struct MQDC32_Event {
+  MQDC32_Header head;
+  FixedList<MQDC32_Data,MQDC32_MAX_CHANNELS> data;
+  MQDC32_EoE eoe;
+};
+
+bool MQDC32_ParseWord(uint32_t word, MQDC32_Event * ev, const Settings & set);
+
 struct MQDC32_EnableChannel {
   std::vector<bool> ch;
 MQDC32_EnableChannel() : ch(32,false) {}
@@ -174,6 +211,8 @@ MQDC32_EnableChannel() : ch(32,false) {}
   }
 };
 
-CVErrorCodes MQDC32_ReadEvent(int32_t handle, MQDC32_Header * head, std::vector<MQDC32_Data> * data, MQDC32_EoE * eoe, Settings set);
+CVErrorCodes MQDC32_Read_Buffer(int32_t handle, const Settings & set, MQDC32_Buffer * buf);
+uint32_t MQDC32_Count_Events(const MQDC32_Buffer & buf);
+void MQDC32_Decode_Buffer(const MQDC32_Buffer & buf, std::vector<MQDC32_Event> * events, MQDC32_Event * partial, const Settings & set);
 
 #endif  //  MQDC32_H
@@ -56,6 +56,62 @@ int main(int argc, char ** argv)
 	  set.SetConfigFile(argv[i+1]);
 	  ++i;
 	}
+      else if (!strcmp(argv[i],"-readout"))
+	{
+	  ReadoutMode mode;
+	  if (i+2 > argc || !ParseReadoutMode(argv[i+1],&mode))
+	    {
+	      std::cout << "need to specify a readout mode (word, blt or mblt)!" << std::endl;
+	      return 0;
+	    }
+	  set.SetReadout(mode);
+	  ++i;
+	}
+      else if (!strcmp(argv[i],"-multievent"))
+	{
+	  if (i+2 > argc)
+	    {
+	      std::cout << "need to specify a number of events per readout!" << std::endl;
+	      return 0;
+	    }
+	  set.SetMultiEvent(std::stod(argv[i+1]));
+	  ++i;
+	}
+      else if (!strcmp(argv[i],"-crate"))
+	{
+	  set.SetUseCrate(true);
+	}
+      else if (!strcmp(argv[i],"-build"))
+	{
+	  set.SetUseBuilder(true);
+	}
+      else if (!strcmp(argv[i],"-irq"))
+	{
+	  IRQMode mode;
+	  if (i+2 > argc || !ParseIRQMode(argv[i+1],&mode))
+	    {
+	      std::cout << "need to specify an IRQ mode (wait or poll)!" << std::endl;
+	      return 0;
+	    }
+	  set.SetIRQ(mode);
+	  ++i;
+	}
+    }
+  if (set.UseCrate() && (!set.UseTDC() || set.Readout() == READOUT_WORD))
+    {
+      std::cout << "-crate needs -tdc and block readout!" << std::endl;
+      return 0;
+    }
+  if (set.UseBuilder() && !set.UseTDC())
+    {
+      std::cout << "-build needs -tdc!" << std::endl;
+      return 0;
+    }
+  // the VX1290A takes one event per MQDC32 event in every readout
+  if (set.UseTDC() && set.MultiEvent() > VX1290A_Max_Events(set))
+    {
+      std::cout << "-multievent limited to " << VX1290A_Max_Events(set) << " events per readout by the VX1290A" << std::endl;
+      set.SetMultiEvent(VX1290A_Max_Events(set));
     }
   if (!(set.IsValid()))
     {
@@ -68,6 +124,11 @@ int main(int argc, char ** argv)
       std::cout << "     -tdc , include if TDC information is to be recorded" << std::endl;
       std::cout << "     -v , verbose output to terminal" << std::endl;
       std::cout << "     -i [number of events] , \"interactive mode\": during recording show average of a specified number of recent measurements" << std::endl;
+      std::cout << "     -readout [word|blt|mblt] , MQDC32 and VX1290A readout: one single cycle per word, or whole events in one D32 or D64 block transfer (default blt)" << std::endl;
+      std::cout << "     -multievent [number of events] , let the MQDC32 buffer about this many events before interrupting, then read them in one block transfer" << std::endl;
+      std::cout << "     -crate , read the VX1290A and MQDC32 together in one chained block transfer (needs -tdc and blt or mblt readout)" << std::endl;
+      std::cout << "     -irq [wait|poll] , block in CAENVME_IRQWait for the MQDC32 interrupt, or poll for it with a growing backoff (default wait)" << std::endl;
+      std::cout << "     -build , pair MQDC32 and VX1290A events by their trigger times, dropping events that lost their partner (needs -tdc)" << std::endl;
       return 0;
     }
 
@@ -132,239 +193,345 @@ int main(int argc, char ** argv)
   uint32_t nT = 0;
 
   if (set.UseInteractive()) std::cout << "Displaying average of " << set.Interactive() << " pulses." << std::endl;
-  std::deque<Double_t> windowQDC;
-  std::deque<Double_t> windowTDC;
+  // the last Interactive() pulses, as rings (the order does not matter
+  // for mean and spread)
+  std::vector<Double_t> windowQDC(set.Interactive(),0);
+  std::vector<Double_t> windowTDC(set.Interactive(),0);
+  uint64_t nwindow = 0;
 
   Double_t mqdc, sqdc, mqdc_last, sqdc_last;
   Double_t mtdc, stdc, mtdc_last, stdc_last;
 
   Double_t ADCtopC = 500.0/3840.0;
 
-  try
-    {
-      std::cout << "Initializing V1718..." << std::endl;
-      checkApiCall(CAENVME_Init(cvV1718, 0, set.VX1718_USB_CHANNEL(), &handle),"CAENVME_Init");
-      checkApiCall(CAENVME_SystemReset(handle),"CAENVME_SystemReset");
-      usleep(1000000);
-      std::cout << "             MQDC32..." << std::endl;
-      checkApiCall(MQDC32_Setup(handle),"MQDC32_Setup");
-      if (set.UseTDC())
-	{
-	  std::cout << "             VX1290A..." << std::endl;
-	  checkApiCall(VX1290A_Setup(handle,set),"VX1290A_Setup");
-	}
+  // The readout thread (this one) only talks to the bus and hands the raw
+  // buffers of each readout over in the queue; the writer thread decodes
+  // them, builds events, keeps the statistics and fills the tree. The
+  // events of one readout, the partial events carried to the next, and
+  // the time spent reading
+  ReadoutQueue queue(set);
+  std::vector<MQDC32_Event> qdcevents;
+  MQDC32_Event qdcpartial;
+  std::vector<VX1290A_Event> tdcevents;
+  VX1290A_Event tdcpartial;
+  VX1290A_Event notdc;
+  EventBuilder builder(set.MultiEvent());
+  // room for what the builder hands back at most, so the event loop does
+  // not allocate
+  qdcevents.reserve(EventBuilder::MaxEvents(set.MultiEvent()));
+  tdcevents.reserve(EventBuilder::MaxEvents(set.MultiEvent()));
+  uint32_t nIRQ = 0;
+  std::chrono::duration<double> qdc_readout_time(0);
+  std::chrono::duration<double> tdc_readout_time(0);
+  std::chrono::duration<double> run_time(0);
+  IRQMode irqmode = set.IRQ();
+  LatencyHistogram irq_wait;
+  LatencyHistogram irq_latency;
+  // wall and readout thread CPU time from the first arm to the end of the
+  // readout loop
+  auto start_time = std::chrono::high_resolution_clock::now();
+  double cpu_start = 0;
+  double cpu_time = 0;
+  bool armed = false;
 
+  // Decode, build and write each readout as the queue hands it over,
+  // until the readout thread finishes. Once n events are recorded the
+  // readout is told to stop; what it read meanwhile is dropped.
+  WriterThread writer(queue, [&]()
+    {
       auto before_time = std::chrono::high_resolution_clock::now();
       auto after_time = std::chrono::high_resolution_clock::now();
-      
-      while (n < set.NumEvents())
+      RawReadout * raw;
+      while ((raw = queue.Next()) != NULL)
 	{
-	  if ((set.NumEvents()<100 || set.Delay() > 100000 || n%(set.NumEvents()/100)==0) && !(set.UseInteractive()))
-	    std::cout << "\rReading event " << n << std::flush;
-	  
-	  // The MQDC32 emits an IRQ1 when data is ready, so check for it
-	  unsigned char mask = 0;
-	  while (!(mask & (1<<(cvIRQ1-1))))
+	  if (n >= set.NumEvents())
 	    {
-	      checkApiCall(CAENVME_IRQCheck(handle, &mask),"CAENVME_IRQCheck");
+	      queue.Release();
+	      continue;
 	    }
-	  
-	  // When the MQDC32 IRQ1 is found, acknowledge it and continue reading data
-	  uint32_t vector;
-	  checkApiCall(CAENVME_IACKCycle(handle,cvIRQ1,&vector,cvD16),"CAENVME_IACKCycle");
+	  if ((set.NumEvents()<100 || set.Delay() > 100000 || n%(set.NumEvents()/100)==0) && !(set.UseInteractive()))
+	    std::cout << "\rReading event " << n << std::flush;
 
-	  // Read MQDC32 output buffer and store in structs
-	  MQDC32_Header head;
-	  std::vector<MQDC32_Data> data;
-	  MQDC32_EoE eoe;
-	  checkApiCall(MQDC32_ReadEvent(handle,&head,&data,&eoe,set),"MQDC32_ReadEvent");
-
-	  // Read VX1290A (which was triggered by the output of MQDC32)
-	  VX1290A_GlobalHeader gh;
-	  VX1290A_GlobalTrailer gt;
-	  std::vector<VX1290A_TDCHeader> th;
-	  std::vector<VX1290A_TDCMeasurement> tm;
-	  std::vector<VX1290A_TDCError> te;
-	  std::vector<VX1290A_TDCTrailer> tt;
-	  VX1290A_GlobalTrigTime gtt;
-	  if (set.UseTDC())
+	  qdcevents.clear();
+	  tdcevents.clear();
+	  if (set.UseCrate()) CBLT_Decode_Buffer(raw->cblt,&qdcevents,&qdcpartial,&tdcevents,&tdcpartial,set);
+	  else
 	    {
-	      checkApiCall(VX1290A_ReadEvent(handle,&gh,&gt,&th,&tm,&te,&tt,&gtt,set),"VX1290A_ReadEvent");
+	      MQDC32_Decode_Buffer(raw->qdc,&qdcevents,&qdcpartial,set);
+	      if (set.UseTDC()) VX1290A_Decode_Buffer(raw->tdc,&tdcevents,&tdcpartial,set);
 	    }
+	  now = raw->time;
+	  queue.Release();
+	  dp = floor<days>(now);
+	  ymd = year_month_day{dp};
+	  time = make_time(std::chrono::duration_cast<std::chrono::milliseconds>(now-dp));
+	  year = (int)(ymd.year());
+	  month = (unsigned)(ymd.month());
+	  day = (unsigned)(ymd.day());
+	  hour = time.hours().count();
+	  minute = time.minutes().count();
+	  second = time.seconds().count();
+	  millisecond = time.subseconds().count();
+
+	  if (set.UseBuilder()) builder.Build(&qdcevents,&tdcevents);
 
-	  /*
-	  // Print parsed words if desired
-	  if (set.Verbose())
+	  // a batch may hold more events than are still wanted
+	  for (size_t iev = 0; iev < qdcevents.size() && n < set.NumEvents(); ++iev)
 	    {
-	      head.Print();
-	      for (auto i : data) i.Print();
-	      eoe.Print();
-	      gh.Print();
-	      gtt.Print();
-	      for (auto i : th) i.Print();
-	      for (auto i : tm) i.Print();
-	      for (auto i : te) i.Print();
-	      for (auto i : tt) i.Print();
-	      gt.Print();
-	    }
-	  */
+	      MQDC32_Event & qdcevent = qdcevents[iev];
+	      FixedList<MQDC32_Data,MQDC32_MAX_CHANNELS> & data = qdcevent.data;
+	      MQDC32_EoE & eoe = qdcevent.eoe;
+	      VX1290A_Event & tdcevent = (iev < tdcevents.size()) ? tdcevents[iev] : notdc;
+	      FixedList<VX1290A_TDCMeasurement,VX1290A_MAX_HITS> & tm = tdcevent.tm;
+	      VX1290A_GlobalTrigTime & gtt = tdcevent.gtt;
+
+	      /*
+	      // Print parsed words if desired
+	      if (set.Verbose())
+		{
+		  qdcevent.head.Print();
+		  for (auto i : data) i.Print();
+		  eoe.Print();
+		  tdcevent.gh.Print();
+		  gtt.Print();
+		  for (auto i : tdcevent.th) i.Print();
+		  for (auto i : tm) i.Print();
+		  for (auto i : tdcevent.te) i.Print();
+		  for (auto i : tdcevent.tt) i.Print();
+		  tdcevent.gt.Print();
+		}
+	      */
 
 	  
-	  /////////////////////////////////////////////
-	  // Acquire data here and fill output TTree //
-	  /////////////////////////////////////////////
+	      /////////////////////////////////////////////
+	      // Acquire data here and fill output TTree //
+	      /////////////////////////////////////////////
 	  
-	  std::vector<uint32_t> measuredQDCchannels;
-	  for (auto d : data)
-	    {
-	      measuredQDCchannels.push_back(d.channel);
-	    }
-	  bool correctQDCchannels = (measuredQDCchannels.size() <= set.MQDC32_CHANNEL_CHARGE().size());// OR
-	  //bool correctQDCchannels = (measuredQDCchannels.size() == set.MQDC32_CHANNEL_CHARGE().size());// AND
-	  for (auto d : set.MQDC32_CHANNEL_CHARGE())
-	    {
-	      int count = 0;
-	      for (auto mc : measuredQDCchannels)
+	      // hits per channel, on the stack
+	      uint32_t measuredQDCchannels[32] = {0};
+	      for (auto & d : data)
 		{
-		  if (mc == d) ++count;
+		  ++measuredQDCchannels[d.channel & 31];
 		}
-	      correctQDCchannels = correctQDCchannels || (count==1);// OR
-	      //correctQDCchannels = correctQDCchannels && (count==1);// AND
-	    }
-	  // Here, correctQDCchannels should be true if good data
+	      bool correctQDCchannels = (data.size() <= set.MQDC32_CHANNEL_CHARGE().size());// OR
+	      //bool correctQDCchannels = (data.size() == set.MQDC32_CHANNEL_CHARGE().size());// AND
+	      for (auto d : set.MQDC32_CHANNEL_CHARGE())
+		{
+		  uint32_t count = measuredQDCchannels[d & 31];
+		  correctQDCchannels = correctQDCchannels || (count==1);// OR
+		  //correctQDCchannels = correctQDCchannels && (count==1);// AND
+		}
+	      // Here, correctQDCchannels should be true if good data
 
-	  std::vector<uint32_t> measuredTDCchannels;
-	  for (auto t : tm)
-	    {
-	      measuredTDCchannels.push_back(t.channel);
-	    }
-	  bool correctTDCchannels = (measuredTDCchannels.size() == set.VX1290A_CHANNEL_LE().size()+set.VX1290A_CHANNEL_MAX().size()) && set.UseTDC();
-	  for (auto d : set.VX1290A_CHANNEL_LE())
-	    {
-	      int count = 0;
-	      for (auto mt : measuredTDCchannels)
+	      uint32_t measuredTDCchannels[32] = {0};
+	      for (auto & t : tm)
 		{
-		  if (d == mt) ++count;
+		  ++measuredTDCchannels[t.channel & 31];
 		}
-	      correctTDCchannels = correctTDCchannels && (count==1);
-	    }
-	  for (auto d : set.VX1290A_CHANNEL_MAX())
-	    {
-	      int count = 0;
-	      for (auto mt : measuredTDCchannels)
+	      bool correctTDCchannels = (tm.size() == set.VX1290A_CHANNEL_LE().size()+set.VX1290A_CHANNEL_MAX().size()) && set.UseTDC();
+	      for (auto d : set.VX1290A_CHANNEL_LE())
 		{
-		  if (d == mt) ++count;
+		  correctTDCchannels = correctTDCchannels && (measuredTDCchannels[d & 31]==1);
 		}
-	      correctTDCchannels = correctTDCchannels && (count==1);
-	    }
-	  // Here, correctTDCchannels should be true if TDC is enabled and good data.
+	      for (auto d : set.VX1290A_CHANNEL_MAX())
+		{
+		  correctTDCchannels = correctTDCchannels && (measuredTDCchannels[d & 31]==1);
+		}
+	      // Here, correctTDCchannels should be true if TDC is enabled and good data.
 
-	  if (correctQDCchannels)
-	    {
-	      for (size_t id = 0; id < data.size(); ++id)
+	      if (correctQDCchannels)
 		{
-		  qdc_adc = data[id].adc;
-		  qdc_pC = qdc_adc*ADCtopC;
-		  qdc_overflow = data[id].overflow;
-		  qdc_channel = data[id].channel;
-		  qdc_timestamp = eoe.timestamp;
-		  qdc_charge = qdc_adc*ADCtopC;
-
-		  if (correctTDCchannels)
-		    {
-		      size_t tmlocLE, tmlocMAX;
-		      for (size_t it = 0; it < tm.size(); ++it)
-			{
-			  if (tm[it].channel == set.VX1290A_CHANNEL_LE()[id]) tmlocLE=it;
-			  else if (tm[it].channel == set.VX1290A_CHANNEL_MAX()[id]) tmlocMAX=it;
-			}
-		      tdc_tdc1 = tm[tmlocLE].tdc_meas;
-		      tdc_tdc2 = tm[tmlocMAX].tdc_meas;
-		      tdc_channel1 = tm[tmlocLE].channel;
-		      tdc_channel2 = tm[tmlocMAX].channel;
-		      tdc_timestamp = gtt.trig_time;
-		    }
-		  else
+		  for (size_t id = 0; id < data.size(); ++id)
 		    {
-		      tdc_tdc1 = 0;
-		      tdc_tdc2 = 0;
-		      tdc_channel1 = 0;
-		      tdc_channel2 = 0;
-		      tdc_timestamp = 0;
-		    }
-		  risetime = (std::max(tdc_tdc1,tdc_tdc2)-std::min(tdc_tdc1,tdc_tdc2))*0.025;
-
-		  now = std::chrono::system_clock::now();
-		  dp = floor<days>(now);
-		  ymd = year_month_day{dp};
-		  time = make_time(std::chrono::duration_cast<std::chrono::milliseconds>(now-dp));
-		  year = (int)(ymd.year());
-		  month = (unsigned)(ymd.month());
-		  day = (unsigned)(ymd.day());
-		  hour = time.hours().count();
-		  minute = time.minutes().count();
-		  second = time.seconds().count();
-		  millisecond = time.subseconds().count();
-		  
-		  if (!set.UseTDC() || (set.UseTDC() && correctTDCchannels)) tree->Fill();
-
-		  if (data[id].channel == set.MQDC32_CHANNEL_CHARGE()[0])
-		    {
-		      if (n == 0) 
+		      qdc_adc = data[id].adc;
+		      qdc_pC = qdc_adc*ADCtopC;
+		      qdc_overflow = data[id].overflow;
+		      qdc_channel = data[id].channel;
+		      qdc_timestamp = eoe.timestamp;
+		      qdc_charge = qdc_adc*ADCtopC;
+
+		      if (correctTDCchannels)
 			{
-			  mqdc = qdc_charge;
-			  sqdc = 0;
-			  mtdc = risetime;
-			  stdc = 0;
+			  size_t tmlocLE, tmlocMAX;
+			  for (size_t it = 0; it < tm.size(); ++it)
+			    {
+			      if (tm[it].channel == set.VX1290A_CHANNEL_LE()[id]) tmlocLE=it;
+			      else if (tm[it].channel == set.VX1290A_CHANNEL_MAX()[id]) tmlocMAX=it;
+			    }
+			  tdc_tdc1 = tm[tmlocLE].tdc_meas;
+			  tdc_tdc2 = tm[tmlocMAX].tdc_meas;
+			  tdc_channel1 = tm[tmlocLE].channel;
+			  tdc_channel2 = tm[tmlocMAX].channel;
+			  tdc_timestamp = gtt.trig_time;
 			}
 		      else
 			{
-			  mqdc_last = mqdc;
-			  mqdc = mqdc_last + (qdc_charge - mqdc_last)/n;
-			  sqdc_last = sqdc;
-			  sqdc = sqdc_last + (qdc_charge - mqdc_last)*(qdc_charge - mqdc);
-			  mtdc_last = mtdc;
-			  mtdc = mtdc_last + (risetime - mtdc_last)/n;
-			  stdc_last = stdc;
-			  stdc = stdc_last + (risetime - mtdc_last)*(risetime - mtdc);
+			  tdc_tdc1 = 0;
+			  tdc_tdc2 = 0;
+			  tdc_channel1 = 0;
+			  tdc_channel2 = 0;
+			  tdc_timestamp = 0;
 			}
-		      
-		      if (set.UseInteractive())
+		      risetime = (std::max(tdc_tdc1,tdc_tdc2)-std::min(tdc_tdc1,tdc_tdc2))*0.025;
+
+		      if (!set.UseTDC() || (set.UseTDC() && correctTDCchannels)) tree->Fill();
+
+		      if (data[id].channel == set.MQDC32_CHANNEL_CHARGE()[0])
 			{
-			  windowQDC.push_back(qdc_charge);
-			  windowTDC.push_back(risetime);
-			  if (windowQDC.size() > set.Interactive())
+			  if (n == 0) 
 			    {
-			      windowQDC.pop_front();
-			      windowTDC.pop_front();
-			      if (n % set.Interactive() == 0)
+			      mqdc = qdc_charge;
+			      sqdc = 0;
+			      mtdc = risetime;
+			      stdc = 0;
+			    }
+			  else
+			    {
+			      mqdc_last = mqdc;
+			      mqdc = mqdc_last + (qdc_charge - mqdc_last)/n;
+			      sqdc_last = sqdc;
+			      sqdc = sqdc_last + (qdc_charge - mqdc_last)*(qdc_charge - mqdc);
+			      mtdc_last = mtdc;
+			      mtdc = mtdc_last + (risetime - mtdc_last)/n;
+			      stdc_last = stdc;
+			      stdc = stdc_last + (risetime - mtdc_last)*(risetime - mtdc);
+			    }
+		      
+			  if (set.UseInteractive())
+			    {
+			      windowQDC[nwindow % windowQDC.size()] = qdc_charge;
+			      windowTDC[nwindow % windowTDC.size()] = risetime;
+			      if (++nwindow > set.Interactive())
 				{
-				  std::cout << "\rPulse " << n << ": Charge (pC) = " << std::setw(7) << std::setprecision(2) << std::fixed << TMath::Mean(windowQDC.begin(),windowQDC.end()) << " +/- " << std::setw(7) << std::setprecision(2) << std::fixed << TMath::StdDev(windowQDC.begin(),windowQDC.end()) << "," << std::flush;
-				  if (set.UseTDC()) std::cout << "  Rise Time (ns) = " << std::setw(6) << std::setprecision(2) << std::fixed << TMath::Mean(windowTDC.begin(),windowTDC.end()) << " +/- " << std::setw(6) << std::setprecision(2) << std::fixed << TMath::StdDev(windowTDC.begin(),windowTDC.end()) << "," << std::flush;
-				  after_time = std::chrono::high_resolution_clock::now();
-				  double interactive_duration = std::chrono::duration_cast<std::chrono::milliseconds>(after_time - before_time).count();
-				  std::cout << "  Record Frequency = " << 1000*set.Interactive() / interactive_duration << " Hz." << std::flush;
-				  before_time = after_time;
+				  if (n % set.Interactive() == 0)
+				    {
+				      std::cout << "\rPulse " << n << ": Charge (pC) = " << std::setw(7) << std::setprecision(2) << std::fixed << TMath::Mean(windowQDC.begin(),windowQDC.end()) << " +/- " << std::setw(7) << std::setprecision(2) << std::fixed << TMath::StdDev(windowQDC.begin(),windowQDC.end()) << "," << std::flush;
+				      if (set.UseTDC()) std::cout << "  Rise Time (ns) = " << std::setw(6) << std::setprecision(2) << std::fixed << TMath::Mean(windowTDC.begin(),windowTDC.end()) << " +/- " << std::setw(6) << std::setprecision(2) << std::fixed << TMath::StdDev(windowTDC.begin(),windowTDC.end()) << "," << std::flush;
+				      after_time = std::chrono::high_resolution_clock::now();
+				      double interactive_duration = std::chrono::duration_cast<std::chrono::milliseconds>(after_time - before_time).count();
+				      std::cout << "  Record Frequency = " << 1000*set.Interactive() / interactive_duration << " Hz." << std::flush;
+				      before_time = after_time;
+				    }
 				}
 			    }
+			  if ((correctQDCchannels && !set.UseTDC()) || (correctQDCchannels && set.UseTDC() && correctTDCchannels)) ++n;
 			}
-		      if ((correctQDCchannels && !set.UseTDC()) || (correctQDCchannels && set.UseTDC() && correctTDCchannels)) ++n;
-		      usleep(set.Delay());    
 		    }
 		}
+
+	      ///////////////////////////////////////////
+	      // Finished writing data to output TTree //
+	      ///////////////////////////////////////////
+
+	      // Increment
+	      ++nT;
+	    }
+	  if (n >= set.NumEvents()) queue.Stop();
+	}
+    });
+
+  try
+    {
+      std::cout << "Initializing V1718..." << std::endl;
+      auto setup_time = std::chrono::steady_clock::now();
+      checkApiCall(CAENVME_Init(cvV1718, 0, set.VX1718_USB_CHANNEL(), &handle),"CAENVME_Init");
+      checkApiCall(CAENVME_SystemReset(handle),"CAENVME_SystemReset");
+      // The modules are polled until they answer instead of sleeping. The
+      // V1718 does one bus cycle at a time, so the only overlap is the
+      // VX1290A setup running while the MQDC32 does its soft reset.
+      std::cout << "             MQDC32..." << std::endl;
+      checkApiCall(MQDC32_Reset(handle),"MQDC32_Reset");
+      if (set.UseTDC())
+	{
+	  std::cout << "             VX1290A..." << std::endl;
+	  checkApiCall(VX1290A_Setup(handle,set),"VX1290A_Setup");
+	}
+      checkApiCall(MQDC32_Setup(handle,set),"MQDC32_Setup");
+      if (set.UseCrate())
+	{
+	  std::cout << "             CBLT chain..." << std::endl;
+	  checkApiCall(CBLT_Setup(handle,set),"CBLT_Setup");
+	  checkApiCall(CBLT_Start(handle),"CBLT_Start");
+	}
+      else
+	{
+	  if (set.UseTDC()) checkApiCall(VX1290A_Clear(handle),"VX1290A_Clear");
+	  checkApiCall(MQDC32_Start(handle),"MQDC32_Start");
+	}
+      if (irqmode == IRQ_WAIT && CAENVME_IRQEnable(handle, cvIRQ1) != cvSuccess) irqmode = IRQ_POLL;
+      std::cout << "Setup took " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - setup_time).count() << " ms" << std::endl;
+
+      start_time = std::chrono::high_resolution_clock::now();
+      cpu_start = ThreadCPUTime();
+      armed = true;
+      auto rearm_time = start_time;
+      
+      while (!queue.Stopped() && !stopRequested)
+	{
+	  // The MQDC32 emits an IRQ1 when data is ready, so wait for it,
+	  // looking at Ctrl+C after every timeout
+	  auto wait_start = std::chrono::high_resolution_clock::now();
+	  CVErrorCodes irq;
+	  do
+	    {
+	      irq = IRQ_Wait(handle, cvIRQ1, IRQ_TIMEOUT_MS, &irqmode);
+	    } while (irq == cvTimeoutError && !stopRequested && !queue.Stopped());
+	  if (stopRequested || queue.Stopped()) break;
+	  checkApiCall(irq,"IRQ_Wait");
+	  auto irq_time = std::chrono::high_resolution_clock::now();
+	  irq_wait.Fill(std::chrono::duration<double>(irq_time - wait_start).count());
+	  
+	  // When the MQDC32 IRQ1 is found, acknowledge it and continue reading data
+	  uint32_t vector;
+	  checkApiCall(CAENVME_IACKCycle(handle,cvIRQ1,&vector,cvD16),"CAENVME_IACKCycle");
+
+	  // Read everything the MQDC32 holds (one event, or a batch in
+	  // multi-event mode) into a free slot of the queue
+	  RawReadout * raw = queue.Claim();
+	  ++nIRQ;
+	  auto readout_start = std::chrono::high_resolution_clock::now();
+	  if (set.UseCrate())
+	    {
+	      // both modules in one chained transfer
+	      checkApiCall(CBLT_Read_Buffer(handle,set,&raw->cblt,&raw->tdc),"CBLT_Read_Buffer");
+	      qdc_readout_time += std::chrono::high_resolution_clock::now() - readout_start;
 	    }
+	  else
+	    {
+	      checkApiCall(MQDC32_Read_Buffer(handle,set,&raw->qdc),"MQDC32_Read_Buffer");
+	      qdc_readout_time += std::chrono::high_resolution_clock::now() - readout_start;
 
-	  ///////////////////////////////////////////
-	  // Finished writing data to output TTree //
-	  ///////////////////////////////////////////
+	      // Read the same number of events from the VX1290A (which was
+	      // triggered by the output of MQDC32)
+	      if (set.UseTDC())
+		{
+		  readout_start = std::chrono::high_resolution_clock::now();
+		  uint32_t nqdc = MQDC32_Count_Events(raw->qdc);
+		  uint32_t ntdc = nqdc;
+		  // the builder takes whatever the TDC has, not one per MQDC32
+		  // event, so it never waits for an event the TDC lost
+		  if (set.UseBuilder())
+		    {
+		      checkApiCall(VX1290A_Events_Ready(handle,set,&ntdc),"VX1290A_Events_Ready");
+		      if (ntdc > nqdc+BUILDER_WINDOW) ntdc = nqdc+BUILDER_WINDOW;
+		    }
+		  checkApiCall(VX1290A_Read_Buffer(handle,ntdc,set,&raw->tdc),"VX1290A_Read_Buffer");
+		  tdc_readout_time += std::chrono::high_resolution_clock::now() - readout_start;
+		}
+	    }
+	  // the one time stamp of everything in this readout
+	  raw->time = std::chrono::system_clock::now();
+	  queue.Publish();
+	  irq_latency.Fill(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - irq_time).count());
 
+	  // -d keeps readouts at least that far apart; the time spent since
+	  // the last one counts towards it
+	  if (set.Delay() > 0) std::this_thread::sleep_until(rearm_time + std::chrono::microseconds(set.Delay()));
 
-	  // Reset data buffer of MQDC32
+	  // Reset data buffer of MQDC32 (in multi-event mode this re-arms the IRQ)
 	  checkApiCall(MQDC32_Reset_Data_Buffer(handle),"MQDC32_Reset_Data_Buffer");
 	  // Do not reset VX1290A here. No point...
-
-	  // Increment
-	  ++nT;
+	  rearm_time = std::chrono::high_resolution_clock::now();
 	}
       checkApiCall(CAENVME_End(handle),"CAENVME_End");
     }
@@ -396,9 +563,41 @@ int main(int argc, char ** argv)
       std::cout << err.what() << std::endl;
       checkApiCall(CAENVME_End(handle),"CAENVME_End");
     }
+  catch (std::exception & err)
+    {
+      std::cout << err.what() << std::endl;
+      CAENVME_End(handle);
+    }
+  catch (...)
+    {
+      std::cout << "Unknown error" << std::endl;
+      CAENVME_End(handle);
+    }
+  // the readout loop is over, however it ended
+  if (armed)
+    {
+      run_time = std::chrono::high_resolution_clock::now() - start_time;
+      cpu_time = ThreadCPUTime() - cpu_start;
+    }
+  writer.Join();
   
+  if (stopRequested) std::cout << "\nStopped by Ctrl+C";
   std::cout << "\nRead " << n << " events" << std::endl;
   std::cout << "Error in " << nT-n << " events" << std::endl;
+  if (nT > 0)
+    {
+      std::cout << (set.UseCrate() ? "CBLT readout (" : "MQDC32 readout (") << ReadoutModeName(set.Readout()) << "): " << std::setprecision(1) << std::fixed << 1e6*qdc_readout_time.count()/nT << " us/event, "
+		<< std::setprecision(0) << nT/qdc_readout_time.count() << " events/s readout only, " << nT/run_time.count() << " events/s overall, "
+		<< std::setprecision(1) << (double)nT/nIRQ << " events per IRQ" << std::endl;
+      std::cout << "IRQ (" << IRQModeName(irqmode) << "): readout thread CPU time " << std::setprecision(2) << std::fixed << cpu_time << " s, "
+		<< std::setprecision(0) << 100*cpu_time/run_time.count() << "% of the run, " << std::setprecision(1) << 1e6*cpu_time/nT << " us per event" << std::endl;
+      if (set.UseBuilder()) builder.Print();
+      queue.Print();
+      irq_wait.Print("Time waiting for the IRQ");
+      irq_latency.Print("IRQ to readout done");
+      if (set.UseTDC() && !set.UseCrate())
+	std::cout << "VX1290A readout (" << ReadoutModeName(set.Readout()) << "): " << std::setprecision(1) << std::fixed << 1e6*tdc_readout_time.count()/nT << " us/event" << std::endl;
+    }
 
   std::cout << "Mean Charge (pC) = " << std::setw(7) << std::setprecision(2) << std::fixed << mqdc << " +/- " << std::setw(7) << std::setprecision(2) << std::fixed << TMath::Sqrt((n>1)?sqdc/(n-1):0) << "  Mean Rise Time (ns) = " << std::setw(6) << std::setprecision(2) << std::fixed << mtdc << " +/- " << std::setw(6) << std::setprecision(2) << std::fixed << TMath::Sqrt((n>1)?stdc/(n-1):0) << std::endl;
 
@@ -410,6 +609,7 @@ int main(int argc, char ** argv)
   std::cout << "Finished run: " << (int)(ymd.year()) << "/" << (unsigned)(ymd.month()) << "/" << (unsigned)(ymd.day()) << " " << (unsigned)(time.hours().count()) << ":" << (unsigned)(time.minutes().count()) << ":" << (unsigned)(time.seconds().count()) << std::endl;
 
   tree->Write();
+  std::cout << "Wrote " << tree->GetEntries() << " entries to " << filename << std::endl;
   fileout->Close();
   
   return 0;
@@ -3,6 +3,9 @@
 
 #include "MQDC32.h"
 #include "VX1290A.h"
+#include "CBLT.h"
+#include "EventBuilder.h"
+#include "ReadoutQueue.h"
 
 #include "Common.h"
 #include "User_Settings.h"
@@ -0,0 +1,97 @@
+#include "ReadoutQueue.h"
+
+ReadoutQueue::ReadoutQueue(const Settings & set)
+  : readouts(0), highWater(0), fullWaits(0), fullTime(0),
+    slot(READOUT_QUEUE_SLOTS), head(0), tail(0), finished(false), stopped(false)
+{
+  // give back the buffers this readout mode never fills
+  for (auto & s : slot)
+    {
+      if (set.UseCrate())
+	{
+	  std::vector<uint32_t>().swap(s.qdc.word);
+	  std::vector<uint32_t>().swap(s.tdc.word);
+	}
+      else
+	{
+	  std::vector<uint32_t>().swap(s.cblt.word);
+	  if (!set.UseTDC()) std::vector<uint32_t>().swap(s.tdc.word);
+	}
+    }
+}
+
+RawReadout * ReadoutQueue::Claim()
+{
+  uint64_t t = tail.load(std::memory_order_relaxed);
+  if (t - head.load(std::memory_order_acquire) < READOUT_QUEUE_SLOTS) return &slot[t % READOUT_QUEUE_SLOTS];
+
+  // the writer is behind: wait for it, as IRQ_Wait polls
+  ++fullWaits;
+  auto start = std::chrono::steady_clock::now();
+  uint32_t backoff = READOUT_QUEUE_MIN_US;
+  while (t - head.load(std::memory_order_acquire) >= READOUT_QUEUE_SLOTS)
+    {
+      usleep(backoff);
+      if (backoff < READOUT_QUEUE_MAX_US) backoff *= 2;
+    }
+  fullTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return &slot[t % READOUT_QUEUE_SLOTS];
+}
+
+void ReadoutQueue::Publish()
+{
+  uint64_t t = tail.load(std::memory_order_relaxed) + 1;
+  tail.store(t, std::memory_order_release);
+  ++readouts;
+  uint64_t used = t - head.load(std::memory_order_acquire);
+  if (used > highWater) highWater = used;
+}
+
+void ReadoutQueue::Finish()
+{
+  finished.store(true, std::memory_order_release);
+}
+
+RawReadout * ReadoutQueue::Next()
+{
+  uint64_t h = head.load(std::memory_order_relaxed);
+  uint32_t backoff = READOUT_QUEUE_MIN_US;
+  while (true)
+    {
+      // finished is set after the last Publish, so look at it first
+      bool last = finished.load(std::memory_order_acquire);
+      if (h < tail.load(std::memory_order_acquire)) return &slot[h % READOUT_QUEUE_SLOTS];
+      if (last) return NULL;
+      usleep(backoff);
+      if (backoff < READOUT_QUEUE_MAX_US) backoff *= 2;
+    }
+}
+
+void ReadoutQueue::Release()
+{
+  head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void ReadoutQueue::Stop()
+{
+  stopped.store(true, std::memory_order_release);
+}
+
+void ReadoutQueue::Print()
+{
+  std::cout << "Readout queue: " << readouts << " readouts, high-water mark " << highWater << " of " << READOUT_QUEUE_SLOTS
+	    << " slots, full " << fullWaits << " times (" << std::setprecision(1) << std::fixed << 1e3*fullTime << " ms waiting)" << std::endl;
+}
+
+void WriterThread::Join()
+{
+  queue.Finish();
+  if (thread.joinable()) thread.join();
+}
+
+void WriterThread::Failed(const char * what)
+{
+  std::cout << "\nError in writer thread: " << what << std::endl;
+  queue.Stop();
+  while (queue.Next() != NULL) queue.Release();
+}
@@ -0,0 +1,81 @@
+#ifndef READOUTQUEUE_H
+#define READOUTQUEUE_H
+
+#include "MQDC32.h"
+#include "VX1290A.h"
+#include "CBLT.h"
+
+#include "Common.h"
+#include "User_Settings.h"
+
+#define READOUT_QUEUE_SLOTS 256      /* readouts in flight between the readout and writer threads */
+#define READOUT_QUEUE_MIN_US 10      /* backoff while the queue is full or empty ... */
+#define READOUT_QUEUE_MAX_US 1000    /* ... growing up to this */
+
+// What one IRQ brought over the bus, not yet decoded: the MQDC32 and
+// VX1290A words, or in crate mode the chained transfer, and the time the
+// readout finished.
+struct RawReadout {
+  MQDC32_Buffer qdc;
+  VX1290A_Buffer tdc;
+  CBLT_Buffer cblt;
+  std::chrono::system_clock::time_point time;
+};
+
+// Ring of READOUT_QUEUE_SLOTS RawReadouts from the thread reading the VME
+// bus (one producer) to the thread decoding the events and filling the
+// tree (one consumer). The readout fills the slot at the tail and
+// publishes it, the writer decodes the slot at the head and releases it.
+// The two counters are the only shared state, so neither side locks, and
+// either only waits when the ring is full or empty. The slots are
+// allocated once, with only the buffers the readout mode uses.
+struct ReadoutQueue {
+  ReadoutQueue(const Settings & set);
+  // readout thread
+  RawReadout * Claim();      // the next free slot, waiting while the ring is full
+  void Publish();            // hand the claimed slot to the writer
+  void Finish();             // no more readouts will come
+  bool Stopped() const { return stopped.load(std::memory_order_acquire); }
+  // writer thread
+  RawReadout * Next();       // the oldest readout, waiting for one; NULL once finished and empty
+  void Release();            // the slot from Next() can be filled again
+  void Stop();               // enough events, the readout may end
+  void Print();
+
+  uint64_t readouts;
+  uint64_t highWater;        // most slots in use at once
+  uint64_t fullWaits;        // readouts that found the ring full
+  double fullTime;           // seconds the readout waited for a slot
+
+ private:
+  std::vector<RawReadout> slot;
+  std::atomic<uint64_t> head;     // next slot to decode, moved by the writer
+  std::atomic<uint64_t> tail;     // next slot to fill, moved by the readout
+  std::atomic<bool> finished;
+  std::atomic<bool> stopped;
+};
+
+// The writer thread, joined however the readout ends, so an exception in
+// the readout thread never destroys it while it runs. An exception in the
+// writer is printed and stops the readout; the writer then keeps releasing
+// slots until the queue is finished, so the readout is never left waiting
+// for a free one.
+class WriterThread {
+ public:
+  template <class F> WriterThread(ReadoutQueue & q, F f)
+    : queue(q),
+      thread([this,f]() mutable
+	     {
+	       try { f(); }
+	       catch (std::exception & e) { Failed(e.what()); }
+	       catch (...) { Failed("unknown exception"); }
+	     }) {}
+  ~WriterThread() { Join(); }
+  void Join();               // finish the queue and wait for the writer
+ private:
+  void Failed(const char * what);
+  ReadoutQueue & queue;
+  std::thread thread;
+};
+
+#endif
@@ -6,15 +6,23 @@ Settings::Settings()
     setDelay(false),
     setInteractive(false),
     setTDC(false),
+    setConfigFile(false),
     verb(false),
     num(1),
     del(0),
     inter(1),
-    tdc(false)
+    tdc(false),
+    readout(READOUT_BLT),
+    multi(1),
+    crate(false),
+    irq(IRQ_WAIT),
+    builder(false),
+    config_mqdc32_channel_mask(0),
+    config_vx1290a_channel_mask(0)
 {
 }
 
-bool Settings::IsValid()
+bool Settings::IsValid() const
 {
   // verbose is optional, so not a requirement for validation
   return (setNumEvents && setDelay && setConfigFile);
@@ -57,36 +65,86 @@ void Settings::SetConfigFile(std::string filename)
   ReadConfigFile(filename);
 }
 
-bool Settings::Verbose()
+void Settings::SetReadout(ReadoutMode r)
+{
+  readout = r;
+}
+
+void Settings::SetMultiEvent(uint32_t m)
+{
+  multi = m;
+}
+
+void Settings::SetUseCrate(bool c)
+{
+  crate = c;
+}
+
+void Settings::SetIRQ(IRQMode m)
+{
+  irq = m;
+}
+
+void Settings::SetUseBuilder(bool b)
+{
+  builder = b;
+}
+
+bool Settings::Verbose() const
 {
   return verb;
 }
 
-uint32_t Settings::NumEvents()
+uint32_t Settings::NumEvents() const
 {
   return num;
 }
 
-uint32_t Settings::Delay()
+uint32_t Settings::Delay() const
 {
   return del;
 }
 
-uint32_t Settings::Interactive()
+uint32_t Settings::Interactive() const
 {
   return inter;
 }
 
-bool Settings::UseInteractive()
+bool Settings::UseInteractive() const
 {
   return setInteractive;
 }
 
-bool Settings::UseTDC()
+bool Settings::UseTDC() const
 {
   return tdc;
 }
 
+ReadoutMode Settings::Readout() const
+{
+  return readout;
+}
+
+uint32_t Settings::MultiEvent() const
+{
+  return multi;
+}
+
+bool Settings::UseCrate() const
+{
+  return crate;
+}
+
+IRQMode Settings::IRQ() const
+{
+  return irq;
+}
+
+bool Settings::UseBuilder() const
+{
+  return builder;
+}
+
 void Settings::ReadConfigFile(std::string fname="config.txt")
 {
   std::string line;
@@ -154,6 +212,15 @@ void Settings::ReadConfigFile(std::string fname="config.txt")
 	}
     }
 
+  config_mqdc32_channel_mask = 0;
+  for (auto c : config_mqdc32_channel_charge)
+    if (c < 32) config_mqdc32_channel_mask |= 1u << c;
+  config_vx1290a_channel_mask = 0;
+  for (auto c : config_vx1290a_channel_le)
+    if (c < 32) config_vx1290a_channel_mask |= 1u << c;
+  for (auto c : config_vx1290a_channel_max)
+    if (c < 32) config_vx1290a_channel_mask |= 1u << c;
+
   std::cout << "Reading channels from MQDC32: ";
   for (auto c : MQDC32_CHANNEL_CHARGE())
     {
@@ -11,6 +11,11 @@
 //#define VX1290A_WINDOW_WIDTH 0x0014  // 0x0014 * 25ns = 500ns
 //#define VX1290A_WINDOW_OFFSET 0xfff6 // 0xfff6 * 25ns = -250ns
 
+// Chained block transfer (-crate): A31..A24 of the address both modules
+// answer as a chain, for CBLT reads and for MCST writes. The VX1290A is the
+// first module of the chain, so it must sit left of the MQDC32.
+#define CBLT_MCST_ADDRESS 0xAA000000
+
 //#define VX1718_USB_CHANNEL 0 // Most likely 0 or 1. To find out easily, use the CAENVMElib/sample program and test different <VMEdevice> values.
 
 #include "Common.h"
@@ -19,29 +24,42 @@ class Settings
 {
  public:
   Settings();
-  bool IsValid();
+  bool IsValid() const;
   void SetVerbose(bool v);
   void SetNumEvents(uint32_t n);
   void SetDelay(uint32_t d);
   void SetInteractive(uint32_t i);
   void SetUseTDC(bool d);
   void SetConfigFile(std::string filename);
-  bool Verbose();
-  uint32_t NumEvents();
-  uint32_t Delay();
-  uint32_t Interactive();
-  bool UseInteractive();
-  bool UseTDC();
+  void SetReadout(ReadoutMode r);
+  void SetMultiEvent(uint32_t m);
+  void SetUseCrate(bool c);
+  void SetIRQ(IRQMode m);
+  void SetUseBuilder(bool b);
+  bool Verbose() const;
+  uint32_t NumEvents() const;
+  uint32_t Delay() const;
+  uint32_t Interactive() const;
+  bool UseInteractive() const;
+  bool UseTDC() const;
+  ReadoutMode Readout() const;
+  uint32_t MultiEvent() const;
+  bool UseCrate() const;
+  IRQMode IRQ() const;
+  bool UseBuilder() const;
 
   void ReadConfigFile(std::string fname);
-  uint32_t VX1718_USB_CHANNEL() { return config_vx1718_usb_channel; }
+  uint32_t VX1718_USB_CHANNEL() const { return config_vx1718_usb_channel; }
   //uint32_t MQDC32_BASE() { return config_mqdc32_base; }
-  std::vector<uint32_t> MQDC32_CHANNEL_CHARGE() { return config_mqdc32_channel_charge; }
+  const std::vector<uint32_t> & MQDC32_CHANNEL_CHARGE() const { return config_mqdc32_channel_charge; }
   //uint32_t VX1290A_BASE() { return config_vx1290a_base; }
-  std::vector<uint32_t> VX1290A_CHANNEL_LE() { return config_vx1290a_channel_le; }
-  std::vector<uint32_t> VX1290A_CHANNEL_MAX() { return config_vx1290a_channel_max; }
-  uint32_t VX1290A_WINDOW_WIDTH() { return config_vx1290a_window_width; }
-  uint32_t VX1290A_WINDOW_OFFSET() { return config_vx1290a_window_offset; }
+  const std::vector<uint32_t> & VX1290A_CHANNEL_LE() const { return config_vx1290a_channel_le; }
+  const std::vector<uint32_t> & VX1290A_CHANNEL_MAX() const { return config_vx1290a_channel_max; }
+  uint32_t VX1290A_WINDOW_WIDTH() const { return config_vx1290a_window_width; }
+  uint32_t VX1290A_WINDOW_OFFSET() const { return config_vx1290a_window_offset; }
+  // bit c set if channel c is read (VX1290A: LE or MAX), for the decoders
+  uint32_t MQDC32_CHANNEL_MASK() const { return config_mqdc32_channel_mask; }
+  uint32_t VX1290A_CHANNEL_MASK() const { return config_vx1290a_channel_mask; }
   
  private:
   
@@ -57,6 +75,11 @@ class Settings
   uint32_t del;
   uint32_t inter;
   bool tdc;
+  ReadoutMode readout;
+  uint32_t multi;
+  bool crate;
+  IRQMode irq;
+  bool builder;
 
   uint32_t config_vx1718_usb_channel;
   uint32_t config_mqdc32_base;
@@ -66,6 +89,8 @@ class Settings
   std::vector<uint32_t> config_vx1290a_channel_max;
   uint32_t config_vx1290a_window_width;
   uint32_t config_vx1290a_window_offset;
+  uint32_t config_mqdc32_channel_mask;
+  uint32_t config_vx1290a_channel_mask;
 };
 
 #endif
@@ -10,26 +10,41 @@ CVErrorCodes VX1290A_Read_Word(int32_t Handle, uint32_t * data)
   return CAENVME_ReadCycle(Handle, VX1290A_BASE + VX1290A_OUT_BUFFER_ADD, data, cvA24_U_DATA, cvD32);
 }
 
-CVErrorCodes VX1290A_Read_OpCode(int32_t Handle, uint32_t * opaddress)
+CVErrorCodes VX1290A_Read_Register32(int32_t Handle, uint32_t address, uint32_t * data)
 {
-  int time = 0;
+  return CAENVME_ReadCycle(Handle, VX1290A_BASE + address, data, cvA24_U_DATA, cvD32);
+}
+
+// Wait for one of the micro controller handshake bits (VX1290A_WRITE_OK,
+// VX1290A_READ_OK), polling with a growing backoff for up to
+// VX1290A_MICRO_TIMEOUT_MS
+static bool VX1290A_Wait_Handshake(int32_t Handle, uint32_t bit, CVErrorCodes * ret)
+{
+  Backoff wait(VX1290A_MICRO_TIMEOUT_MS);
   uint32_t rdata;
-  CVErrorCodes ret;
   do {
-    ret = VX1290A_Read_Register(Handle, VX1290A_MICRO_HND_ADD, &rdata);
-    if (ret != cvSuccess) return ret;
-    ++time;
-  } while (!(rdata & VX1290A_READ_OK) && time < 10000);
-  if (time >= 10000)
+    *ret = VX1290A_Read_Register(Handle, VX1290A_MICRO_HND_ADD, &rdata);
+    if (*ret != cvSuccess) return true;
+    if (rdata & bit) return true;
+  } while (wait.Wait());
+  return false;
+}
+
+CVErrorCodes VX1290A_Read_OpCode(int32_t Handle, uint32_t * opaddress)
+{
+  CVErrorCodes ret;
+  if (!VX1290A_Wait_Handshake(Handle, VX1290A_READ_OK, &ret))
     {
       throw std::runtime_error("Timeout reading READ_OK bit");
     }
+  if (ret != cvSuccess) return ret;
   return VX1290A_Read_Register(Handle, VX1290A_MICRO_ADD, opaddress);
 }
 
+// Send a READ_* opcode and read the first word of its answer
 CVErrorCodes VX1290A_TouchRead_OpCode(int32_t Handle, uint32_t opaddress, uint32_t * data)
 {
-  CVErrorCodes ret = VX1290A_Read_OpCode(Handle, &opaddress);
+  CVErrorCodes ret = VX1290A_Write_OpCode(Handle, opaddress);
   if (ret != cvSuccess) return ret;
   return VX1290A_Read_OpCode(Handle, data);
 }
@@ -41,18 +56,12 @@ CVErrorCodes VX1290A_Write_Register(int32_t Handle, uint32_t address, uint32_t d
 
 CVErrorCodes VX1290A_Write_OpCode(int32_t Handle, uint32_t opaddress)
 {
-  int time = 0;
-  uint32_t rdata;
   CVErrorCodes ret;
-  do {
-    ret = VX1290A_Read_Register(Handle, VX1290A_MICRO_HND_ADD, &rdata);
-    if (ret != cvSuccess) return ret;
-    ++time;
-  } while (!(rdata & VX1290A_WRITE_OK) && time < 10000);
-  if (time >= 10000)
+  if (!VX1290A_Wait_Handshake(Handle, VX1290A_WRITE_OK, &ret))
     {
       throw std::runtime_error("Timeout reading WRITE_OK bit");
     }
+  if (ret != cvSuccess) return ret;
   return VX1290A_Write_Register(Handle, VX1290A_MICRO_ADD, opaddress);
 }
 
@@ -63,47 +72,124 @@ CVErrorCodes VX1290A_TouchWrite_OpCode(int32_t Handle, uint32_t opaddress, uint3
   return VX1290A_Write_OpCode(Handle, data);
 }
 
-CVErrorCodes VX1290A_Setup(int32_t Handle, Settings set)
+// After a reset the micro controller takes a while to load its
+// configuration and does not take opcodes (nor, briefly, VME cycles) until
+// it is done. Poll for WRITE_OK for up to VX1290A_RESET_TIMEOUT_MS.
+CVErrorCodes VX1290A_Wait_Ready(int32_t Handle)
+{
+  Backoff wait(VX1290A_RESET_TIMEOUT_MS);
+  do {
+    uint32_t rdata;
+    CVErrorCodes ret = VX1290A_Read_Register(Handle, VX1290A_MICRO_HND_ADD, &rdata);
+    if (ret != cvSuccess && ret != cvBusError) return ret;
+    if (ret == cvSuccess && (rdata & VX1290A_WRITE_OK)) return cvSuccess;
+  } while (wait.Wait());
+  return cvTimeoutError;
+}
+
+// Read back the settings VX1290A_Setup makes
+CVErrorCodes VX1290A_Read_Config(int32_t Handle, VX1290A_Config * cfg)
+{
+  uint32_t lo, hi;
+  checkApiCall(VX1290A_TouchRead_OpCode(Handle, VX1290A_READ_ACQ_MOD_OPCODE, &cfg->acq_mode),"VX1290A_Read_Config: Acquisition Mode");
+  cfg->acq_mode &= 0x1;
+  checkApiCall(VX1290A_TouchRead_OpCode(Handle, VX1290A_READ_TRG_CONF_OPCODE, &cfg->win_width),"VX1290A_Read_Config: Trigger Configuration");
+  checkApiCall(VX1290A_Read_OpCode(Handle, &cfg->win_offset),"VX1290A_Read_Config: Window Offset");
+  checkApiCall(VX1290A_Read_OpCode(Handle, &cfg->sw_margin),"VX1290A_Read_Config: Extra Search Margin");
+  checkApiCall(VX1290A_Read_OpCode(Handle, &cfg->rej_margin),"VX1290A_Read_Config: Reject Margin");
+  checkApiCall(VX1290A_Read_OpCode(Handle, &cfg->sub_trg),"VX1290A_Read_Config: Trigger Time Subtraction");
+  cfg->win_width &= 0xffff;
+  cfg->win_offset &= 0xffff;
+  cfg->sub_trg &= 0x1;
+  checkApiCall(VX1290A_TouchRead_OpCode(Handle, VX1290A_READ_DETECTION_OPCODE, &cfg->detection),"VX1290A_Read_Config: Edge Detection");
+  cfg->detection &= 0x3;
+  checkApiCall(VX1290A_TouchRead_OpCode(Handle, VX1290A_READ_RES_OPCODE, &cfg->lsb),"VX1290A_Read_Config: Resolution");
+  cfg->lsb &= 0x3;
+  checkApiCall(VX1290A_TouchRead_OpCode(Handle, VX1290A_READ_EN_PATTERN_OPCODE, &lo),"VX1290A_Read_Config: Enable Pattern");
+  checkApiCall(VX1290A_Read_OpCode(Handle, &hi),"VX1290A_Read_Config: Enable Pattern");
+  cfg->enable = (lo & 0xffff) | (hi & 0xffff) << 16;
+  return cvSuccess;
+}
+
+// Put the module in trigger matching mode with the window, edge detection,
+// resolution and channels of the settings. The micro controller keeps its
+// configuration (and may load a saved one after a reset), so it is read
+// back first and only the settings that differ are sent.
+CVErrorCodes VX1290A_Setup(int32_t Handle, const Settings & set)
 {
+  checkApiCall(VX1290A_Wait_Ready(Handle),"VX1290A_Setup: Wait Ready");
+
   // Set event BERR enable (writing to control register automatically clears the module)
   uint32_t ctrl;
   checkApiCall(VX1290A_Read_Register(Handle, VX1290A_CONTROL_ADD, &ctrl),"Read control register");
   std::bitset<16> ctrlbit(ctrl);
   ctrlbit.set(0);
   ctrlbit.set(9);
+  // Block readout takes the event sizes from the event FIFO
+  if (set.Readout() != READOUT_WORD) ctrlbit.set(8);
   ctrl = ctrlbit.to_ulong();
   checkApiCall(VX1290A_Write_Register(Handle, VX1290A_CONTROL_ADD, ctrl),"Write control register");
+
+  VX1290A_Config cfg;
+  checkApiCall(VX1290A_Read_Config(Handle, &cfg),"VX1290A_Read_Config");
+  if (set.Verbose()) cfg.Print();
+  uint32_t sent = 0;
   
   //Set Acquisition mode
-  checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_TRG_MATCH_OPCODE),"VX1290A_Write_OpCode: Trigger Mode"); 
+  if (cfg.acq_mode != 1)
+    {
+      checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_TRG_MATCH_OPCODE),"VX1290A_Write_OpCode: Trigger Mode"); 
+      ++sent;
+    }
   
   //Set Window Width to 0x7d0 * 25ns = 50us
-  checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_WIN_WIDTH_OPCODE,set.VX1290A_WINDOW_WIDTH()),"VX1290A_TouchWriteOpCode: Set Window Width");
+  if (cfg.win_width != (set.VX1290A_WINDOW_WIDTH() & 0xffff))
+    {
+      checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_WIN_WIDTH_OPCODE,set.VX1290A_WINDOW_WIDTH()),"VX1290A_TouchWriteOpCode: Set Window Width");
+      ++sent;
+    }
   
   //Set window offset to 0xfc18 * 25ns = -25us
-  checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_WIN_OFFSET_OPCODE,set.VX1290A_WINDOW_OFFSET()),"VX1290A_TouchWriteOpCode: Set Window Offset");
+  if (cfg.win_offset != (set.VX1290A_WINDOW_OFFSET() & 0xffff))
+    {
+      checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_WIN_OFFSET_OPCODE,set.VX1290A_WINDOW_OFFSET()),"VX1290A_TouchWriteOpCode: Set Window Offset");
+      ++sent;
+    }
 
   //Enable subtraction of trigger time
-  checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_EN_SUB_TRG_OPCODE),"VX1290A_Write_OpCode: Enable trigger time subtraction");
+  if (cfg.sub_trg != 1)
+    {
+      checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_EN_SUB_TRG_OPCODE),"VX1290A_Write_OpCode: Enable trigger time subtraction");
+      ++sent;
+    }
 
   //Set edge detection configuration to only leading
-  checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_DETECTION_OPCODE,0x2),"VX1290A_TouchWrite_OpCode: set edge detection configuration");
+  if (cfg.detection != 0x2)
+    {
+      checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_DETECTION_OPCODE,0x2),"VX1290A_TouchWrite_OpCode: set edge detection configuration");
+      ++sent;
+    }
   
   //Set time resolution to minimum, 25ps
-  checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_TR_LEAD_LSB_OPCODE,0x3),"VX1290A_TouchWrite_OpCode: set time resolution");
-
-  //Disable all channels
-  checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_DIS_ALL_CH_OPCODE),"VX1290A_Write_OpCode: Disable all channels");
-  // Enable two channels
-  for (auto c : set.VX1290A_CHANNEL_LE())
-    checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_EN_CHANNEL_OPCODE + c),"VX1290A_Write_OpCode: Enable channel LE");
-  for (auto c : set.VX1290A_CHANNEL_MAX())
-    checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_EN_CHANNEL_OPCODE + c),"VX1290A_Write_OpCode: Enable channel MAX");
+  if (cfg.lsb != 0x3)
+    {
+      checkApiCall(VX1290A_TouchWrite_OpCode(Handle, VX1290A_SET_TR_LEAD_LSB_OPCODE,0x3),"VX1290A_TouchWrite_OpCode: set time resolution");
+      ++sent;
+    }
 
-  Status stat;
-  checkApiCall(VX1290A_Status(Handle, &stat),"VX1290A_Status");
+  // Enable only the LE and MAX channels, all 32 in one pattern
+  uint32_t enable = set.VX1290A_CHANNEL_MASK();
+  if (cfg.enable != enable)
+    {
+      checkApiCall(VX1290A_Write_OpCode(Handle, VX1290A_WRITE_EN_PATTERN_OPCODE),"VX1290A_Write_OpCode: Write enable pattern");
+      checkApiCall(VX1290A_Write_OpCode(Handle, enable & 0xffff),"VX1290A_Write_OpCode: Enable pattern channels 0-15");
+      checkApiCall(VX1290A_Write_OpCode(Handle, enable >> 16),"VX1290A_Write_OpCode: Enable pattern channels 16-31");
+      ++sent;
+    }
 
-  usleep(1000000);
+  // the last opcode is done once the micro controller takes words again
+  checkApiCall(VX1290A_Wait_Ready(Handle),"VX1290A_Setup: Wait Ready");
+  if (set.Verbose()) std::cout << "VX1290A_Setup: " << sent << " of 7 settings sent" << std::endl;
   
   return cvSuccess;
 }
@@ -132,6 +218,17 @@ void PrintStatus(Status stat)
 	    << "\n        PAIR         " << stat.PAIR
 	    << "\n        TRIGGER_LOST " << stat.TRIGGER_LOST << std::endl;
 }
+
+void VX1290A_Config::Print()
+{
+  std::cout << "VX1290A config: acquisition mode " << acq_mode
+	    << ", window width 0x" << std::hex << win_width
+	    << ", offset 0x" << win_offset << std::dec
+	    << ", trigger subtraction " << sub_trg
+	    << ", detection " << detection
+	    << ", lsb " << lsb
+	    << ", channels 0x" << std::hex << enable << std::dec << std::endl;
+}
   
 CVErrorCodes VX1290A_Clear(int32_t Handle)
 {
@@ -143,15 +240,79 @@ CVErrorCodes VX1290A_Trigger(int32_t Handle)
   return VX1290A_Write_Register(Handle, VX1290A_SW_TRIGGER_ADD, 0x0);
 }
 
-CVErrorCodes VX1290A_ReadEvent(int32_t Handle, 
-			       VX1290A_GlobalHeader * gh, 
-			       VX1290A_GlobalTrailer * gt, 
-			       std::vector<VX1290A_TDCHeader> * th, 
-			       std::vector<VX1290A_TDCMeasurement> * tm, 
-			       std::vector<VX1290A_TDCError> * te, 
-			       std::vector<VX1290A_TDCTrailer> * tt, 
-			       VX1290A_GlobalTrigTime * gtt,
-			       Settings set)
+// Add one word to the event being read; true when it completes the event
+// (global trailer). One switch on the word id instead of a chain of
+// VX1290A_Is* tests.
+bool VX1290A_DecodeWord(uint32_t word, VX1290A_Event * ev, const Settings & set)
+{
+  switch (BitMask(word,27,5)) {
+  case VX1290A_ID_GLOBAL_HEADER :
+    VX1290A_ParseGlobalHeader(word,&ev->gh);
+    ev->th.clear();
+    ev->tm.clear();
+    ev->te.clear();
+    ev->tt.clear();
+    if (set.Verbose()) ev->gh.Print();
+    break;
+  case VX1290A_ID_TDC_HEADER :
+    {
+      VX1290A_TDCHeader h;
+      VX1290A_ParseTDCHeader(word,&h);
+      if (set.Verbose()) h.Print();
+      ev->th.push_back(h);
+    }
+    break;
+  case VX1290A_ID_TDC_MEASUREMENT :
+    {
+      VX1290A_TDCMeasurement m;
+      VX1290A_ParseTDCMeasurement(word,&m);
+      if (set.VX1290A_CHANNEL_MASK() >> m.channel & 1)
+	{
+	  if (set.Verbose()) 
+	    {
+	      std::cout << "---> ";
+	      m.Print();
+	    }
+	  ev->tm.push_back(m);
+	}
+      else
+	{
+	  if (set.Verbose()) m.Print();
+	}
+    }
+    break;
+  case VX1290A_ID_TDC_TRAILER :
+    {
+      VX1290A_TDCTrailer t;
+      VX1290A_ParseTDCTrailer(word,&t);
+      if (set.Verbose()) t.Print();
+      ev->tt.push_back(t);
+    }
+    break;
+  case VX1290A_ID_TDC_ERROR :
+    {
+      VX1290A_TDCError e;
+      VX1290A_ParseTDCError(word,&e);
+      if (set.Verbose()) e.Print();
+      ev->te.push_back(e);
+    }
+    break;
+  case VX1290A_ID_GLOBAL_TRIG_TIME :
+    VX1290A_ParseGlobalTrigTime(word,&ev->gtt);
+    if (set.Verbose()) ev->gtt.Print();
+    break;
+  case VX1290A_ID_GLOBAL_TRAILER :
+    VX1290A_ParseGlobalTrailer(word,&ev->gt);
+    if (set.Verbose()) ev->gt.Print();
+    return true;
+  default :
+    // filler words of an odd length MBLT
+    break;
+  }
+  return false;
+}
+
+CVErrorCodes VX1290A_ReadEvent(int32_t Handle, VX1290A_Event * ev, const Settings & set)
 {
   int time = 0;
   CVErrorCodes ret;
@@ -176,64 +337,7 @@ CVErrorCodes VX1290A_ReadEvent(int32_t Handle,
       ret = VX1290A_Read_Word(Handle,&word);
       if (ret == cvSuccess)
 	{
-	  if (VX1290A_IsGlobalHeader(word))
-	    {
-	      VX1290A_ParseGlobalHeader(word,gh);
-	      if (set.Verbose()) gh->Print();
-	    }
-	  else if (VX1290A_IsTDCHeader(word))
-	    {
-	      VX1290A_TDCHeader h;
-	      VX1290A_ParseTDCHeader(word,&h);
-	      if (set.Verbose()) h.Print();
-	      th->push_back(h);
-	    }
-	  else if (VX1290A_IsTDCMeasurement(word))
-	    {
-	      VX1290A_TDCMeasurement m;
-	      VX1290A_ParseTDCMeasurement(word,&m);
-	      if (std::find(set.VX1290A_CHANNEL_LE().begin(),set.VX1290A_CHANNEL_LE().end(),m.channel) != set.VX1290A_CHANNEL_LE().end() ||
-		  std::find(set.VX1290A_CHANNEL_MAX().begin(),set.VX1290A_CHANNEL_MAX().end(),m.channel) != set.VX1290A_CHANNEL_MAX().end())
-		//if (m.channel == VX1290A_CHANNEL_LE || 
-		//m.channel == VX1290A_CHANNEL_MAX) 
-		{
-		  if (set.Verbose()) 
-		    {
-		      std::cout << "---> ";
-		      m.Print();
-		    }
-		  tm->push_back(m);
-		}
-	      else
-		{
-		  if (set.Verbose()) m.Print();
-		}
-	    }
-	  else if (VX1290A_IsTDCTrailer(word))
-	    {
-	      VX1290A_TDCTrailer t;
-	      VX1290A_ParseTDCTrailer(word,&t);
-	      if (set.Verbose()) t.Print();
-	      tt->push_back(t);
-	    }
-	  else if (VX1290A_IsTDCError(word))
-	    {
-	      VX1290A_TDCError e;
-	      VX1290A_ParseTDCError(word,&e);
-	      if (set.Verbose()) e.Print();
-	      te->push_back(e);
-	    }
-	  else if (VX1290A_IsGlobalTrigTime(word))
-	    {
-	      VX1290A_ParseGlobalTrigTime(word,gtt);
-	      if (set.Verbose()) gtt->Print();
-	    }
-	  else if (VX1290A_IsGlobalTrailer(word))
-	    {
-	      VX1290A_ParseGlobalTrailer(word,gt);
-	      if (set.Verbose()) gt->Print();
-	      return cvSuccess;
-	    }
+	  if (VX1290A_DecodeWord(word,ev,set)) return cvSuccess;
 	}
       else if (ret == cvBusError) break;
       else
@@ -245,6 +349,185 @@ CVErrorCodes VX1290A_ReadEvent(int32_t Handle,
   return cvSuccess;
 }
 
+// Number of complete events in the output buffer, from the event FIFO
+CVErrorCodes VX1290A_Events_Stored(int32_t Handle, uint32_t * stored)
+{
+  *stored = 0;
+  CVErrorCodes ret = VX1290A_Read_Register(Handle, VX1290A_EVENT_FIFO_STORED_ADD, stored);
+  *stored &= 0x7ff;
+  return ret;
+}
+
+// Number of complete events in the output buffer, without waiting for
+// any: from the event FIFO with block readout (whose entries
+// VX1290A_Read_Event_Sizes needs), else from VX1290A_EVENT_STORED_ADD
+CVErrorCodes VX1290A_Events_Ready(int32_t Handle, const Settings & set, uint32_t * nevents)
+{
+  if (set.Readout() != READOUT_WORD) return VX1290A_Events_Stored(Handle, nevents);
+  *nevents = 0;
+  CVErrorCodes ret = VX1290A_Read_Register(Handle, VX1290A_EVENT_STORED_ADD, nevents);
+  *nevents &= 0xffff;
+  return ret;
+}
+
+// Pop the event FIFO entries of the next nevents events (waiting, as
+// VX1290A_ReadEvent does, until that many are complete) and add up their
+// word counts. The entries are read VX1290A_FIFO_CHUNK at a time in one
+// multi-read each.
+CVErrorCodes VX1290A_Read_Event_Sizes(int32_t Handle, VX1290A_Buffer * buf, uint32_t nevents, uint32_t * nwords)
+{
+  *nwords = 0;
+  int time = 0;
+  uint32_t stored;
+  CVErrorCodes ret;
+  do {
+    ret = VX1290A_Events_Stored(Handle, &stored);
+    if (ret != cvSuccess) return ret;
+    if (stored < nevents)
+      {
+	Status stat;
+	if (VX1290A_Status(Handle, &stat) == cvSuccess) PrintStatus(stat);
+	usleep(1000000);
+      }
+    ++time;
+  } while (stored < nevents && time < 10);
+  if (stored < nevents)
+    {
+      throw std::runtime_error("Data not ready to be read, TIMEOUT");
+    }
+
+  uint32_t addr[VX1290A_FIFO_CHUNK];
+  CVAddressModifier am[VX1290A_FIFO_CHUNK];
+  CVDataWidth dw[VX1290A_FIFO_CHUNK];
+  CVErrorCodes ec[VX1290A_FIFO_CHUNK];
+  for (int i = 0; i < VX1290A_FIFO_CHUNK; ++i)
+    {
+      addr[i] = VX1290A_BASE + VX1290A_EVENT_FIFO_ADD;
+      am[i] = cvA24_U_DATA;
+      dw[i] = cvD32;
+    }
+  for (uint32_t done = 0; done < nevents; )
+    {
+      int k = std::min<uint32_t>(nevents-done, VX1290A_FIFO_CHUNK);
+      ret = CAENVME_MultiRead(Handle, addr, buf->fifo.data(), k, am, dw, ec);
+      if (ret != cvSuccess) return ret;
+      for (int i = 0; i < k; ++i) *nwords += BitMask(buf->fifo[i],0,16);
+      done += k;
+    }
+  return cvSuccess;
+}
+
+// Most events one readout can take from the VX1290A: half a
+// VX1290A_Buffer of events with one hit per read channel (global header,
+// trigger time and trailer, a header and trailer per TDC chip), no more
+// than the event FIFO holds with block readout, and no more than one
+// chained transfer carries.
+uint32_t VX1290A_Max_Events(const Settings & set)
+{
+  uint32_t words = 3 + 2*VX1290A_NUM_TDC + set.VX1290A_CHANNEL_LE().size() + set.VX1290A_CHANNEL_MAX().size();
+  uint32_t nmax = VX1290A_BUFFER_WORDS/2/words;
+  if (set.Readout() != READOUT_WORD && nmax > VX1290A_FIFO_EVENTS) nmax = VX1290A_FIFO_EVENTS;
+  if (set.UseCrate() && nmax > VX1290A_BLT_EVENT_MAX) nmax = VX1290A_BLT_EVENT_MAX;
+  return nmax;
+}
+
+// Fetch nwords of the output buffer in one block transfer, as
+// MQDC32_Read_BLT.
+CVErrorCodes VX1290A_Read_BLT(int32_t Handle, VX1290A_Buffer * buf, uint32_t nwords, ReadoutMode mode)
+{
+  if (nwords > VX1290A_BUFFER_WORDS) nwords = VX1290A_BUFFER_WORDS;
+  int count = 0;
+  CVErrorCodes ret;
+  if (mode == READOUT_MBLT)
+    ret = CAENVME_FIFOMBLTReadCycle(Handle, VX1290A_BASE + VX1290A_OUT_BUFFER_ADD, buf->word.data(), 8*((nwords+1)/2), cvA24_U_MBLT, &count);
+  else
+    ret = CAENVME_FIFOBLTReadCycle(Handle, VX1290A_BASE + VX1290A_OUT_BUFFER_ADD, buf->word.data(), 4*nwords, cvA24_U_BLT, cvD32, &count);
+  buf->size = count/4;
+  if (ret == cvBusError && count > 0) ret = cvSuccess;
+  return ret;
+}
+
+// Read the next nevents events into buf without decoding them. With block
+// readout their sizes come from the event FIFO and all of them are fetched
+// in one transfer; word readout waits for data as VX1290A_ReadEvent does
+// and reads single words up to each global trailer.
+CVErrorCodes VX1290A_Read_Buffer(int32_t Handle, uint32_t nevents, const Settings & set, VX1290A_Buffer * buf)
+{
+  buf->size = 0;
+  if (nevents == 0) return cvSuccess;
+  CVErrorCodes ret;
+  if (set.Readout() == READOUT_WORD)
+    {
+      for (uint32_t i = 0; i < nevents; ++i)
+	{
+	  int time = 0;
+	  Status stat;
+	  do {
+	    ret = VX1290A_Status(Handle, &stat);
+	    if (ret != cvSuccess) return ret;
+	    if (stat.DATA_READY != 1) 
+	      {
+		PrintStatus(stat);
+		usleep(1000000);
+	      }
+	    ++time;
+	  } while (stat.DATA_READY != 1 && time < 10);
+	  if (time >= 10)
+	    {
+	      throw std::runtime_error("Data not ready to be read, TIMEOUT");
+	    }
+	  uint32_t word;
+	  do
+	    {
+	      ret = VX1290A_Read_Word(Handle,&word);
+	      if (ret == cvBusError) break;
+	      if (ret != cvSuccess)
+		{
+		  std::cout << "Error in VX1290A_Read_Buffer" << std::endl;
+		  throw ret;
+		}
+	      if (buf->size >= VX1290A_BUFFER_WORDS)
+		{
+		  throw std::runtime_error("VX1290A events larger than the readout buffer");
+		}
+	      buf->word[buf->size++] = word;
+	    } while (!VX1290A_IsGlobalTrailer(word));
+	}
+      return cvSuccess;
+    }
+
+  uint32_t nwords;
+  ret = VX1290A_Read_Event_Sizes(Handle,buf,nevents,&nwords);
+  if (ret != cvSuccess)
+    {
+      std::cout << "Error in VX1290A_Read_Buffer" << std::endl;
+      throw ret;
+    }
+  if (set.Verbose()) std::cout << "VX1290A event FIFO: " << nevents << " events, " << nwords << " words" << std::endl;
+  // the FIFO entries are gone, so a cut transfer could not be resumed
+  if (nwords > VX1290A_BUFFER_WORDS)
+    {
+      throw std::runtime_error("VX1290A events larger than the readout buffer");
+    }
+  ret = VX1290A_Read_BLT(Handle,buf,nwords,set.Readout());
+  if (ret != cvSuccess)
+    {
+      std::cout << "Error in VX1290A_Read_Buffer" << std::endl;
+      throw ret;
+    }
+  return cvSuccess;
+}
+
+// Append the events completed by the words in buf; an event cut off at
+// the end stays in *partial for the next buffer.
+void VX1290A_Decode_Buffer(const VX1290A_Buffer & buf, std::vector<VX1290A_Event> * events, VX1290A_Event * partial, const Settings & set)
+{
+  for (uint32_t i = 0; i < buf.size; ++i)
+    {
+      if (VX1290A_DecodeWord(buf.word[i],partial,set)) events->push_back(*partial);
+    }
+}
+
 bool VX1290A_IsGlobalHeader(uint32_t word)
 {
   return (BitMask(word,27,5)==8);
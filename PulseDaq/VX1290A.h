@@ -129,6 +129,32 @@
 #define VX1290A_READ_OK 0x2
 #define VX1290A_WRITE_OK 0x1
 
+#define VX1290A_MICRO_TIMEOUT_MS 1000  /* longest wait for one handshake bit */
+#define VX1290A_RESET_TIMEOUT_MS 2000  /* longest wait for the micro controller after a reset */
+
+#define VX1290A_CBLT_DISABLED 0x0   /* VX1290A_MCST_CBLT_CTRL_ADD: position in the chain */
+#define VX1290A_CBLT_LAST 0x1
+#define VX1290A_CBLT_FIRST 0x2
+#define VX1290A_CBLT_MIDDLE 0x3
+#define VX1290A_BLT_EVENT_MAX 255   /* VX1290A_BLT_EVENT_NUM_ADD is 8 bits */
+
+#define VX1290A_NUM_TDC 4             /* HPTDC chips, one header/trailer/error each per event */
+#define VX1290A_MAX_HITS 64           /* accepted measurements kept per event */
+
+#define VX1290A_BUFFER_WORDS 16384   /* 32-bit words, largest block read at once */
+#define VX1290A_FIFO_CHUNK 64        /* event FIFO entries popped per multi-read */
+#define VX1290A_FIFO_EVENTS 1024     /* event FIFO depth */
+
+// Data word ids (bits 27-31)
+#define VX1290A_ID_TDC_MEASUREMENT 0x00
+#define VX1290A_ID_TDC_HEADER 0x01
+#define VX1290A_ID_TDC_TRAILER 0x03
+#define VX1290A_ID_TDC_ERROR 0x04
+#define VX1290A_ID_GLOBAL_HEADER 0x08
+#define VX1290A_ID_GLOBAL_TRAILER 0x10
+#define VX1290A_ID_GLOBAL_TRIG_TIME 0x11
+#define VX1290A_ID_FILLER 0x18
+
 #include "Common.h"
 #include "User_Settings.h"
 
@@ -158,10 +184,27 @@ CVErrorCodes VX1290A_TouchWrite_OpCode(int32_t Handle, uint32_t opaddress, uint3
 CVErrorCodes VX1290A_Write_OpCode(int32_t Handle, uint32_t opaddress);
 CVErrorCodes VX1290A_Read_Register(int32_t Handle, uint32_t address, uint32_t * data);
 CVErrorCodes VX1290A_TouchRead_OpCode(int32_t Handle, uint32_t opaddress, uint32_t * data);
-CVErrorCodes VX1290A_Read_OpCode(int32_t Handle, uint32_t opaddress);
+CVErrorCodes VX1290A_Read_OpCode(int32_t Handle, uint32_t * opaddress);
 CVErrorCodes VX1290A_Read_Word(int32_t Handle, uint32_t * data);
+CVErrorCodes VX1290A_Read_Register32(int32_t Handle, uint32_t address, uint32_t * data);
 
-CVErrorCodes VX1290A_Setup(int32_t Handle, Settings set);
+// Settings of the micro controller that VX1290A_Setup makes
+struct VX1290A_Config {
+  uint32_t acq_mode;    // 1: trigger matching
+  uint32_t win_width;
+  uint32_t win_offset;
+  uint32_t sw_margin;
+  uint32_t rej_margin;
+  uint32_t sub_trg;     // 1: trigger time subtraction
+  uint32_t detection;
+  uint32_t lsb;
+  uint32_t enable;      // channels 0-31
+  void Print();
+};
+
+CVErrorCodes VX1290A_Wait_Ready(int32_t Handle);
+CVErrorCodes VX1290A_Read_Config(int32_t Handle, VX1290A_Config * cfg);
+CVErrorCodes VX1290A_Setup(int32_t Handle, const Settings & set);
 
 CVErrorCodes VX1290A_Status(int32_t Handle, Status * status);
 CVErrorCodes VX1290A_Clear(int32_t Handle);
@@ -270,14 +313,35 @@ void VX1290A_ParseTDCError(uint32_t word, VX1290A_TDCError * err);
 void VX1290A_ParseTDCTrailer(uint32_t word, VX1290A_TDCTrailer * trail);
 void VX1290A_ParseGlobalTrigTime(uint32_t word, VX1290A_GlobalTrigTime * trig);
 
-CVErrorCodes VX1290A_ReadEvent(int32_t Handle, 
-			       VX1290A_GlobalHeader * gh, 
-			       VX1290A_GlobalTrailer * gt, 
-			       std::vector<VX1290A_TDCHeader> * th_v, 
-			       std::vector<VX1290A_TDCMeasurement> * tm_v, 
-			       std::vector<VX1290A_TDCError> * te_v, 
-			       std::vector<VX1290A_TDCTrailer> * tt_v, 
-			       VX1290A_GlobalTrigTime * gtt,
-			       Settings set);
+// One trigger as it comes out of the output buffer
+struct VX1290A_Event {
+  VX1290A_GlobalHeader gh;
+  VX1290A_GlobalTrailer gt;
+  FixedList<VX1290A_TDCHeader,VX1290A_NUM_TDC> th;
+  FixedList<VX1290A_TDCMeasurement,VX1290A_MAX_HITS> tm;
+  FixedList<VX1290A_TDCError,VX1290A_NUM_TDC> te;
+  FixedList<VX1290A_TDCTrailer,VX1290A_NUM_TDC> tt;
+  VX1290A_GlobalTrigTime gtt;
+};
+
+// Memory for one block transfer of the output buffer, allocated once.
+// One word more than VX1290A_BUFFER_WORDS for the filler of an odd length
+// MBLT.
+struct VX1290A_Buffer {
+  std::vector<uint32_t> word;
+  uint32_t size;
+  std::vector<uint32_t> fifo;
+VX1290A_Buffer() : word(VX1290A_BUFFER_WORDS+1,0), size(0), fifo(VX1290A_FIFO_CHUNK,0) {}
+};
+
+bool VX1290A_DecodeWord(uint32_t word, VX1290A_Event * ev, const Settings & set);
+CVErrorCodes VX1290A_ReadEvent(int32_t Handle, VX1290A_Event * ev, const Settings & set);
+CVErrorCodes VX1290A_Events_Stored(int32_t Handle, uint32_t * stored);
+CVErrorCodes VX1290A_Events_Ready(int32_t Handle, const Settings & set, uint32_t * nevents);
+CVErrorCodes VX1290A_Read_Event_Sizes(int32_t Handle, VX1290A_Buffer * buf, uint32_t nevents, uint32_t * nwords);
+CVErrorCodes VX1290A_Read_BLT(int32_t Handle, VX1290A_Buffer * buf, uint32_t nwords, ReadoutMode mode);
+uint32_t VX1290A_Max_Events(const Settings & set);
+CVErrorCodes VX1290A_Read_Buffer(int32_t Handle, uint32_t nevents, const Settings & set, VX1290A_Buffer * buf);
+void VX1290A_Decode_Buffer(const VX1290A_Buffer & buf, std::vector<VX1290A_Event> * events, VX1290A_Event * partial, const Settings & set);
 
 #endif
@@ -0,0 +1,101 @@
+#ifndef CAENVMELIB_SIM_H
+#define CAENVMELIB_SIM_H
+
+// Stand-in for CAEN's CAENVMElib.h when PulseDaq is built with "make sim".
+// The types and values are those of CAENVMElib v2.50; only the calls that
+// PulseDaq makes are declared, and VMESim.cc answers them with simulated
+// MQDC32 and VX1290A modules instead of a V1718.
+
+#include <stdint.h>
+
+typedef unsigned char CAEN_BYTE;
+
+typedef enum CVBoardTypes {
+  cvV1718 = 0,
+  cvV2718 = 1,
+  cvA2818 = 2,
+  cvA2719 = 3,
+  cvA3818 = 4
+} CVBoardTypes;
+
+typedef enum CVErrorCodes {
+  cvSuccess = 0,
+  cvBusError = -1,
+  cvCommError = -2,
+  cvGenericError = -3,
+  cvInvalidParam = -4,
+  cvTimeoutError = -5
+} CVErrorCodes;
+
+typedef enum CVAddressModifier {
+  cvA16_S = 0x2D,
+  cvA16_U = 0x29,
+  cvA16_LCK = 0x2C,
+  cvA24_S_BLT = 0x3F,
+  cvA24_S_PGM = 0x3E,
+  cvA24_S_DATA = 0x3D,
+  cvA24_S_MBLT = 0x3C,
+  cvA24_U_BLT = 0x3B,
+  cvA24_U_PGM = 0x3A,
+  cvA24_U_DATA = 0x39,
+  cvA24_U_MBLT = 0x38,
+  cvA24_LCK = 0x32,
+  cvA32_S_BLT = 0x0F,
+  cvA32_S_PGM = 0x0E,
+  cvA32_S_DATA = 0x0D,
+  cvA32_S_MBLT = 0x0C,
+  cvA32_U_BLT = 0x0B,
+  cvA32_U_PGM = 0x0A,
+  cvA32_U_DATA = 0x09,
+  cvA32_U_MBLT = 0x08,
+  cvA32_LCK = 0x05,
+  cvCR_CSR = 0x2F
+} CVAddressModifier;
+
+typedef enum CVDataWidth {
+  cvD8 = 0x01,
+  cvD16 = 0x02,
+  cvD32 = 0x04,
+  cvD64 = 0x08,
+  cvD16_swapped = 0x12,
+  cvD32_swapped = 0x14,
+  cvD64_swapped = 0x18
+} CVDataWidth;
+
+typedef enum CVIRQLevels {
+  cvIRQ1 = 0x01,
+  cvIRQ2 = 0x02,
+  cvIRQ3 = 0x04,
+  cvIRQ4 = 0x08,
+  cvIRQ5 = 0x10,
+  cvIRQ6 = 0x20,
+  cvIRQ7 = 0x40
+} CVIRQLevels;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CVErrorCodes CAENVME_Init(CVBoardTypes BdType, short Link, short BdNum, int32_t *Handle);
+CVErrorCodes CAENVME_End(int32_t Handle);
+CVErrorCodes CAENVME_SystemReset(int32_t Handle);
+CVErrorCodes CAENVME_ReadCycle(int32_t Handle, uint32_t Address, void *Data, CVAddressModifier AM, CVDataWidth DW);
+CVErrorCodes CAENVME_WriteCycle(int32_t Handle, uint32_t Address, void *Data, CVAddressModifier AM, CVDataWidth DW);
+CVErrorCodes CAENVME_MultiRead(int32_t Handle, uint32_t *Addrs, uint32_t *Buffer, int NCycles, CVAddressModifier *AMs, CVDataWidth *DWs, CVErrorCodes *ECs);
+CVErrorCodes CAENVME_MultiWrite(int32_t Handle, uint32_t *Addrs, uint32_t *Buffer, int NCycles, CVAddressModifier *AMs, CVDataWidth *DWs, CVErrorCodes *ECs);
+CVErrorCodes CAENVME_BLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, CVDataWidth DW, int *count);
+CVErrorCodes CAENVME_FIFOBLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, CVDataWidth DW, int *count);
+CVErrorCodes CAENVME_MBLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, int *count);
+CVErrorCodes CAENVME_FIFOMBLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, int *count);
+CVErrorCodes CAENVME_IRQCheck(int32_t Handle, CAEN_BYTE *Mask);
+CVErrorCodes CAENVME_IRQEnable(int32_t Handle, uint32_t Mask);
+CVErrorCodes CAENVME_IRQDisable(int32_t Handle, uint32_t Mask);
+CVErrorCodes CAENVME_IRQWait(int32_t Handle, uint32_t Mask, uint32_t Timeout);
+CVErrorCodes CAENVME_IACKCycle(int32_t Handle, CVIRQLevels Level, void *Vector, CVDataWidth DW);
+const char * CAENVME_DecodeError(CVErrorCodes Code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
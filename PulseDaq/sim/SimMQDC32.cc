@@ -0,0 +1,227 @@
+#include "SimMQDC32.h"
+
+#include "../MQDC32.h"
+
+SIM_MQDC32::SIM_MQDC32()
+{
+  Reset(0);
+  readyAt = 0;
+}
+
+// Power-up state, as after MQDC32_SOFT_RESET or a VME system reset
+void SIM_MQDC32::Reset(double now)
+{
+  for (int i = 0; i < SIM_MQDC32_REGISTERS; ++i) reg[i] = 0;
+  for (int c = 0; c < SIM_MAX_CHANNELS; ++c) threshold[c] = 0;
+  Register(MQDC32_MODULE_ID) = 0xff;
+  Register(MQDC32_FIRM_REV) = 0x0110;
+  Register(MQDC32_IRQ_DATA_THRESHOLD) = 1;
+  Register(MQDC32_MAX_TRANSFER_DATA) = 1;
+  Register(MQDC32_CBLT_ADD) = 0xAA;
+  Register(MQDC32_MCST_ADD) = 0xBB;
+  Register(MQDC32_DATA_LEN_FMT) = 2;
+  Register(MQDC32_START_ACQ) = 1;
+  Register(MQDC32_ECL_TERM) = 0x18;
+  Register(MQDC32_ECL_FC_RESET) = 1;
+  Register(MQDC32_HIGH_LIMIT_BANK0) = 32;
+  Register(MQDC32_HIGH_LIMIT_BANK1) = 16;
+  data.clear();
+  transferred = 0;
+  armed = true;
+  irqArmed = true;
+  counter = 0;
+  tsZero = now;
+  readyAt = now + 1e-6*SIM_MQDC32_RESET_US;
+  cblt = cbltFirst = cbltLast = mcst = false;
+  converted = 0;
+}
+
+bool SIM_MQDC32::Valid(uint32_t offset) const
+{
+  return offset < 0x8 || (offset >= MQDC32_THRESHOLD_0 && offset < MQDC32_THRESHOLD_0 + 2*SIM_MAX_CHANNELS)
+    || (offset >= 0x6000 && offset < 0x6000 + 2*SIM_MQDC32_REGISTERS);
+}
+
+CVErrorCodes SIM_MQDC32::Read(uint32_t offset, double now, uint32_t * value)
+{
+  if (now < readyAt || !Valid(offset)) return cvBusError;
+  offset &= ~1u;
+  if (offset < 0x8)
+    return Pop(value) ? cvSuccess : cvBusError;
+  if (offset < 0x6000)
+    {
+      *value = threshold[(offset-MQDC32_THRESHOLD_0)/2];
+      return cvSuccess;
+    }
+  switch (offset) {
+  case MQDC32_BUF_DATA_LEN :
+    {
+      uint32_t words = data.size();
+      switch (Register(MQDC32_DATA_LEN_FMT) & 3) {
+      case 0 : *value = 4*words; break;
+      case 1 : *value = 2*words; break;
+      case 2 : *value = words; break;
+      default : *value = (words+1)/2; break;
+      }
+      if (*value > 0xffff) *value = 0xffff;
+    }
+    break;
+  case MQDC32_DATA_READY : *value = data.empty() ? 0 : 1; break;
+  case MQDC32_CBLT_MCST_CTL :
+    *value = (cblt ? MQDC32_CBLT_ENABLE : 0) | (cbltLast ? MQDC32_CBLT_LAST_ENABLE : 0)
+      | (cbltFirst ? MQDC32_CBLT_FIRST_ENABLE : 0) | (mcst ? MQDC32_MCST_ENABLE : 0);
+    break;
+  case MQDC32_EV_CTL_LOW : *value = counter & 0xffff; break;
+  case MQDC32_EV_CTL_HIGH : *value = counter >> 16; break;
+  case MQDC32_TS_COUNTER_LOW : *value = (uint32_t)(16e6*(now-tsZero)) & 0xffff; break;
+  case MQDC32_TS_COUNTER_HIGH : *value = ((uint32_t)(16e6*(now-tsZero)) >> 16) & 0xffff; break;
+  default : *value = Register(offset); break;
+  }
+  return cvSuccess;
+}
+
+CVErrorCodes SIM_MQDC32::Write(uint32_t offset, uint32_t value, double now)
+{
+  if (now < readyAt || !Valid(offset)) return cvBusError;
+  offset &= ~1u;
+  value &= 0xffff;
+  if (offset < 0x8) return cvBusError;
+  if (offset < 0x6000)
+    {
+      threshold[(offset-MQDC32_THRESHOLD_0)/2] = value;
+      return cvSuccess;
+    }
+  switch (offset) {
+  case MQDC32_SOFT_RESET : Reset(now); break;
+  case MQDC32_IRQ_RESET : irqArmed = false; break;
+  case MQDC32_READOUT_RESET :
+    armed = true;
+    irqArmed = true;
+    transferred = 0;
+    break;
+  case MQDC32_FIFO_RESET :
+    data.clear();
+    transferred = 0;
+    break;
+  case MQDC32_CBLT_MCST_CTL :
+    if (value & MQDC32_CBLT_DISABLE) cblt = false;
+    if (value & MQDC32_CBLT_ENABLE) cblt = true;
+    if (value & MQDC32_CBLT_LAST_DISABLE) cbltLast = false;
+    if (value & MQDC32_CBLT_LAST_ENABLE) cbltLast = true;
+    if (value & MQDC32_CBLT_FIRST_DISABLE) cbltFirst = false;
+    if (value & MQDC32_CBLT_FIRST_ENABLE) cbltFirst = true;
+    if (value & MQDC32_MCST_DISABLE) mcst = false;
+    if (value & MQDC32_MCST_ENABLE) mcst = true;
+    break;
+  case MQDC32_RESET_CTL_AB :
+    if (value & 0x1)
+      {
+	counter = 0;
+	tsZero = now;
+      }
+    break;
+  case MQDC32_FIRM_REV :
+  case MQDC32_BUF_DATA_LEN :
+  case MQDC32_DATA_READY :
+  case MQDC32_TS_COUNTER_LOW :
+  case MQDC32_TS_COUNTER_HIGH :
+    break;
+  default : Register(offset) = value; break;
+  }
+  return cvSuccess;
+}
+
+bool SIM_MQDC32::Accepting(double now) const
+{
+  if (now < readyAt || !(Register(MQDC32_START_ACQ) & 1)) return false;
+  if ((Register(MQDC32_MULTIEVENT) & 3) == MQDC32_MULTIEVENT_OFF) return armed;
+  return data.size() + MQDC32_MAX_CHANNELS + 2 <= MQDC32_BUFFER_WORDS;
+}
+
+// Header, one data word per channel above threshold (0x1FFF switches a
+// channel off) and the EoE mark with the event counter or the time stamp.
+// A lost event is counted but never reaches the buffer.
+void SIM_MQDC32::Convert(const SIM_Pulse & p, bool lose)
+{
+  uint32_t id = Register(MQDC32_MODULE_ID);
+  if (id == 0xff) id = (MQDC32_BASE >> 24) & 0xff;
+  size_t head = data.size();
+  data.push_back(0);
+  uint32_t n = 0;
+  for (uint32_t c = 0; c < SIM_MAX_CHANNELS; ++c)
+    {
+      uint32_t thr = threshold[c] & 0x1fff;
+      if (!p.qdc[c] || thr == 0x1fff || p.adc[c] < thr) continue;
+      uint32_t adc = p.adc[c];
+      uint32_t overflow = 0;
+      if (adc > 0xfff)
+	{
+	  adc = 0xfff;
+	  overflow = 1;
+	}
+      data.push_back(0x04000000 | c << 16 | overflow << 15 | adc);
+      ++n;
+    }
+  uint32_t mark = counter;
+  if (Register(MQDC32_MARKING_TYPE) & MQDC32_MARK_TIME) mark = (uint32_t)(16e6*(p.time-tsZero));
+  data.push_back(0xC0000000 | (mark & 0x3fffffff));
+  data[head] = 0x40000000 | id << 16 | (n+1);
+  ++counter;
+  ++converted;
+  if (lose)
+    {
+      data.resize(head);
+      return;
+    }
+  armed = false;
+}
+
+// Next word of the event buffer; false (a bus error) when it is empty or
+// a limited transfer has reached its length at an event boundary
+bool SIM_MQDC32::Pop(uint32_t * word)
+{
+  if (data.empty()) return false;
+  uint32_t limit = Register(MQDC32_MAX_TRANSFER_DATA);
+  if ((Register(MQDC32_MULTIEVENT) & 3) == MQDC32_MULTIEVENT_LIMITED && limit > 0
+      && transferred >= limit && (data.front() >> 30) == 1)
+    return false;
+  *word = data.front();
+  data.pop_front();
+  ++transferred;
+  return true;
+}
+
+uint32_t SIM_MQDC32::IRQLevel() const
+{
+  uint32_t level = Register(MQDC32_IRQ_LEVEL) & 7;
+  if (level == 0 || !irqArmed || data.empty()) return 0;
+  if ((Register(MQDC32_MULTIEVENT) & 3) != MQDC32_MULTIEVENT_OFF)
+    {
+      uint32_t threshold = Register(MQDC32_IRQ_DATA_THRESHOLD);
+      if (data.size() < (threshold > 0 ? threshold : 1)) return 0;
+    }
+  return level;
+}
+
+uint32_t SIM_MQDC32::Acknowledge()
+{
+  irqArmed = false;
+  return Register(MQDC32_IRQ_VECTOR);
+}
+
+bool SIM_MQDC32::InChain(uint32_t high) const
+{
+  return cblt && Register(MQDC32_CBLT_ADD) == high;
+}
+
+bool SIM_MQDC32::InMulticast(uint32_t high) const
+{
+  return mcst && Register(MQDC32_MCST_ADD) == high;
+}
+
+int SIM_MQDC32::ChainPosition() const
+{
+  if (cbltFirst) return 0;
+  if (cbltLast) return 2;
+  return 1;
+}
@@ -0,0 +1,47 @@
+#ifndef SIMMQDC32_H
+#define SIMMQDC32_H
+
+#include <deque>
+
+#include "VMESim.h"
+
+#define SIM_MQDC32_REGISTERS 0x60    /* 16-bit registers 0x6000..0x60BE */
+
+// The MQDC32 as the bus sees it: registers, thresholds and the event
+// buffer. Single-event mode (MQDC32_MULTIEVENT 0) takes one event and
+// then waits for MQDC32_READOUT_RESET; multi-event mode keeps converting
+// until the buffer is full, interrupts at MQDC32_IRQ_DATA_THRESHOLD words
+// and, in limited mode, ends a transfer with a bus error after the event
+// that reaches MQDC32_MAX_TRANSFER_DATA words. The IRQ is released by the
+// IACK cycle and raised again after MQDC32_READOUT_RESET.
+struct SIM_MQDC32 {
+  uint16_t reg[SIM_MQDC32_REGISTERS];
+  uint16_t threshold[SIM_MAX_CHANNELS];
+  std::deque<uint32_t> data;
+  uint32_t transferred;    // words read since the last readout reset
+  bool armed;              // single-event mode: takes the next event
+  bool irqArmed;
+  uint32_t counter;        // event counter
+  double tsZero;           // time stamp counter reset
+  double readyAt;          // does not answer before, after a reset
+  bool cblt, cbltFirst, cbltLast, mcst;
+  uint64_t converted;
+
+  SIM_MQDC32();
+  void Reset(double now);
+  bool Valid(uint32_t offset) const;
+  CVErrorCodes Read(uint32_t offset, double now, uint32_t * value);
+  CVErrorCodes Write(uint32_t offset, uint32_t value, double now);
+  bool Accepting(double now) const;
+  void Convert(const SIM_Pulse & p, bool lose = false);
+  bool Pop(uint32_t * word);
+  uint32_t IRQLevel() const;   // 0 if no IRQ is pending
+  uint32_t Acknowledge();
+  bool InChain(uint32_t high) const;
+  bool InMulticast(uint32_t high) const;
+  int ChainPosition() const;   // 0 first, 1 middle, 2 last
+  uint16_t & Register(uint32_t offset) { return reg[(offset-0x6000)/2]; }
+  uint16_t Register(uint32_t offset) const { return reg[(offset-0x6000)/2]; }
+};
+
+#endif
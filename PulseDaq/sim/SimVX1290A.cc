@@ -0,0 +1,388 @@
+#include "SimVX1290A.h"
+
+#include "../VX1290A.h"
+
+// Power-up configuration of the model: continuous storage, so nothing is
+// recorded until VX1290A_TRG_MATCH_OPCODE
+SIM_VX1290A_Config::SIM_VX1290A_Config()
+  : triggerMatching(false), winWidth(0x14), winOffset(0xFFD8), swMargin(0x08), rejMargin(0x04),
+    subTrigger(false), detection(0x2), lsb(0x2), pairRes(0), deadTime(0), headerTrailer(true),
+    eventSize(0x9), errorMark(true), errorBypass(false), errorTypes(0x7ff), fifoSize(0x7),
+    enable(0xffffffff), rcAdjust(0)
+{
+  globOffset[0] = globOffset[1] = 0;
+  for (int c = 0; c < SIM_MAX_CHANNELS; ++c) adjust[c] = 0;
+}
+
+SIM_VX1290A::SIM_VX1290A()
+  : microWord(0), triggers(0), protocolErrors(0), extraRead(0)
+{
+  Reset(0);
+  microReady = 0;
+}
+
+// VX1290A_MOD_RESET_ADD or a VME system reset
+void SIM_VX1290A::Reset(double now)
+{
+  control = 0x0020;
+  intLevel = 0;
+  intVector = 0;
+  geo = 0;
+  mcstAddr = 0xAA;
+  mcstCtrl = VX1290A_CBLT_DISABLED;
+  almostFull = 64;
+  bltEventNum = 0;
+  outProg = 0;
+  testreg = 0;
+  dummy16 = 0;
+  dummy32 = 0;
+  Clear();
+  cfg = SIM_VX1290A_Config();
+  opcode = 0;
+  want = 0;
+  nparam = 0;
+  answer.clear();
+  microReady = now + 1e-6*SIM_VX1290A_RESET_US;
+}
+
+// VX1290A_SW_CLEAR_ADD: empties the buffers and resets the event counter
+void SIM_VX1290A::Clear()
+{
+  buffer.clear();
+  sizes.clear();
+  extras.clear();
+  fifo.clear();
+  midEvent = false;
+  bltEvents = 0;
+  counter = 0;
+  triggerLost = false;
+}
+
+bool SIM_VX1290A::Valid(uint32_t offset) const
+{
+  return offset < 0x1000 || (offset >= 0x1000 && offset < 0x1040) || (offset >= 0x1200 && offset < 0x1208)
+    || (offset >= 0x4000 && offset < 0x4100) || (offset >= 0x8000 && offset < 0x8200);
+}
+
+CVErrorCodes SIM_VX1290A::Read(uint32_t offset, double now, uint32_t * value)
+{
+  if (!Valid(offset)) return cvBusError;
+  if (offset < 0x1000)
+    {
+      if (Pop(value,false)) return cvSuccess;
+      if (control & 0x1) return cvBusError;
+      *value = VX1290A_ID_FILLER << 27;
+      return cvSuccess;
+    }
+  bool ready = now >= microReady;
+  switch (offset) {
+  case VX1290A_CONTROL_ADD : *value = control; break;
+  case VX1290A_STATUS_ADD :
+    *value = (sizes.empty() ? 0 : 0x1) | (buffer.size() >= almostFull ? 0x2 : 0)
+      | (buffer.size() >= SIM_VX1290A_BUFFER_WORDS ? 0x4 : 0) | (cfg.triggerMatching ? 0x8 : 0)
+      | (cfg.headerTrailer ? 0x10 : 0) | 0x20 | (cfg.lsb & 0x3) << 12
+      | (cfg.detection == 0 ? 0x4000 : 0) | (triggerLost ? 0x8000 : 0);
+    break;
+  case VX1290A_INT_LEVEL_ADD : *value = intLevel; break;
+  case VX1290A_INT_VECTOR_ADD : *value = intVector; break;
+  case VX1290A_GEO_ADDRESS_ADD : *value = geo; break;
+  case VX1290A_MCST_CBLT_ADDRESS_ADD : *value = mcstAddr; break;
+  case VX1290A_MCST_CBLT_CTRL_ADD : *value = mcstCtrl; break;
+  case VX1290A_EVENT_COUNTER_ADD : *value = counter; break;
+  case VX1290A_EVENT_STORED_ADD : *value = sizes.size(); break;
+  case VX1290A_ALMOST_FULL_LVL_ADD : *value = almostFull; break;
+  case VX1290A_BLT_EVENT_NUM_ADD : *value = bltEventNum; break;
+  case VX1290A_FW_REV_ADD : *value = 0x0006; break;
+  case VX1290A_TESTREG_ADD : *value = testreg; break;
+  case VX1290A_OUT_PROG_CTRL_ADD : *value = outProg; break;
+  case VX1290A_MICRO_ADD :
+    if (ready && !answer.empty())
+      {
+	*value = answer.front();
+	answer.pop_front();
+	microReady = now + microWord;
+      }
+    else
+      {
+	*value = 0;
+	++protocolErrors;
+      }
+    break;
+  case VX1290A_MICRO_HND_ADD :
+    *value = (ready && answer.empty() ? VX1290A_WRITE_OK : 0) | (ready && !answer.empty() ? VX1290A_READ_OK : 0);
+    break;
+  case VX1290A_EVENT_FIFO_ADD :
+    if (fifo.empty()) *value = 0;
+    else
+      {
+	*value = fifo.front();
+	fifo.pop_front();
+      }
+    break;
+  case VX1290A_EVENT_FIFO_STORED_ADD : *value = fifo.size(); break;
+  case VX1290A_EVENT_FIFO_STATUS_ADD :
+    *value = (fifo.empty() ? 0 : 0x1) | (fifo.size() >= SIM_VX1290A_FIFO_EVENTS ? 0x2 : 0);
+    break;
+  case VX1290A_DUMMY32_ADD : *value = dummy32; break;
+  case VX1290A_DUMMY16_ADD : *value = dummy16; break;
+  default : *value = 0; break;
+  }
+  return cvSuccess;
+}
+
+CVErrorCodes SIM_VX1290A::Write(uint32_t offset, uint32_t value, double now)
+{
+  if (!Valid(offset) || offset < 0x1000) return cvBusError;
+  switch (offset) {
+  case VX1290A_CONTROL_ADD : control = value & 0x3ff; break;
+  case VX1290A_INT_LEVEL_ADD : intLevel = value & 0x7; break;
+  case VX1290A_INT_VECTOR_ADD : intVector = value & 0xff; break;
+  case VX1290A_GEO_ADDRESS_ADD : geo = value & 0x1f; break;
+  case VX1290A_MCST_CBLT_ADDRESS_ADD : mcstAddr = value & 0xff; break;
+  case VX1290A_MCST_CBLT_CTRL_ADD : mcstCtrl = value & 0x3; break;
+  case VX1290A_MOD_RESET_ADD : Reset(now); break;
+  case VX1290A_SW_CLEAR_ADD : Clear(); break;
+  case VX1290A_SW_EVENT_RESET_ADD : counter = 0; break;
+  case VX1290A_SW_TRIGGER_ADD : Trigger(SIM_Pulse(now)); break;
+  case VX1290A_ALMOST_FULL_LVL_ADD : almostFull = value & 0xffff; break;
+  case VX1290A_BLT_EVENT_NUM_ADD : bltEventNum = value & 0xff; break;
+  case VX1290A_TESTREG_ADD : testreg = value; break;
+  case VX1290A_OUT_PROG_CTRL_ADD : outProg = value & 0x7; break;
+  case VX1290A_MICRO_ADD : MicroWrite(value & 0xffff, now); break;
+  case VX1290A_DUMMY32_ADD : dummy32 = value; break;
+  case VX1290A_DUMMY16_ADD : dummy16 = value & 0xffff; break;
+  default : break;
+  }
+  return cvSuccess;
+}
+
+// Number of parameter words that follow an opcode
+static int SIM_OpCodeParams(uint16_t code)
+{
+  switch (code) {
+  case VX1290A_SET_WIN_WIDTH_OPCODE >> 8 :
+  case VX1290A_SET_WIN_OFFSET_OPCODE >> 8 :
+  case VX1290A_SET_SW_MARGIN_OPCODE >> 8 :
+  case VX1290A_SET_REJ_MARGIN_OPCODE >> 8 :
+  case VX1290A_SET_DETECTION_OPCODE >> 8 :
+  case VX1290A_SET_TR_LEAD_LSB_OPCODE >> 8 :
+  case VX1290A_SET_PAIR_RES_OPCODE >> 8 :
+  case VX1290A_SET_DEAD_TIME_OPCODE >> 8 :
+  case VX1290A_SET_EVENT_SIZE_OPCODE >> 8 :
+  case VX1290A_SET_ERROR_TYPES_OPCODE >> 8 :
+  case VX1290A_SET_FIFO_SIZE_OPCODE >> 8 :
+  case VX1290A_SET_ADJUST_CH_OPCODE >> 8 :
+  case VX1290A_SET_RC_ADJ_OPCODE >> 8 :
+    return 1;
+  case VX1290A_WRITE_EN_PATTERN_OPCODE >> 8 :
+  case VX1290A_WRITE_EN_PATTERN32_OPCODE >> 8 :
+  case VX1290A_SET_GLOB_OFFSET_OPCODE >> 8 :
+    return 2;
+  default :
+    return 0;
+  }
+}
+
+void SIM_VX1290A::MicroWrite(uint16_t word, double now)
+{
+  if (now < microReady || !answer.empty())
+    {
+      // not WRITE_OK: the word is lost
+      ++protocolErrors;
+      return;
+    }
+  microReady = now + microWord;
+  if (want > 0)
+    {
+      param[nparam++] = word;
+      if (--want == 0) Execute();
+      return;
+    }
+  opcode = word;
+  nparam = 0;
+  want = SIM_OpCodeParams(word >> 8);
+  if (want == 0) Execute();
+}
+
+void SIM_VX1290A::Execute()
+{
+  uint32_t ch = opcode & 0x1f;
+  switch (opcode >> 8) {
+  case VX1290A_TRG_MATCH_OPCODE >> 8 : cfg.triggerMatching = true; break;
+  case VX1290A_CONT_STORE_OPCODE >> 8 : cfg.triggerMatching = false; break;
+  case VX1290A_READ_ACQ_MOD_OPCODE >> 8 : answer.push_back(cfg.triggerMatching ? 1 : 0); break;
+  case VX1290A_LOAD_DEF_CONFIG_OPCODE >> 8 : cfg = SIM_VX1290A_Config(); break;
+  case VX1290A_SAVE_USER_CONFIG_OPCODE >> 8 : user = cfg; break;
+  case VX1290A_LOAD_USER_CONFIG_OPCODE >> 8 : cfg = user; break;
+  case VX1290A_SET_WIN_WIDTH_OPCODE >> 8 : cfg.winWidth = param[0]; break;
+  case VX1290A_SET_WIN_OFFSET_OPCODE >> 8 : cfg.winOffset = param[0]; break;
+  case VX1290A_SET_SW_MARGIN_OPCODE >> 8 : cfg.swMargin = param[0]; break;
+  case VX1290A_SET_REJ_MARGIN_OPCODE >> 8 : cfg.rejMargin = param[0]; break;
+  case VX1290A_EN_SUB_TRG_OPCODE >> 8 : cfg.subTrigger = true; break;
+  case VX1290A_DIS_SUB_TRG_OPCODE >> 8 : cfg.subTrigger = false; break;
+  case VX1290A_READ_TRG_CONF_OPCODE >> 8 :
+    answer.push_back(cfg.winWidth);
+    answer.push_back(cfg.winOffset);
+    answer.push_back(cfg.swMargin);
+    answer.push_back(cfg.rejMargin);
+    answer.push_back(cfg.subTrigger ? 1 : 0);
+    break;
+  case VX1290A_SET_DETECTION_OPCODE >> 8 : cfg.detection = param[0] & 0x3; break;
+  case VX1290A_READ_DETECTION_OPCODE >> 8 : answer.push_back(cfg.detection); break;
+  case VX1290A_SET_TR_LEAD_LSB_OPCODE >> 8 : cfg.lsb = param[0] & 0x3; break;
+  case VX1290A_SET_PAIR_RES_OPCODE >> 8 : cfg.pairRes = param[0]; break;
+  case VX1290A_READ_RES_OPCODE >> 8 : answer.push_back(cfg.detection == 0 ? cfg.pairRes : cfg.lsb); break;
+  case VX1290A_SET_DEAD_TIME_OPCODE >> 8 : cfg.deadTime = param[0] & 0x3; break;
+  case VX1290A_READ_DEAD_TIME_OPCODE >> 8 : answer.push_back(cfg.deadTime); break;
+  case VX1290A_EN_HEAD_TRAILER_OPCODE >> 8 : cfg.headerTrailer = true; break;
+  case VX1290A_DIS_HEAD_TRAILER_OPCODE >> 8 : cfg.headerTrailer = false; break;
+  case VX1290A_READ_HEAD_TRAILER_OPCODE >> 8 : answer.push_back(cfg.headerTrailer ? 1 : 0); break;
+  case VX1290A_SET_EVENT_SIZE_OPCODE >> 8 : cfg.eventSize = param[0] & 0xf; break;
+  case VX1290A_READ_EVENT_SIZE_OPCODE >> 8 : answer.push_back(cfg.eventSize); break;
+  case VX1290A_EN_ERROR_MARK_OPCODE >> 8 : cfg.errorMark = true; break;
+  case VX1290A_DIS_ERROR_MARK_OPCODE >> 8 : cfg.errorMark = false; break;
+  case VX1290A_EN_ERROR_BYPASS_OPCODE >> 8 : cfg.errorBypass = true; break;
+  case VX1290A_DIS_ERROR_BYPASS_OPCODE >> 8 : cfg.errorBypass = false; break;
+  case VX1290A_SET_ERROR_TYPES_OPCODE >> 8 : cfg.errorTypes = param[0] & 0x7ff; break;
+  case VX1290A_READ_ERROR_TYPES_OPCODE >> 8 : answer.push_back(cfg.errorTypes); break;
+  case VX1290A_SET_FIFO_SIZE_OPCODE >> 8 : cfg.fifoSize = param[0] & 0x7; break;
+  case VX1290A_READ_FIFO_SIZE_OPCODE >> 8 : answer.push_back(cfg.fifoSize); break;
+  case VX1290A_EN_CHANNEL_OPCODE >> 8 : cfg.enable |= 1u << ch; break;
+  case VX1290A_DIS_CHANNEL_OPCODE >> 8 : cfg.enable &= ~(1u << ch); break;
+  case VX1290A_EN_ALL_CH_OPCODE >> 8 : cfg.enable = 0xffffffff; break;
+  case VX1290A_DIS_ALL_CH_OPCODE >> 8 : cfg.enable = 0; break;
+  case VX1290A_WRITE_EN_PATTERN_OPCODE >> 8 : cfg.enable = param[0] | (uint32_t)param[1] << 16; break;
+  case VX1290A_READ_EN_PATTERN_OPCODE >> 8 :
+    answer.push_back(cfg.enable & 0xffff);
+    answer.push_back(cfg.enable >> 16);
+    break;
+  case VX1290A_WRITE_EN_PATTERN32_OPCODE >> 8 :
+    {
+      // the 8 channels of one TDC chip
+      uint32_t shift = 8*(opcode & 0x3);
+      cfg.enable = (cfg.enable & ~(0xffu << shift)) | (uint32_t)(param[0] & 0xff) << shift;
+    }
+    break;
+  case VX1290A_READ_EN_PATTERN32_OPCODE >> 8 :
+    answer.push_back((cfg.enable >> 8*(opcode & 0x3)) & 0xff);
+    answer.push_back(0);
+    break;
+  case VX1290A_SET_GLOB_OFFSET_OPCODE >> 8 :
+    cfg.globOffset[0] = param[0];
+    cfg.globOffset[1] = param[1];
+    break;
+  case VX1290A_READ_GLOB_OFFSET_OPCODE >> 8 :
+    answer.push_back(cfg.globOffset[0]);
+    answer.push_back(cfg.globOffset[1]);
+    break;
+  case VX1290A_SET_ADJUST_CH_OPCODE >> 8 : cfg.adjust[ch] = param[0]; break;
+  case VX1290A_READ_ADJUST_CH_OPCODE >> 8 : answer.push_back(cfg.adjust[ch]); break;
+  case VX1290A_SET_RC_ADJ_OPCODE >> 8 : cfg.rcAdjust = param[0]; break;
+  case VX1290A_READ_RC_ADJ_OPCODE >> 8 : answer.push_back(cfg.rcAdjust); break;
+  case VX1290A_READ_TDC_ID_OPCODE >> 8 :
+    answer.push_back(0xDACE);
+    answer.push_back(0x8470);
+    break;
+  case VX1290A_READ_MICRO_REV_OPCODE >> 8 : answer.push_back(0x0011); break;
+  default : break;
+  }
+}
+
+// One trigger in trigger matching mode: global header, per TDC chip a
+// header, the hits in the window and a trailer, the extended trigger time
+// (control bit 9) and the global trailer. The hit times are counted from
+// the start of the window when the trigger time is subtracted. A lost
+// event is counted but never reaches the buffer. An extra event is one the
+// MQDC32 did not see; it is counted when read out.
+void SIM_VX1290A::Trigger(const SIM_Pulse & p, bool lose, bool extra)
+{
+  ++triggers;
+  if (!cfg.triggerMatching) return;
+  uint32_t evt = counter++;
+  static const double lsbns[4] = { 0.8, 0.2, 0.1, 0.025 };
+  double tns = 1e9*p.time;
+  double offset = 25.0*(int16_t)cfg.winOffset;
+  double width = 25.0*cfg.winWidth;
+  bool leading = cfg.detection != 1;
+  bool trailing = cfg.detection == 1 || cfg.detection == 3;
+
+  std::vector<uint32_t> ev;
+  ev.push_back(VX1290A_ID_GLOBAL_HEADER << 27 | (evt & 0x3fffff) << 5 | (geo & 0x1f));
+  uint32_t nhits = 0;
+  for (uint32_t k = 0; k < VX1290A_NUM_TDC; ++k)
+    {
+      size_t first = ev.size();
+      if (cfg.headerTrailer) ev.push_back(VX1290A_ID_TDC_HEADER << 27 | k << 24 | (evt & 0xfff) << 12 | ((uint32_t)(tns/25) & 0xfff));
+      for (uint32_t c = 8*k; c < 8*k+8; ++c)
+	{
+	  if (!p.tdc[c] || !(cfg.enable >> c & 1)) continue;
+	  for (uint32_t edge = 0; edge < 2; ++edge)
+	    {
+	      if ((edge == 0 && !leading) || (edge == 1 && !trailing)) continue;
+	      double t = p.tdc_ns[c] + edge*SIM_VX1290A_TRAILING_NS;
+	      if (t < offset || t >= offset+width) continue;
+	      double m = cfg.subTrigger ? t-offset : tns+t;
+	      ev.push_back(VX1290A_ID_TDC_MEASUREMENT << 27 | edge << 26 | c << 21 | ((uint32_t)(m/lsbns[cfg.lsb & 3]) & 0x1fffff));
+	      ++nhits;
+	    }
+	}
+      if (cfg.headerTrailer) ev.push_back(VX1290A_ID_TDC_TRAILER << 27 | k << 24 | (evt & 0xfff) << 12 | ((ev.size()-first+1) & 0xfff));
+    }
+  // no empty events unless control bit 3 asks for them
+  if (lose || (nhits == 0 && !(control & 0x8))) return;
+  if (control & 0x200) ev.push_back(VX1290A_ID_GLOBAL_TRIG_TIME << 27 | ((uint32_t)(tns/800) & 0x7ffffff));
+  ev.push_back(VX1290A_ID_GLOBAL_TRAILER << 27 | (triggerLost ? 1u << 26 : 0) | ((ev.size()+1) & 0xffff) << 5 | (geo & 0x1f));
+  if ((control & 0x10) && (ev.size() & 1)) ev.push_back(VX1290A_ID_FILLER << 27);
+
+  if (buffer.size() + ev.size() > SIM_VX1290A_BUFFER_WORDS
+      || ((control & 0x100) && fifo.size() >= SIM_VX1290A_FIFO_EVENTS))
+    {
+      triggerLost = true;
+      return;
+    }
+  triggerLost = false;
+  buffer.insert(buffer.end(), ev.begin(), ev.end());
+  sizes.push_back(ev.size());
+  extras.push_back(extra);
+  if (control & 0x100) fifo.push_back((evt & 0xffff) << 16 | (ev.size() & 0xffff));
+}
+
+// Next word of the output buffer; false at its end, or in a block
+// transfer after VX1290A_BLT_EVENT_NUM_ADD whole events
+bool SIM_VX1290A::Pop(uint32_t * word, bool block)
+{
+  if (buffer.empty()) return false;
+  if (block && bltEventNum > 0 && bltEvents >= bltEventNum && !midEvent) return false;
+  *word = buffer.front();
+  buffer.pop_front();
+  midEvent = true;
+  if (--sizes.front() == 0)
+    {
+      sizes.pop_front();
+      if (extras.front()) ++extraRead;
+      extras.pop_front();
+      midEvent = false;
+      ++bltEvents;
+    }
+  return true;
+}
+
+uint32_t SIM_VX1290A::IRQLevel() const
+{
+  if (intLevel == 0 || buffer.empty() || buffer.size() < almostFull) return 0;
+  return intLevel;
+}
+
+bool SIM_VX1290A::InChain(uint32_t high) const
+{
+  return mcstCtrl != VX1290A_CBLT_DISABLED && mcstAddr == high;
+}
+
+int SIM_VX1290A::ChainPosition() const
+{
+  switch (mcstCtrl) {
+  case VX1290A_CBLT_FIRST : return 0;
+  case VX1290A_CBLT_MIDDLE : return 1;
+  default : return 2;
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef SIMVX1290A_H
+#define SIMVX1290A_H
+
+#include <deque>
+
+#include "VMESim.h"
+
+#define SIM_VX1290A_BUFFER_WORDS 32768   /* output buffer */
+#define SIM_VX1290A_FIFO_EVENTS 1024     /* event FIFO */
+#define SIM_VX1290A_TRAILING_NS 20       /* leading to trailing edge of a hit */
+
+// The settings held by the micro controller, written and read back with
+// the opcodes through VX1290A_MICRO_ADD
+struct SIM_VX1290A_Config {
+  bool triggerMatching;
+  uint16_t winWidth;
+  uint16_t winOffset;
+  uint16_t swMargin;
+  uint16_t rejMargin;
+  bool subTrigger;
+  uint16_t detection;
+  uint16_t lsb;
+  uint16_t pairRes;
+  uint16_t deadTime;
+  bool headerTrailer;
+  uint16_t eventSize;
+  bool errorMark;
+  bool errorBypass;
+  uint16_t errorTypes;
+  uint16_t fifoSize;
+  uint32_t enable;           // one bit per channel
+  uint16_t globOffset[2];
+  uint16_t adjust[SIM_MAX_CHANNELS];
+  uint16_t rcAdjust;
+  SIM_VX1290A_Config();
+};
+
+// The VX1290A as the bus sees it: registers, the micro controller
+// handshake (VX1290A_MICRO_HND_ADD) and the output buffer with its event
+// FIFO. An opcode word is taken when WRITE_OK is set, its parameters
+// follow one by one, and its answers are read while READ_OK is set; the
+// micro controller is busy for the configured time after each word. Only
+// trigger matching mode produces data.
+struct SIM_VX1290A {
+  uint16_t control;
+  uint16_t intLevel;
+  uint16_t intVector;
+  uint16_t geo;
+  uint16_t mcstAddr;
+  uint16_t mcstCtrl;
+  uint16_t almostFull;
+  uint16_t bltEventNum;
+  uint16_t outProg;
+  uint16_t testreg;
+  uint16_t dummy16;
+  uint32_t dummy32;
+  std::deque<uint32_t> buffer;
+  std::deque<uint32_t> sizes;      // words of each event in the buffer
+  std::deque<bool> extras;         // which of them came from a trigger the MQDC32 did not see
+  std::deque<uint32_t> fifo;       // event FIFO entries
+  bool midEvent;                   // part of the first event was read
+  uint32_t bltEvents;              // events sent in the current block transfer
+  uint32_t counter;
+  bool triggerLost;
+  SIM_VX1290A_Config cfg;
+  SIM_VX1290A_Config user;
+  uint16_t opcode;
+  int want;                        // parameters still to come
+  int nparam;
+  uint16_t param[4];
+  std::deque<uint16_t> answer;
+  double microReady;
+  double microWord;
+  uint64_t triggers;
+  uint64_t protocolErrors;
+  uint64_t extraRead;              // events of such triggers read out
+
+  SIM_VX1290A();
+  void Reset(double now);
+  void Clear();
+  bool Valid(uint32_t offset) const;
+  CVErrorCodes Read(uint32_t offset, double now, uint32_t * value);
+  CVErrorCodes Write(uint32_t offset, uint32_t value, double now);
+  void Trigger(const SIM_Pulse & p, bool lose = false, bool extra = false);
+  void BeginBlock() { bltEvents = 0; }
+  bool Pop(uint32_t * word, bool block);
+  uint32_t IRQLevel() const;
+  bool InChain(uint32_t high) const;
+  int ChainPosition() const;
+ private:
+  void MicroWrite(uint16_t word, double now);
+  void Execute();
+};
+
+#endif
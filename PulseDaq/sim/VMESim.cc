@@ -0,0 +1,614 @@
+#include "VMESim.h"
+#include "SimMQDC32.h"
+#include "SimVX1290A.h"
+
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+#include "../MQDC32.h"
+#include "../VX1290A.h"
+
+SIM_Config::SIM_Config()
+  : rate(1000), poisson(false), seed(1), berr(0), desync(0), extra_tdc(0), cycle_us(0), blt_mbs(0), micro_us(20),
+    qdc_channels(1,0x4), tdc_le(1,0x4), tdc_max(1,0x1a), adc_mean(800), adc_sigma(40),
+    tdc_time_ns(-100), risetime_ns(4), risetime_sigma_ns(0.3)
+{
+}
+
+static void SIM_EnvDouble(const char * name, double * value)
+{
+  const char * s = getenv(name);
+  if (s && *s) *value = strtod(s,NULL);
+}
+
+static void SIM_EnvChannels(const char * name, std::vector<uint32_t> * channels)
+{
+  const char * s = getenv(name);
+  if (!s) return;
+  std::string list(s);
+  for (auto & c : list) if (c == ',') c = ' ';
+  std::stringstream ss(list);
+  std::string word;
+  channels->clear();
+  while (ss >> word)
+    {
+      uint32_t c = strtoul(word.c_str(),NULL,0);
+      if (c < SIM_MAX_CHANNELS) channels->push_back(c);
+    }
+}
+
+void SIM_Config::ReadEnvironment()
+{
+  double d;
+  SIM_EnvDouble("PULSEDAQ_SIM_RATE",&rate);
+  d = poisson;
+  SIM_EnvDouble("PULSEDAQ_SIM_POISSON",&d);
+  poisson = d != 0;
+  d = seed;
+  SIM_EnvDouble("PULSEDAQ_SIM_SEED",&d);
+  seed = d;
+  SIM_EnvDouble("PULSEDAQ_SIM_BERR",&berr);
+  SIM_EnvDouble("PULSEDAQ_SIM_DESYNC",&desync);
+  SIM_EnvDouble("PULSEDAQ_SIM_EXTRA_TDC",&extra_tdc);
+  SIM_EnvDouble("PULSEDAQ_SIM_CYCLE_US",&cycle_us);
+  SIM_EnvDouble("PULSEDAQ_SIM_BLT_MBS",&blt_mbs);
+  SIM_EnvDouble("PULSEDAQ_SIM_MICRO_US",&micro_us);
+  SIM_EnvChannels("PULSEDAQ_SIM_QDC_CHANNELS",&qdc_channels);
+  SIM_EnvChannels("PULSEDAQ_SIM_TDC_LE",&tdc_le);
+  SIM_EnvChannels("PULSEDAQ_SIM_TDC_MAX",&tdc_max);
+  SIM_EnvDouble("PULSEDAQ_SIM_ADC_MEAN",&adc_mean);
+  SIM_EnvDouble("PULSEDAQ_SIM_ADC_SIGMA",&adc_sigma);
+  SIM_EnvDouble("PULSEDAQ_SIM_TDC_TIME_NS",&tdc_time_ns);
+  SIM_EnvDouble("PULSEDAQ_SIM_RISETIME_NS",&risetime_ns);
+  SIM_EnvDouble("PULSEDAQ_SIM_RISETIME_SIGMA_NS",&risetime_sigma_ns);
+}
+
+void SIM_Config::Print()
+{
+  std::cout << "Simulated VME bus: " << rate << " triggers/s" << (poisson ? " (random)" : "")
+	    << ", bus errors " << berr << ", desync " << desync
+	    << ", extra VX1290A triggers " << extra_tdc
+	    << ", " << cycle_us << " us/cycle";
+  if (blt_mbs > 0) std::cout << ", " << blt_mbs << " MB/s";
+  std::cout << ", seed " << seed << std::endl;
+}
+
+SIM_Pulse::SIM_Pulse(double t)
+  : time(t)
+{
+  for (int c = 0; c < SIM_MAX_CHANNELS; ++c)
+    {
+      qdc[c] = false;
+      adc[c] = 0;
+      tdc[c] = false;
+      tdc_ns[c] = 0;
+    }
+}
+
+// The V1718 and its crate
+struct SIM_Bus {
+  bool open;
+  bool configured;
+  SIM_Config cfg;
+  std::mt19937 rng;
+  std::chrono::steady_clock::time_point t0;
+  double nextTrigger;
+  double lastTrigger;
+  uint32_t irqEnabled;
+  SIM_MQDC32 qdc;
+  SIM_VX1290A tdc;
+  uint64_t triggers;
+  uint64_t busy;
+  uint64_t qdcLost;
+  uint64_t tdcLost;
+  uint64_t tdcExtra;
+  uint64_t berrs;
+  uint64_t calls;
+  uint64_t blockWords;
+SIM_Bus() : open(false), configured(false) {}
+};
+
+static SIM_Bus bus;
+
+void SIM_Configure(const SIM_Config & c)
+{
+  bus.cfg = c;
+  bus.configured = true;
+}
+
+static double SIM_Now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - bus.t0).count();
+}
+
+static double SIM_Uniform()
+{
+  return std::uniform_real_distribution<double>(0,1)(bus.rng);
+}
+
+static double SIM_Gauss(double mean, double sigma)
+{
+  if (sigma <= 0) return mean;
+  return std::normal_distribution<double>(mean,sigma)(bus.rng);
+}
+
+static double SIM_NextTrigger(double t)
+{
+  if (bus.cfg.rate <= 0) return HUGE_VAL;
+  if (bus.cfg.poisson) return t + std::exponential_distribution<double>(bus.cfg.rate)(bus.rng);
+  return t + 1/bus.cfg.rate;
+}
+
+// The time a bus call takes: one transaction plus the bytes at the block
+// transfer speed. Spun, as usleep is far coarser than a VME cycle.
+static void SIM_Spend(uint32_t bytes)
+{
+  ++bus.calls;
+  double t = 1e-6*bus.cfg.cycle_us;
+  if (bus.cfg.blt_mbs > 0) t += bytes/(1e6*bus.cfg.blt_mbs);
+  if (t <= 0) return;
+  auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(t);
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+static bool SIM_InjectError()
+{
+  if (bus.cfg.berr <= 0 || SIM_Uniform() >= bus.cfg.berr) return false;
+  ++bus.berrs;
+  return true;
+}
+
+static void SIM_Trigger(double t)
+{
+  ++bus.triggers;
+  double last = bus.lastTrigger;
+  bus.lastTrigger = t;
+  if (!bus.qdc.Accepting(t))
+    {
+      ++bus.busy;
+      return;
+    }
+  SIM_Pulse p(t);
+  for (auto c : bus.cfg.qdc_channels)
+    {
+      double adc = SIM_Gauss(bus.cfg.adc_mean,bus.cfg.adc_sigma);
+      p.qdc[c] = true;
+      p.adc[c] = adc > 0 ? (uint32_t)adc : 0;
+    }
+  double le = bus.cfg.tdc_time_ns;
+  double rise = SIM_Gauss(bus.cfg.risetime_ns,bus.cfg.risetime_sigma_ns);
+  for (auto c : bus.cfg.tdc_le)
+    {
+      p.tdc[c] = true;
+      p.tdc_ns[c] = le;
+    }
+  for (auto c : bus.cfg.tdc_max)
+    {
+      p.tdc[c] = true;
+      p.tdc_ns[c] = le + rise;
+    }
+  // both modules count the trigger, but with a desync injected one of
+  // them loses the event, as a module dropping an event or a readout
+  // that misses one leaves the two out of step
+  bool loseQDC = false, loseTDC = false;
+  if (bus.cfg.desync > 0 && SIM_Uniform() < bus.cfg.desync)
+    {
+      if (SIM_Uniform() < 0.5)
+	{
+	  loseQDC = true;
+	  ++bus.qdcLost;
+	}
+      else
+	{
+	  loseTDC = true;
+	  ++bus.tdcLost;
+	}
+    }
+  bus.qdc.Convert(p,loseQDC);
+  // a trigger only the VX1290A takes, as noise on its trigger input: it
+  // counts it like any other, so only the trigger times show it. Not
+  // before the first event after a clear, which the builder takes as the
+  // first pair.
+  if (bus.cfg.extra_tdc > 0 && bus.tdc.counter > 0 && SIM_Uniform() < bus.cfg.extra_tdc)
+    {
+      SIM_Pulse extra = p;
+      extra.time = 0.5*(last+t);
+      bus.tdc.Trigger(extra,false,true);
+      ++bus.tdcExtra;
+    }
+  bus.tdc.Trigger(p,loseTDC);
+}
+
+// Run the pulser up to now. Triggers while the MQDC32 cannot take them
+// (stopped, single event not read, buffer full) are only counted, and
+// beyond SIM_CATCHUP_S they are not simulated one by one.
+static void SIM_Advance()
+{
+  double now = SIM_Now();
+  if (bus.nextTrigger < now - SIM_CATCHUP_S)
+    {
+      uint64_t skipped = (uint64_t)((now - SIM_CATCHUP_S - bus.nextTrigger)*bus.cfg.rate);
+      bus.triggers += skipped;
+      bus.busy += skipped;
+      bus.nextTrigger = SIM_NextTrigger(now - SIM_CATCHUP_S);
+    }
+  while (bus.nextTrigger <= now)
+    {
+      SIM_Trigger(bus.nextTrigger);
+      bus.nextTrigger = SIM_NextTrigger(bus.nextTrigger);
+    }
+}
+
+static CVErrorCodes SIM_Check(int32_t Handle)
+{
+  if (!bus.open || Handle != 0) return cvInvalidParam;
+  SIM_Advance();
+  return cvSuccess;
+}
+
+// Which module an address belongs to
+enum SIM_Target {
+  SIM_NONE,
+  SIM_QDC,
+  SIM_TDC,
+  SIM_CHAIN
+};
+
+static bool SIM_IsA24(CVAddressModifier AM)
+{
+  return AM >= 0x38 && AM <= 0x3F;
+}
+
+static SIM_Target SIM_Decode(uint32_t Address, CVAddressModifier AM, uint32_t * offset)
+{
+  *offset = Address & 0xffff;
+  if (SIM_IsA24(AM))
+    {
+      if ((Address & 0xff0000) == (VX1290A_BASE & 0xff0000)) return SIM_TDC;
+      if ((Address & 0xff0000) == (MQDC32_BASE & 0xff0000)) return SIM_QDC;
+      return SIM_NONE;
+    }
+  if (AM > 0x0F) return SIM_NONE;
+  if ((Address & 0xffff0000) == (MQDC32_BASE & 0xffff0000)) return SIM_QDC;
+  if ((Address & 0xffff0000) == (VX1290A_BASE & 0xffff0000)) return SIM_TDC;
+  uint32_t high = Address >> 24;
+  if (bus.qdc.InChain(high) || bus.qdc.InMulticast(high) || bus.tdc.InChain(high)) return SIM_CHAIN;
+  return SIM_NONE;
+}
+
+static uint32_t SIM_Width(CVDataWidth DW)
+{
+  uint32_t bytes = DW & 0x0F;
+  return bytes > 4 ? 4 : bytes;
+}
+
+// Output buffer reads are data reads, where bus errors are injected
+static bool SIM_IsData(SIM_Target target, uint32_t offset)
+{
+  return (target == SIM_QDC && offset < 0x8) || (target == SIM_TDC && offset < 0x1000);
+}
+
+static CVErrorCodes SIM_Read(uint32_t Address, uint32_t * value, CVAddressModifier AM)
+{
+  uint32_t offset;
+  SIM_Target target = SIM_Decode(Address,AM,&offset);
+  if (SIM_IsData(target,offset) && SIM_InjectError()) return cvBusError;
+  double now = SIM_Now();
+  switch (target) {
+  case SIM_QDC : return bus.qdc.Read(offset,now,value);
+  case SIM_TDC : return bus.tdc.Read(offset,now,value);
+  default : return cvBusError;
+  }
+}
+
+// A multicast write goes to every module of the chain; the last one
+// acknowledges it, so it ends with a bus error if that module has no such
+// register
+static CVErrorCodes SIM_Write(uint32_t Address, uint32_t value, CVAddressModifier AM)
+{
+  uint32_t offset;
+  SIM_Target target = SIM_Decode(Address,AM,&offset);
+  double now = SIM_Now();
+  switch (target) {
+  case SIM_QDC : return bus.qdc.Write(offset,value,now);
+  case SIM_TDC : return bus.tdc.Write(offset,value,now);
+  case SIM_CHAIN :
+    {
+      uint32_t high = Address >> 24;
+      CVErrorCodes qret = cvBusError, tret = cvBusError;
+      if (bus.qdc.InMulticast(high)) qret = bus.qdc.Write(offset,value,now);
+      if (bus.tdc.InChain(high)) tret = bus.tdc.Write(offset,value,now);
+      bool qdcLast = bus.qdc.InMulticast(high) && (!bus.tdc.InChain(high) || bus.qdc.ChainPosition() >= bus.tdc.ChainPosition());
+      return qdcLast ? qret : tret;
+    }
+  default : return cvBusError;
+  }
+}
+
+extern "C" {
+
+CVErrorCodes CAENVME_Init(CVBoardTypes BdType, short Link, short BdNum, int32_t *Handle)
+{
+  if (bus.open) return cvGenericError;
+  if (!bus.configured)
+    {
+      bus.cfg = SIM_Config();
+      bus.cfg.ReadEnvironment();
+    }
+  bus.cfg.Print();
+  bus.rng.seed(bus.cfg.seed);
+  bus.t0 = std::chrono::steady_clock::now();
+  bus.nextTrigger = SIM_NextTrigger(0);
+  bus.lastTrigger = 0;
+  bus.irqEnabled = 0;
+  bus.qdc = SIM_MQDC32();
+  bus.tdc = SIM_VX1290A();
+  bus.tdc.microWord = 1e-6*bus.cfg.micro_us;
+  bus.triggers = bus.busy = bus.qdcLost = bus.tdcLost = bus.tdcExtra = bus.berrs = bus.calls = bus.blockWords = 0;
+  bus.open = true;
+  *Handle = 0;
+  (void)BdType;
+  (void)Link;
+  (void)BdNum;
+  return cvSuccess;
+}
+
+CVErrorCodes CAENVME_End(int32_t Handle)
+{
+  if (!bus.open || Handle != 0) return cvInvalidParam;
+  bus.open = false;
+  std::cout << "\nSimulated VME bus: " << bus.triggers << " triggers, " << bus.qdc.converted << " MQDC32 events, "
+	    << bus.busy << " lost while busy, " << bus.tdc.triggers << " VX1290A triggers, "
+	    << bus.qdcLost << " MQDC32 and " << bus.tdcLost << " VX1290A events lost, "
+	    << bus.tdcExtra << " extra VX1290A triggers (" << bus.tdc.extraRead << " read), "
+	    << bus.berrs << " bus errors injected, " << bus.calls << " bus calls, "
+	    << bus.blockWords << " words in block transfers";
+  if (bus.tdc.protocolErrors) std::cout << ", " << bus.tdc.protocolErrors << " VX1290A opcode handshake errors";
+  std::cout << std::endl;
+  return cvSuccess;
+}
+
+CVErrorCodes CAENVME_SystemReset(int32_t Handle)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  double now = SIM_Now();
+  bus.qdc.Reset(now);
+  bus.tdc.Reset(now);
+  return cvSuccess;
+}
+
+CVErrorCodes CAENVME_ReadCycle(int32_t Handle, uint32_t Address, void *Data, CVAddressModifier AM, CVDataWidth DW)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  uint32_t value = 0;
+  ret = SIM_Read(Address,&value,AM);
+  // only the bytes of the data width are written, as by CAENVMElib
+  if (ret == cvSuccess) memcpy(Data,&value,SIM_Width(DW));
+  return ret;
+}
+
+CVErrorCodes CAENVME_WriteCycle(int32_t Handle, uint32_t Address, void *Data, CVAddressModifier AM, CVDataWidth DW)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  uint32_t value = 0;
+  memcpy(&value,Data,SIM_Width(DW));
+  return SIM_Write(Address,value,AM);
+}
+
+CVErrorCodes CAENVME_MultiRead(int32_t Handle, uint32_t *Addrs, uint32_t *Buffer, int NCycles, CVAddressModifier *AMs, CVDataWidth *DWs, CVErrorCodes *ECs)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  for (int i = 0; i < NCycles; ++i)
+    {
+      uint32_t value = 0;
+      ECs[i] = SIM_Read(Addrs[i],&value,AMs[i]);
+      Buffer[i] = value & (SIM_Width(DWs[i]) == 4 ? 0xffffffff : (1u << 8*SIM_Width(DWs[i]))-1);
+      if (ECs[i] != cvSuccess && ret == cvSuccess) ret = ECs[i];
+    }
+  return ret;
+}
+
+CVErrorCodes CAENVME_MultiWrite(int32_t Handle, uint32_t *Addrs, uint32_t *Buffer, int NCycles, CVAddressModifier *AMs, CVDataWidth *DWs, CVErrorCodes *ECs)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  for (int i = 0; i < NCycles; ++i)
+    {
+      uint32_t value = Buffer[i] & (SIM_Width(DWs[i]) == 4 ? 0xffffffff : (1u << 8*SIM_Width(DWs[i]))-1);
+      ECs[i] = SIM_Write(Addrs[i],value,AMs[i]);
+      if (ECs[i] != cvSuccess && ret == cvSuccess) ret = ECs[i];
+    }
+  return ret;
+}
+
+// One module's share of a block transfer: its words up to the end of its
+// data (or of its limited transfer), padded to 64 bits in an MBLT
+static uint32_t SIM_BlockFrom(SIM_Target target, uint32_t * word, uint32_t max, bool mblt)
+{
+  uint32_t n = 0;
+  if (target == SIM_QDC)
+    {
+      while (n < max && bus.qdc.Pop(&word[n])) ++n;
+      if (mblt && (n & 1) && n < max) word[n++] = 0;
+    }
+  else
+    {
+      bus.tdc.BeginBlock();
+      while (n < max && bus.tdc.Pop(&word[n],true)) ++n;
+      if (mblt && (n & 1) && n < max) word[n++] = VX1290A_ID_FILLER << 27;
+      // without BERR the VX1290A sends fillers to the end of the transfer
+      if (!(bus.tdc.control & 0x1)) while (n < max) word[n++] = VX1290A_ID_FILLER << 27;
+    }
+  return n;
+}
+
+// BLT and MBLT, with or without address increment: the output buffers sit
+// at one address, so all four read the same way. A transfer that reaches
+// the end of the data ends with a bus error, as the modules do.
+static CVErrorCodes SIM_Block(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, bool mblt, int *count)
+{
+  *count = 0;
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  uint32_t offset;
+  SIM_Target target = SIM_Decode(Address,AM,&offset);
+  uint32_t * word = (uint32_t*)Buffer;
+  uint32_t max = Size/4;
+  if (mblt) max &= ~1u;
+  // an injected bus error cuts the transfer short, after at least one word
+  if (max > 1 && SIM_InjectError()) max = 1 + (uint32_t)(SIM_Uniform()*(max-1));
+  uint32_t n = 0;
+  double now = SIM_Now();
+  switch (target) {
+  case SIM_QDC :
+    if (now < bus.qdc.readyAt || offset >= 0x8) ret = cvBusError;
+    else n = SIM_BlockFrom(SIM_QDC,word,max,mblt);
+    break;
+  case SIM_TDC :
+    if (offset >= 0x1000) ret = cvBusError;
+    else n = SIM_BlockFrom(SIM_TDC,word,max,mblt);
+    break;
+  case SIM_CHAIN :
+    {
+      // the modules in the order of the token: first, middle, last
+      uint32_t high = Address >> 24;
+      bool qdc = bus.qdc.InChain(high) && now >= bus.qdc.readyAt;
+      bool tdc = bus.tdc.InChain(high);
+      bool tdcFirst = tdc && (!qdc || bus.tdc.ChainPosition() <= bus.qdc.ChainPosition());
+      if (tdcFirst) n += SIM_BlockFrom(SIM_TDC,word+n,max-n,mblt);
+      if (qdc) n += SIM_BlockFrom(SIM_QDC,word+n,max-n,mblt);
+      if (tdc && !tdcFirst) n += SIM_BlockFrom(SIM_TDC,word+n,max-n,mblt);
+    }
+    break;
+  default :
+    ret = cvBusError;
+    break;
+  }
+  if (ret == cvSuccess && n < (uint32_t)Size/4) ret = cvBusError;
+  SIM_Spend(4*n);
+  bus.blockWords += n;
+  *count = 4*n;
+  return ret;
+}
+
+CVErrorCodes CAENVME_BLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, CVDataWidth DW, int *count)
+{
+  (void)DW;
+  return SIM_Block(Handle,Address,Buffer,Size,AM,false,count);
+}
+
+CVErrorCodes CAENVME_FIFOBLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, CVDataWidth DW, int *count)
+{
+  (void)DW;
+  return SIM_Block(Handle,Address,Buffer,Size,AM,false,count);
+}
+
+CVErrorCodes CAENVME_MBLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, int *count)
+{
+  return SIM_Block(Handle,Address,Buffer,Size,AM,true,count);
+}
+
+CVErrorCodes CAENVME_FIFOMBLTReadCycle(int32_t Handle, uint32_t Address, void *Buffer, int Size, CVAddressModifier AM, int *count)
+{
+  return SIM_Block(Handle,Address,Buffer,Size,AM,true,count);
+}
+
+// IRQ lines asserted by the modules, bit L-1 for level L
+static uint32_t SIM_IRQLines()
+{
+  uint32_t lines = 0;
+  uint32_t level = bus.qdc.IRQLevel();
+  if (level) lines |= 1u << (level-1);
+  level = bus.tdc.IRQLevel();
+  if (level) lines |= 1u << (level-1);
+  return lines;
+}
+
+CVErrorCodes CAENVME_IRQCheck(int32_t Handle, CAEN_BYTE *Mask)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  *Mask = SIM_IRQLines();
+  return cvSuccess;
+}
+
+CVErrorCodes CAENVME_IRQEnable(int32_t Handle, uint32_t Mask)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  bus.irqEnabled |= Mask & 0x7f;
+  return cvSuccess;
+}
+
+CVErrorCodes CAENVME_IRQDisable(int32_t Handle, uint32_t Mask)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  bus.irqEnabled &= ~Mask;
+  return cvSuccess;
+}
+
+// Sleep until the next trigger (the only thing that raises an IRQ) or the
+// timeout, whichever comes first
+CVErrorCodes CAENVME_IRQWait(int32_t Handle, uint32_t Mask, uint32_t Timeout)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  Mask &= bus.irqEnabled;
+  if (Mask == 0) return cvGenericError;
+  double deadline = SIM_Now() + 1e-3*Timeout;
+  while (true)
+    {
+      SIM_Advance();
+      if (SIM_IRQLines() & Mask) return cvSuccess;
+      double now = SIM_Now();
+      if (now >= deadline) return cvTimeoutError;
+      double wake = bus.nextTrigger < deadline ? bus.nextTrigger : deadline;
+      if (wake > now) usleep((useconds_t)(1e6*(wake-now)) + 1);
+    }
+}
+
+CVErrorCodes CAENVME_IACKCycle(int32_t Handle, CVIRQLevels Level, void *Vector, CVDataWidth DW)
+{
+  CVErrorCodes ret = SIM_Check(Handle);
+  if (ret != cvSuccess) return ret;
+  SIM_Spend(0);
+  uint32_t vector;
+  if (bus.qdc.IRQLevel() && (1u << (bus.qdc.IRQLevel()-1)) == (uint32_t)Level) vector = bus.qdc.Acknowledge();
+  else if (bus.tdc.IRQLevel() && (1u << (bus.tdc.IRQLevel()-1)) == (uint32_t)Level) vector = bus.tdc.intVector;
+  else return cvBusError;
+  memcpy(Vector,&vector,SIM_Width(DW));
+  return cvSuccess;
+}
+
+const char * CAENVME_DecodeError(CVErrorCodes Code)
+{
+  switch (Code) {
+  case cvSuccess : return "Operation completed successfully";
+  case cvBusError : return "VME bus error during the cycle";
+  case cvCommError : return "Communication error";
+  case cvGenericError : return "Unspecified error";
+  case cvInvalidParam : return "Invalid parameter";
+  case cvTimeoutError : return "Timeout error";
+  }
+  return "Unknown error";
+}
+
+}
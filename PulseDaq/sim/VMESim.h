@@ -0,0 +1,92 @@
+#ifndef VMESIM_H
+#define VMESIM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "CAENVMElib.h"
+
+// Simulated VME crate for "make sim": a V1718 with one MQDC32 at
+// MQDC32_BASE and one VX1290A at VX1290A_BASE (User_Settings.h), answering
+// the CAENVME_* calls of CAENVMElib.h. A pulser triggers the MQDC32 at
+// PULSEDAQ_SIM_RATE; every event the MQDC32 takes triggers the VX1290A, as
+// its gate output does in the lab. The modules are modelled at register
+// level (SimMQDC32.h, SimVX1290A.h), so setup, readout, IRQs and CBLT/MCST
+// go through the same code as with the hardware.
+//
+// Everything is set from the environment when CAENVME_Init is called:
+//   PULSEDAQ_SIM_RATE          triggers per second (default 1000, 0: none)
+//   PULSEDAQ_SIM_POISSON       1: random trigger times instead of a pulser
+//   PULSEDAQ_SIM_SEED          random number seed (default 1)
+//   PULSEDAQ_SIM_BERR          probability that a data read (a block
+//                              transfer or a single cycle on an output
+//                              buffer) ends early with a bus error
+//   PULSEDAQ_SIM_DESYNC        probability per trigger that the MQDC32 or
+//                              the VX1290A counts it but loses the event
+//   PULSEDAQ_SIM_EXTRA_TDC     probability per trigger that the VX1290A
+//                              also takes a trigger of its own, halfway
+//                              from the previous one, that the MQDC32 never
+//                              sees
+//   PULSEDAQ_SIM_CYCLE_US      time one bus call takes (default 0)
+//   PULSEDAQ_SIM_BLT_MBS       block transfer speed in MB/s (default 0: no
+//                              limit)
+//   PULSEDAQ_SIM_MICRO_US      time the VX1290A micro controller takes per
+//                              opcode word (default 20)
+//   PULSEDAQ_SIM_QDC_CHANNELS  MQDC32 channels with a pulse (default 4)
+//   PULSEDAQ_SIM_TDC_LE        VX1290A channels with the leading edge
+//                              (default 4) ...
+//   PULSEDAQ_SIM_TDC_MAX       ... and with the maximum (default 0x1a)
+//   PULSEDAQ_SIM_ADC_MEAN, PULSEDAQ_SIM_ADC_SIGMA   pulse charge in ADC
+//                              counts (default 800, 40)
+//   PULSEDAQ_SIM_TDC_TIME_NS   leading edge relative to the trigger
+//                              (default -100)
+//   PULSEDAQ_SIM_RISETIME_NS, PULSEDAQ_SIM_RISETIME_SIGMA_NS   leading edge
+//                              to maximum (default 4, 0.3)
+// Channel lists are separated by commas or spaces. The counts of triggers,
+// lost triggers and injected errors are printed by CAENVME_End.
+
+#define SIM_MAX_CHANNELS 32
+#define SIM_MQDC32_RESET_US 20000    /* MQDC32 does not answer after a reset */
+#define SIM_VX1290A_RESET_US 20000   /* VX1290A micro controller busy after a reset */
+#define SIM_CATCHUP_S 1.0            /* triggers further behind are counted, not simulated */
+
+struct SIM_Config {
+  double rate;
+  bool poisson;
+  uint32_t seed;
+  double berr;
+  double desync;
+  double extra_tdc;
+  double cycle_us;
+  double blt_mbs;
+  double micro_us;
+  std::vector<uint32_t> qdc_channels;
+  std::vector<uint32_t> tdc_le;
+  std::vector<uint32_t> tdc_max;
+  double adc_mean;
+  double adc_sigma;
+  double tdc_time_ns;
+  double risetime_ns;
+  double risetime_sigma_ns;
+  SIM_Config();
+  void ReadEnvironment();
+  void Print();
+};
+
+// What one trigger leaves in the modules: the charge on each MQDC32
+// channel and the hit times on each VX1290A channel, in ns from the
+// trigger.
+struct SIM_Pulse {
+  double time;                       // s since CAENVME_Init
+  bool qdc[SIM_MAX_CHANNELS];
+  uint32_t adc[SIM_MAX_CHANNELS];
+  bool tdc[SIM_MAX_CHANNELS];
+  double tdc_ns[SIM_MAX_CHANNELS];
+  SIM_Pulse(double t);
+};
+
+// Use c instead of the environment at the next CAENVME_Init
+void SIM_Configure(const SIM_Config & c);
+
+#endif
@@ -0,0 +1,132 @@
+#!/bin/bash
+#
+# Whole-loop check of PulseDaq against the simulated crate (make simcheck).
+# Runs PulseDaqSim in every readout mode with fixed seeds, the event
+# builder modes also with PULSEDAQ_SIM_DESYNC, PULSEDAQ_SIM_BERR and
+# PULSEDAQ_SIM_EXTRA_TDC, and checks that each run reads exactly -n events,
+# none of them in error, and writes one tree entry per event (config_CH4.txt
+# reads one MQDC32 channel). With triggers only the VX1290A saw, the builder
+# must also drop exactly those events and no MQDC32 one.
+# Then prints the event rate against the -multievent batch size.
+# Exits 1 if any run fails.
+#
+# Usage: sim/simcheck.sh [PulseDaqSim] [config file]
+
+set -o pipefail
+
+SIM=`readlink -f ${1:-./PulseDaqSim}`
+CONFIG=`readlink -f ${2:-./config_CH4.txt}`
+NEVENTS=2000
+RATE=20000
+
+if [ ! -x "$SIM" ] || [ ! -f "$CONFIG" ]; then
+    echo "need $SIM and $CONFIG"
+    exit 1
+fi
+
+# the runs write their trees here
+WORKDIR=`mktemp -d`
+trap "rm -rf $WORKDIR" EXIT
+cd $WORKDIR
+
+failed=0
+
+# check <environment> <options>: one run, one line of output
+check()
+{
+    local env="$1"
+    local opts="$2"
+    out=`env PULSEDAQ_SIM_RATE=$RATE $env timeout 120 $SIM -n $NEVENTS -d 0 -config $CONFIG $opts 2>&1 | tr '\r' '\n'`
+    local status=$?
+    local read=`echo "$out" | sed -n 's/^Read \([0-9]*\) events$/\1/p'`
+    local errors=`echo "$out" | sed -n 's/^Error in \([0-9]*\) events$/\1/p'`
+    local entries=`echo "$out" | sed -n 's/^Wrote \([0-9]*\) entries.*/\1/p'`
+    local rate=`echo "$out" | sed -n 's/.* \([0-9]*\) events\/s overall.*/\1/p'`
+    if [ $status -eq 0 ] && [ "$read" = "$NEVENTS" ] && [ "$errors" = "0" ] && [ "$entries" = "$NEVENTS" ]; then
+	printf "ok    %-48s %-40s %8s events/s\n" "$opts" "$env" "$rate"
+    else
+	printf "FAIL  %-48s %-40s read %s, errors %s, entries %s\n" "$opts" "$env" "${read:-?}" "${errors:-?}" "${entries:-?}"
+	echo "$out" | grep -E "rror|TIMEOUT|limited" | head -5 | sed 's/^/        /'
+	failed=1
+	return 1
+    fi
+}
+
+# check_extra <environment> <options>: check, and that the builder dropped
+# the extra VX1290A events read (less those still waiting at the end) and
+# nothing else. Pairing by read order or by event counter drops none.
+check_extra()
+{
+    check "$1" "$2" || return
+    local extra=`echo "$out" | sed -n 's/.* extra VX1290A triggers (\([0-9]*\) read).*/\1/p'`
+    local counts=`echo "$out" | sed -n 's/^Event builder: [0-9]* events built, \([0-9]*\) MQDC32 and \([0-9]*\) VX1290A events dropped, [0-9]* clock resyncs, [0-9]* MQDC32 and \([0-9]*\) VX1290A events left.*/\1 \2 \3/p'`
+    set -- $counts
+    if [ -z "$extra" ] || [ -z "$3" ] || [ "$extra" -eq 0 ] || [ "$1" -ne 0 ] || [ "$2" -gt "$extra" ] || [ "$2" -lt $((extra-$3)) ]; then
+	printf "FAIL  %-48s %s extra VX1290A events read, builder dropped %s MQDC32 and %s VX1290A, %s VX1290A left\n" "" "${extra:-?}" "${1:-?}" "${2:-?}" "${3:-?}"
+	failed=1
+    fi
+}
+
+MODES=(
+    "-readout word"
+    "-readout blt"
+    "-readout mblt"
+    "-readout blt -multievent 20"
+    "-readout blt -irq poll"
+    "-tdc -readout word"
+    "-tdc -readout blt"
+    "-tdc -readout mblt"
+    "-tdc -readout blt -multievent 20"
+    "-tdc -readout word -multievent 20"
+    "-tdc -crate -readout blt"
+    "-tdc -crate -readout mblt"
+    "-tdc -crate -readout blt -multievent 20"
+)
+BUILDER_MODES=(
+    "-tdc -build -readout word"
+    "-tdc -build -readout blt"
+    "-tdc -build -readout mblt -multievent 20"
+    "-tdc -build -crate -readout blt"
+    "-tdc -build -crate -readout mblt -multievent 20"
+)
+
+echo "Readout modes, PULSEDAQ_SIM_SEED=1:"
+for opts in "${MODES[@]}" "${BUILDER_MODES[@]}"; do
+    check "PULSEDAQ_SIM_SEED=1" "$opts"
+done
+
+echo "Event builder with lost events and bus errors:"
+for seed in 1 2 3; do
+    for opts in "${BUILDER_MODES[@]}"; do
+	check "PULSEDAQ_SIM_SEED=$seed PULSEDAQ_SIM_DESYNC=0.01" "$opts"
+    done
+done
+for opts in "${BUILDER_MODES[@]}"; do
+    check "PULSEDAQ_SIM_SEED=4 PULSEDAQ_SIM_DESYNC=0.01 PULSEDAQ_SIM_BERR=0.01" "$opts"
+done
+
+echo "Event builder with triggers only the VX1290A saw:"
+for seed in 1 2; do
+    for opts in "${BUILDER_MODES[@]}"; do
+	check_extra "PULSEDAQ_SIM_SEED=$seed PULSEDAQ_SIM_EXTRA_TDC=0.05" "$opts"
+    done
+done
+
+echo "Limits on -multievent:"
+check "PULSEDAQ_SIM_SEED=1" "-tdc -readout blt -multievent 2000"
+check "PULSEDAQ_SIM_SEED=1" "-tdc -build -readout blt -multievent 2000"
+check "PULSEDAQ_SIM_SEED=1" "-tdc -crate -readout blt -multievent 2000"
+
+# Event rate against the batch size, with the pulser well above what one
+# readout per event can follow and a bus as fast as a V1718 over USB
+echo "Event rate against -multievent (-tdc -readout blt, 200000 triggers/s, 100 us/cycle, 20 MB/s):"
+for m in 1 2 5 10 20 50 100 200; do
+    out=`env PULSEDAQ_SIM_RATE=200000 PULSEDAQ_SIM_SEED=1 PULSEDAQ_SIM_CYCLE_US=100 PULSEDAQ_SIM_BLT_MBS=20 timeout 120 $SIM -n 20000 -d 0 -config $CONFIG -tdc -readout blt -multievent $m 2>&1 | tr '\r' '\n'`
+    printf "  -multievent %-4s %s\n" $m "`echo "$out" | grep "events/s overall" | sed 's/^MQDC32 readout (blt): //'`"
+done
+
+if [ $failed -ne 0 ]; then
+    echo "simcheck FAILED"
+    exit 1
+fi
+echo "simcheck passed"